@@ -2,6 +2,24 @@ gcc `pkg-config --cflags --libs gtk+-2.0` -o test -Wall -Wextra \
   tests/test-filemon-create.c \
   tests/test-filemon-delete.c \
   tests/test-filemon-move.c \
+  tests/test-filemon-inotify.c \
+  tests/test-filemon-fanotify.c \
+  tests/test-filemon-budget.c \
+  tests/test-filemon-coalesce.c \
+  tests/test-filemon-changeset.c \
+  tests/test-filemon-rename.c \
+  tests/test-filemon-reconcile.c \
+  tests/test-filemon-thread.c \
+  tests/test-filemon-timebudget.c \
+  tests/test-filemon-polling.c \
+  tests/test-filemon-statistics.c \
+  tests/test-filemon-deferred.c \
+  tests/test-filemon-shared.c \
+  tests/test-filemon-complete.c \
+  tests/test-filemon-burst.c \
+  tests/test-filemon-subscribers.c \
+  tests/test-filemon-modify.c \
+  tests/test-filemon-snapshot.c \
   tests/test-filemon-urilist-create.c \
   tests/test-filemon-urilist-delete.c \
   tests/test-tree-addnode.c \
@@ -10,10 +28,34 @@ gcc `pkg-config --cflags --libs gtk+-2.0` -o test -Wall -Wextra \
   tests/test-tree-next-iteration.c \
   tests/test-tree-next-nofiles.c \
   tests/test-tree-numberofleaves.c \
+  tests/test-tree-memoryusage.c \
+  tests/test-tree-outofcore.c \
+  tests/test-tree-packed.c \
+  tests/test-tree-compact.c \
+  tests/test-tree-classify.c \
   tests/test-tree-singlefile.c \
   tests/test-tree-urilist.c \
   tests/tree-printer.c \
   tests/utils.c \
   tests/run-all-tests.c \
   src/vnrfile.c \
-  src/tree.c
+  src/tree.c \
+  src/spill.c \
+  src/packed.c \
+  src/compact.c \
+  src/inotify.c \
+  src/fanotify.c \
+  src/budget.c \
+  src/events.c \
+  src/changeset.c \
+  src/reconcile.c \
+  src/worker.c \
+  src/stats.c \
+  src/deferred.c \
+  src/registry.c \
+  src/mounts.c \
+  src/burst.c \
+  src/subscribers.c \
+  src/lookup.c \
+  src/snapshot.c \
+  src/classify.c
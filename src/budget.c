@@ -0,0 +1,493 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+#define UNUSED(x) (void)(x)
+
+/*
+ * Watch budget. At most a given number of directories in a tree have a
+ * real watch; the ones that were visited least recently lose theirs
+ * first. Directories without a watch, whether they were evicted, the
+ * watch could not be created, or they are on a file system that does
+ * not report changes, are polled instead: their modification time is
+ * checked at an interval, and a directory whose modification time
+ * changed is read again.
+ * Every polled directory has an interval of its own. It is halved when
+ * the directory turns out to have changed and doubled when it has not,
+ * so busy directories are checked often and quiet ones seldom. The
+ * polled directories are kept in the order they are due in, and one
+ * timer is kept, for the directory that is due first.
+ */
+
+#define DEFAULT_POLL_INTERVAL 5
+// Bounds for the interval of a single directory, in seconds and in
+// multiples of the interval of the tree.
+#define MIN_POLL_INTERVAL 1
+#define MAX_POLL_BACKOFF 8
+
+struct PolledDirectory {
+    GNode *dir;
+    // Position in the directories ordered by when they are due.
+    GSequenceIter *position;
+    // Modification time when last read.
+    gint64 mtime;
+    guint interval;
+    gint64 next_poll;
+    // Polled because of the backend or the file system, rather than
+    // for the lack of a watch.
+    gboolean always;
+};
+
+struct WatchBudget {
+    struct MonitoringData *monitoring_data;
+    // 0 when the number of watches is not limited.
+    guint max_watches;
+    guint poll_interval;
+    guint timeout_id;
+    gint64 wakeup_at;
+    // Watched directories, most recently visited first.
+    GQueue watched;
+    GHashTable *links;
+    // Polled directory -> struct PolledDirectory.
+    GHashTable *polled;
+    // The struct PolledDirectory in the order they are due in.
+    GSequence *due;
+};
+
+// Device -> whether it is a remote file system, as a pointer to 1 or 2.
+static GHashTable *remote_devices = NULL;
+G_LOCK_DEFINE_STATIC(remote_devices);
+
+
+static gboolean poll_directories(gpointer data);
+
+static struct WatchBudget* get_budget(GNode *node) {
+    VnrFile *vnrfile = node == NULL ? NULL : node->data;
+    if(vnrfile == NULL || vnrfile->monitoring_data == NULL) {
+        return NULL;
+    }
+    return vnrfile->monitoring_data->watch_budget;
+}
+
+static gint compare_due(gconstpointer a, gconstpointer b, gpointer data) {
+    const struct PolledDirectory *first = a;
+    const struct PolledDirectory *second = b;
+    UNUSED(data);
+
+    if(first->next_poll != second->next_poll) {
+        return first->next_poll < second->next_poll ? -1 : 1;
+    }
+    return first->dir < second->dir ? -1 : first->dir > second->dir;
+}
+
+static void free_polled(gpointer data) {
+    struct PolledDirectory *polled = data;
+    g_sequence_remove(polled->position);
+    g_free(polled);
+}
+
+/* Sets when @polled@ is due, keeping the order. */
+static void set_next_poll(struct PolledDirectory *polled, gint64 when) {
+    polled->next_poll = when;
+    g_sequence_sort_changed(polled->position, compare_due, NULL);
+}
+
+static struct WatchBudget* get_or_create_budget(struct MonitoringData *monitoring_data) {
+    if(monitoring_data->watch_budget == NULL) {
+        struct WatchBudget *budget = g_new0(struct WatchBudget, 1);
+        budget->monitoring_data = monitoring_data;
+        budget->poll_interval = DEFAULT_POLL_INTERVAL;
+        g_queue_init(&budget->watched);
+        budget->links = g_hash_table_new(g_direct_hash, g_direct_equal);
+        budget->polled = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free_polled);
+        budget->due = g_sequence_new(NULL);
+        monitoring_data->watch_budget = budget;
+    }
+    return monitoring_data->watch_budget;
+}
+
+/*
+ * Makes sure that the directories are polled at @when@, in monotonic
+ * time, or earlier.
+ */
+static void schedule_poll(struct WatchBudget *budget, gint64 when) {
+    if(budget->timeout_id != 0 && budget->wakeup_at <= when) {
+        return;
+    }
+    if(budget->timeout_id != 0) {
+        g_source_remove(budget->timeout_id);
+    }
+    gint64 now = g_get_monotonic_time();
+    guint seconds = when > now ? (guint) ((when - now + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC) : 0;
+    budget->wakeup_at = when;
+    budget->timeout_id = g_timeout_add_seconds(seconds, poll_directories, budget->monitoring_data);
+}
+
+static void schedule_earliest_poll(struct WatchBudget *budget) {
+    GSequenceIter *first = g_sequence_get_begin_iter(budget->due);
+    if(!g_sequence_iter_is_end(first)) {
+        schedule_poll(budget, ((struct PolledDirectory*) g_sequence_get(first))->next_poll);
+    }
+}
+
+static void add_polled(struct WatchBudget *budget, GNode *dir, gboolean always) {
+    struct PolledDirectory *polled = g_new(struct PolledDirectory, 1);
+    polled->dir = dir;
+    polled->mtime = vnr_file_get_mtime(((VnrFile*) dir->data)->path);
+    polled->interval = budget->poll_interval;
+    polled->next_poll = g_get_monotonic_time() + (gint64) polled->interval * G_USEC_PER_SEC;
+    polled->always = always;
+    // Replacing an earlier entry takes that out of the order.
+    g_hash_table_insert(budget->polled, dir, polled);
+    polled->position = g_sequence_insert_sorted(budget->due, polled, compare_due, NULL);
+    schedule_poll(budget, polled->next_poll);
+}
+
+#ifdef __linux__
+static gboolean is_remote_file_system_type(const char *path) {
+    static const guint32 remote_file_systems[] = {
+        0x6969,     // NFS
+        0x517B,     // SMB
+        0xFF534D42, // CIFS
+        0xFE534D42, // SMB2
+        0x65735546, // FUSE
+    };
+    struct statfs fs;
+    guint i;
+
+    if(statfs(path, &fs) != 0) {
+        return FALSE;
+    }
+    for(i = 0; i < G_N_ELEMENTS(remote_file_systems); i++) {
+        if((guint32) fs.f_type == remote_file_systems[i]) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+#endif
+
+/*
+ * Returns TRUE if @path@ is on a file system where changes made by
+ * other machines are not reported. The answer is remembered for the
+ * device, since statfs may have to ask the server.
+ */
+static gboolean is_on_remote_file_system(const char *path) {
+#ifdef __linux__
+    struct stat st;
+    gint64 device;
+    gpointer known;
+
+    if(stat(path, &st) != 0) {
+        return FALSE;
+    }
+    device = st.st_dev;
+    G_LOCK(remote_devices);
+    known = remote_devices == NULL ? NULL : g_hash_table_lookup(remote_devices, &device);
+    G_UNLOCK(remote_devices);
+    if(known != NULL) {
+        return GPOINTER_TO_INT(known) == 2;
+    }
+
+    gboolean remote = is_remote_file_system_type(path);
+    gint64 *known_device = g_new(gint64, 1);
+    *known_device = device;
+
+    G_LOCK(remote_devices);
+    if(remote_devices == NULL) {
+        remote_devices = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    }
+    g_hash_table_insert(remote_devices, known_device, GINT_TO_POINTER(remote ? 2 : 1));
+    G_UNLOCK(remote_devices);
+    return remote;
+#else
+    UNUSED(path);
+    return FALSE;
+#endif
+}
+
+static void forget_watched(struct WatchBudget *budget, GNode *dir) {
+    GList *link = g_hash_table_lookup(budget->links, dir);
+    if(link != NULL) {
+        g_queue_delete_link(&budget->watched, link);
+        g_hash_table_remove(budget->links, dir);
+    }
+}
+
+static void evict_least_recently_visited(struct WatchBudget *budget) {
+    while(budget->max_watches > 0 && g_queue_get_length(&budget->watched) > budget->max_watches) {
+        GNode *dir = g_queue_peek_tail(&budget->watched);
+        forget_watched(budget, dir);
+        vnr_file_remove_file_monitor(dir);
+        add_polled(budget, dir, FALSE);
+    }
+}
+
+static void push_watched(struct WatchBudget *budget, GNode *dir) {
+    forget_watched(budget, dir);
+    g_queue_push_head(&budget->watched, dir);
+    g_hash_table_insert(budget->links, dir, g_queue_peek_head_link(&budget->watched));
+}
+
+
+/**
+ * Records that the directory @dir@ got a watch. Evicts the least
+ * recently visited watch if the tree has more than its budget.
+ */
+void budget_watch_added(GNode *dir, struct MonitoringData *monitoring_data) {
+    struct WatchBudget *budget = monitoring_data->watch_budget;
+    if(budget == NULL) {
+        return;
+    }
+    g_hash_table_remove(budget->polled, dir);
+    if(budget->max_watches == 0) {
+        return;
+    }
+    push_watched(budget, dir);
+    evict_least_recently_visited(budget);
+}
+
+/**
+ * Records that no watch could be created for the directory @dir@, so
+ * that it is polled instead.
+ */
+void budget_watch_failed(GNode *dir, struct MonitoringData *monitoring_data) {
+    struct WatchBudget *budget = get_or_create_budget(monitoring_data);
+    forget_watched(budget, dir);
+    add_polled(budget, dir, FALSE);
+}
+
+/**
+ * Returns TRUE if the directory @dir@ is to be polled rather than
+ * watched: with the polling backend, and on file systems such as NFS,
+ * SMB and FUSE, where a watch misses changes made elsewhere. The
+ * directory is then polled from now on.
+ */
+gboolean budget_poll_instead(GNode *dir, struct MonitoringData *monitoring_data) {
+    VnrFile *vnrfile = dir->data;
+
+    if(monitoring_data->backend != MONITOR_BACKEND_POLLING && !is_on_remote_file_system(vnrfile->path)) {
+        return FALSE;
+    }
+    struct WatchBudget *budget = get_or_create_budget(monitoring_data);
+    forget_watched(budget, dir);
+    add_polled(budget, dir, TRUE);
+    return TRUE;
+}
+
+/**
+ * Called when @node@ is visited. Its directory gets a real watch again
+ * if it was polled, or is marked as the most recently visited one.
+ * A directory whose watch could not be created is tried again.
+ */
+void budget_touch(GNode *node) {
+    GNode *dir = node;
+    if(dir != NULL && dir->data != NULL && !((VnrFile*) dir->data)->is_directory) {
+        dir = dir->parent;
+    }
+    struct WatchBudget *budget = get_budget(dir);
+    if(budget == NULL) {
+        return;
+    }
+
+    struct PolledDirectory *polled = g_hash_table_lookup(budget->polled, dir);
+    if(polled == NULL) {
+        if(g_hash_table_contains(budget->links, dir)) {
+            push_watched(budget, dir);
+        }
+        return;
+    }
+    if(polled->always) {
+        // Nothing better to switch to; check it sooner instead.
+        polled->interval = MIN(polled->interval, budget->poll_interval);
+        set_next_poll(polled, MIN(polled->next_poll,
+                                  g_get_monotonic_time() + (gint64) polled->interval * G_USEC_PER_SEC));
+        schedule_poll(budget, polled->next_poll);
+        return;
+    }
+
+    gboolean changed = polled->mtime != vnr_file_get_mtime(((VnrFile*) dir->data)->path);
+    g_hash_table_remove(budget->polled, dir);
+    vnr_file_set_file_monitor(dir, budget->monitoring_data);
+
+    // Catch up with what happened while it was only polled.
+    if(changed) {
+        vnr_file_directory_rescan(dir);
+    }
+}
+
+/**
+ * Forgets @node@. Called when the node is destroyed.
+ */
+void budget_forget(GNode *node) {
+    struct WatchBudget *budget = get_budget(node);
+    if(budget != NULL) {
+        forget_watched(budget, node);
+        g_hash_table_remove(budget->polled, node);
+    }
+}
+
+void budget_free(struct WatchBudget *budget) {
+    if(budget == NULL) {
+        return;
+    }
+    if(budget->timeout_id != 0) {
+        g_source_remove(budget->timeout_id);
+    }
+    g_queue_clear(&budget->watched);
+    g_hash_table_destroy(budget->links);
+    // Takes the directories out of the order, so it goes first.
+    g_hash_table_destroy(budget->polled);
+    g_sequence_free(budget->due);
+    g_free(budget);
+}
+
+void budget_add_memory_usage(struct WatchBudget *budget, struct MemoryUsage *usage) {
+    if(budget == NULL) {
+        return;
+    }
+    usage->indexes += sizeof(struct WatchBudget);
+    if(budget->links != NULL) {
+        usage->indexes += g_hash_table_size(budget->links) * (HASH_TABLE_ENTRY_SIZE + sizeof(GList));
+    }
+    if(budget->polled != NULL) {
+        // The directory and its place in the order they are due in.
+        usage->indexes += g_hash_table_size(budget->polled) *
+                          (HASH_TABLE_ENTRY_SIZE + sizeof(struct PolledDirectory) + 4 * sizeof(gpointer));
+    }
+}
+
+
+static gboolean poll_directories(gpointer data) {
+    struct MonitoringData *monitoring_data = data;
+    struct WatchBudget *budget = monitoring_data->watch_budget;
+    guint max_interval = budget->poll_interval * MAX_POLL_BACKOFF;
+
+    // Reading a directory again may add and remove polled directories,
+    // or free the whole tree.
+    monitoring_data_ref(monitoring_data);
+    budget->timeout_id = 0;
+
+    // Timers in whole seconds may fire a little early.
+    gint64 now = g_get_monotonic_time();
+    gint64 due = now + G_USEC_PER_SEC / 2;
+
+    // A polled directory is due again at least a second from now, so
+    // each one is looked at once.
+    while(!g_sequence_iter_is_end(g_sequence_get_begin_iter(budget->due))) {
+        struct PolledDirectory *polled = g_sequence_get(g_sequence_get_begin_iter(budget->due));
+        GNode *dir = polled->dir;
+        if(polled->next_poll > due) {
+            break;
+        }
+        gint64 current = vnr_file_get_mtime(((VnrFile*) dir->data)->path);
+        gboolean changed = current != -1 && current != polled->mtime;
+
+        polled->interval = changed ? MAX(polled->interval / 2, MIN_POLL_INTERVAL)
+                                   : MIN(polled->interval * 2, max_interval);
+        set_next_poll(polled, now + (gint64) polled->interval * G_USEC_PER_SEC);
+        if(changed) {
+            polled->mtime = current;
+            vnr_file_directory_rescan(dir);
+        }
+    }
+
+    schedule_earliest_poll(budget);
+    monitoring_data_unref(monitoring_data);
+    return G_SOURCE_REMOVE;
+}
+
+
+static gboolean collect_directories(GNode *node, gpointer data) {
+    GSList **directories = data;
+    VnrFile *vnrfile = node->data;
+    if(vnrfile != NULL && vnrfile->is_directory) {
+        *directories = g_slist_prepend(*directories, node);
+    }
+    return FALSE;
+}
+
+/**
+ * Limits the tree that @tree@ is part of to @max_watches@ watched
+ * directories. The directories that were visited least recently lose
+ * their watch first, and get it back when navigation enters them.
+ * Directories without a watch, including those for which no watch
+ * could be created, are checked about every @poll_interval_seconds@
+ * seconds and read again if their modification time has changed, so
+ * changes are still reported, only later. A directory that keeps
+ * changing is checked more often, down to every second, and one that
+ * does not is checked less often, down to every eighth interval.
+ * A @max_watches@ of 0 removes the limit; directories that already
+ * lost their watch keep being polled until they are visited.
+ * Returns FALSE if the tree contains no directories.
+ */
+gboolean set_watch_budget(GNode *tree, guint max_watches, guint poll_interval_seconds) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    GSList *directories = NULL, *it;
+
+    if(monitoring_data == NULL) {
+        return FALSE;
+    }
+    struct WatchBudget *budget = get_or_create_budget(monitoring_data);
+    budget->max_watches = max_watches;
+    budget->poll_interval = MAX(poll_interval_seconds, MIN_POLL_INTERVAL);
+
+    // Without a record of visits, deeper directories are evicted first,
+    // and the directory of @tree@ is kept.
+    g_queue_clear(&budget->watched);
+    g_hash_table_remove_all(budget->links);
+    if(max_watches > 0) {
+        g_node_traverse(get_root_node(tree), G_LEVEL_ORDER, G_TRAVERSE_ALL, -1, collect_directories, &directories);
+        for(it = directories; it != NULL; it = it->next) {
+            if(!g_hash_table_contains(budget->polled, it->data)) {
+                push_watched(budget, it->data);
+            }
+        }
+        g_slist_free(directories);
+    }
+    // Directories that are already polled go by the new interval too.
+    GHashTableIter iter;
+    gpointer value;
+    gint64 next_poll = g_get_monotonic_time() + (gint64) budget->poll_interval * G_USEC_PER_SEC;
+    g_hash_table_iter_init(&iter, budget->polled);
+    while(g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct PolledDirectory *polled = value;
+        polled->interval = MIN(polled->interval, budget->poll_interval);
+        set_next_poll(polled, MIN(polled->next_poll, next_poll));
+    }
+    schedule_earliest_poll(budget);
+
+    budget_touch(tree);
+    evict_least_recently_visited(budget);
+    return TRUE;
+}
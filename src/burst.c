@@ -0,0 +1,339 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Bursts. Extracting an archive or copying a whole folder into a
+ * monitored directory gives an event per entry, and each is looked up,
+ * read and put in the tree on its own. When the events for a directory
+ * come faster than a threshold, they are dropped instead, and once the
+ * directory has been quiet for a while it is read again and compared
+ * with its children, which reports the same changes at a fraction of
+ * the cost. That only compares names, so the entries that were
+ * modified during the burst are remembered and brought up to date
+ * afterwards.
+ */
+
+// How long a directory must go without events before it is read.
+#define QUIET_USEC (250 * 1000)
+
+struct DirectoryActivity {
+    gint64 window_start;
+    guint events;
+    gboolean bursting;
+    gint64 last_event;
+    // Path -> the last event, for entries that were modified during the
+    // burst. Created on demand.
+    GHashTable *modified;
+};
+
+struct FinishedBurst {
+    GNode *dir;
+    GHashTable *modified;
+};
+
+struct BurstDetector {
+    // Events per second per directory that make a burst.
+    guint threshold;
+    // Directory node -> DirectoryActivity.
+    GHashTable *directories;
+    guint bursting;
+    guint timeout_id;
+};
+
+
+static gboolean is_modification(GFileMonitorEvent type) {
+    return type == G_FILE_MONITOR_EVENT_CHANGED ||
+           type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
+           type == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED;
+}
+
+static gboolean is_entry_event(GFile *file, GFileMonitorEvent type, GFile *other_file) {
+    switch(type) {
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_CHANGED:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+            return file != NULL;
+        // Moves that cross the edge of what is monitored add or remove.
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+            return other_file == NULL;
+        default:
+            return FALSE;
+    }
+}
+
+static void activity_free(gpointer data) {
+    struct DirectoryActivity *activity = data;
+    if(activity->modified != NULL) {
+        g_hash_table_destroy(activity->modified);
+    }
+    g_free(activity);
+}
+
+static void finished_burst_free(struct FinishedBurst *burst) {
+    if(burst->modified != NULL) {
+        g_hash_table_destroy(burst->modified);
+    }
+    g_free(burst);
+}
+
+/*
+ * Takes the directories whose bursts are over out of @bursts@, in one
+ * pass, and forgets the directories that have had no events for long
+ * enough for their rate to start over. With @all@, every burst is over.
+ * Returns a list of struct FinishedBurst.
+ */
+static GSList* take_finished_bursts(struct BurstDetector *bursts, gboolean all) {
+    gint64 now = g_get_monotonic_time();
+    GSList *finished = NULL;
+    GHashTableIter iter;
+    gpointer node, value;
+
+    g_hash_table_iter_init(&iter, bursts->directories);
+    while(g_hash_table_iter_next(&iter, &node, &value)) {
+        struct DirectoryActivity *activity = value;
+        if(activity->bursting && (all || now - activity->last_event >= QUIET_USEC)) {
+            struct FinishedBurst *burst = g_new(struct FinishedBurst, 1);
+            burst->dir = node;
+            burst->modified = activity->modified;
+            activity->modified = NULL;
+            bursts->bursting--;
+            finished = g_slist_prepend(finished, burst);
+            g_hash_table_iter_remove(&iter);
+
+        } else if(!activity->bursting && now - activity->last_event >= G_USEC_PER_SEC) {
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+    return finished;
+}
+
+/*
+ * Reads the directory of @burst@ again. Reading it only compares names,
+ * so the entries that were modified during the burst, and were there
+ * before it, are then brought up to date one by one.
+ */
+static void rescan_burst(struct FinishedBurst *burst) {
+    GSList *modified = NULL, *it;
+    GNode *child;
+
+    if(burst->modified != NULL) {
+        spill_fault_in(burst->dir);
+        packed_unpack(burst->dir);
+        for(child = g_node_first_child(burst->dir); child != NULL; child = g_node_next_sibling(child)) {
+            gpointer path;
+            if(g_hash_table_lookup_extended(burst->modified, ((VnrFile*) child->data)->path, &path, NULL)) {
+                modified = g_slist_prepend(modified, path);
+            }
+        }
+    }
+
+    vnr_file_directory_rescan(burst->dir);
+
+    // The paths are those of the table, which outlives the callbacks.
+    for(it = modified; it != NULL && burst->dir != NULL; it = it->next) {
+        GFile *file = g_file_new_for_path(it->data);
+        gpointer type = g_hash_table_lookup(burst->modified, it->data);
+        vnr_file_apply_directory_event(burst->dir, file, NULL, (GFileMonitorEvent) GPOINTER_TO_INT(type));
+        g_object_unref(file);
+    }
+    g_slist_free(modified);
+}
+
+/*
+ * Reads the directories whose bursts are over again. Returns FALSE if
+ * the detector was turned off by a callback.
+ */
+static gboolean rescan_finished_bursts(struct MonitoringData *monitoring_data, gboolean all) {
+    struct BurstDetector *bursts = monitoring_data->bursts;
+    GSList *finished = take_finished_bursts(bursts, all), *it;
+
+    // A callback may free the other directories.
+    for(it = finished; it != NULL; it = it->next) {
+        node_guard(&((struct FinishedBurst*) it->data)->dir);
+    }
+    for(it = finished; it != NULL; it = it->next) {
+        struct FinishedBurst *burst = it->data;
+        if(burst->dir != NULL) {
+            rescan_burst(burst);
+        }
+        node_unguard(&burst->dir);
+        finished_burst_free(burst);
+    }
+    g_slist_free(finished);
+    return monitoring_data->bursts == bursts;
+}
+
+static gboolean rescan_quiet_directories(gpointer data) {
+    struct MonitoringData *monitoring_data = data;
+    struct BurstDetector *bursts = monitoring_data->bursts;
+
+    // The callbacks may free the tree.
+    monitoring_data_ref(monitoring_data);
+    gboolean keep_going = rescan_finished_bursts(monitoring_data, FALSE) &&
+                          g_hash_table_size(bursts->directories) > 0;
+    if(monitoring_data->bursts == bursts && !keep_going) {
+        bursts->timeout_id = 0;
+    }
+    monitoring_data_unref(monitoring_data);
+    return keep_going ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/*
+ * Counts an event of the directory @dir@ towards its rate. Returns
+ * TRUE if the directory is having a burst, in which case the event
+ * must be dropped; the directory is read again once it is quiet.
+ */
+gboolean burst_absorb(GNode *dir, GFile *file, GFile *other_file, GFileMonitorEvent type) {
+    VnrFile *vnrfile = dir->data;
+    struct BurstDetector *bursts = vnrfile->monitoring_data->bursts;
+
+    if(bursts == NULL || !vnrfile->is_directory || !is_entry_event(file, type, other_file)) {
+        return FALSE;
+    }
+    gint64 now = g_get_monotonic_time();
+    struct DirectoryActivity *activity = g_hash_table_lookup(bursts->directories, dir);
+    if(activity == NULL) {
+        activity = g_new0(struct DirectoryActivity, 1);
+        activity->window_start = now;
+        g_hash_table_insert(bursts->directories, dir, activity);
+        // Also forgets it again once it is quiet.
+        if(bursts->timeout_id == 0) {
+            bursts->timeout_id = g_timeout_add(QUIET_USEC / 1000 / 2, rescan_quiet_directories, vnrfile->monitoring_data);
+        }
+    }
+    activity->last_event = now;
+
+    if(activity->bursting) {
+        if(is_modification(type)) {
+            if(activity->modified == NULL) {
+                activity->modified = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+            }
+            g_hash_table_insert(activity->modified, g_file_get_path(file), GINT_TO_POINTER(type));
+        }
+        return TRUE;
+    }
+    if(now - activity->window_start >= G_USEC_PER_SEC) {
+        activity->window_start = now;
+        activity->events = 0;
+    }
+    if(++activity->events <= bursts->threshold) {
+        return FALSE;
+    }
+
+    activity->bursting = TRUE;
+    bursts->bursting++;
+    // Held back events are covered by the rescan as well.
+    events_forget(dir);
+    return TRUE;
+}
+
+void burst_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    if(vnrfile == NULL || vnrfile->monitoring_data == NULL || vnrfile->monitoring_data->bursts == NULL) {
+        return;
+    }
+    struct BurstDetector *bursts = vnrfile->monitoring_data->bursts;
+    struct DirectoryActivity *activity = g_hash_table_lookup(bursts->directories, node);
+    if(activity != NULL && activity->bursting) {
+        bursts->bursting--;
+    }
+    g_hash_table_remove(bursts->directories, node);
+}
+
+/*
+ * Adds the directories in the middle of a burst, whose changes have not
+ * been applied, to the set @dirs@.
+ */
+void burst_add_busy_directories(struct MonitoringData *monitoring_data, GHashTable *dirs) {
+    GHashTableIter iter;
+    gpointer node, activity;
+
+    if(monitoring_data->bursts == NULL) {
+        return;
+    }
+    g_hash_table_iter_init(&iter, monitoring_data->bursts->directories);
+    while(g_hash_table_iter_next(&iter, &node, &activity)) {
+        if(((struct DirectoryActivity*) activity)->bursting) {
+            g_hash_table_add(dirs, node);
+        }
+    }
+}
+
+void burst_free(struct BurstDetector *bursts) {
+    if(bursts == NULL) {
+        return;
+    }
+    if(bursts->timeout_id != 0) {
+        g_source_remove(bursts->timeout_id);
+    }
+    g_hash_table_destroy(bursts->directories);
+    g_free(bursts);
+}
+
+
+/**
+ * Makes the tree that @tree@ is part of stop applying the changes of a
+ * directory one by one once more than @events_per_second@ of them
+ * arrive for it within a second. The directory is instead read again
+ * when no change has arrived for it in a quarter of a second, and the
+ * callback is called for every difference from what the tree has.
+ * Changes to other directories are applied as usual. Moves within the
+ * tree are always applied, so their nodes are kept.
+ * An @events_per_second@ of 0 turns the detection off; directories in
+ * the middle of a burst are then read right away.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_burst_threshold(GNode *tree, guint events_per_second) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        return FALSE;
+    }
+    struct BurstDetector *bursts = monitoring_data->bursts;
+
+    if(events_per_second > 0) {
+        if(bursts == NULL) {
+            bursts = g_new0(struct BurstDetector, 1);
+            bursts->directories = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, activity_free);
+            monitoring_data->bursts = bursts;
+        }
+        bursts->threshold = events_per_second;
+        return TRUE;
+    }
+    if(bursts == NULL) {
+        return TRUE;
+    }
+
+    // The callbacks may free the tree.
+    monitoring_data_ref(monitoring_data);
+    if(rescan_finished_bursts(monitoring_data, TRUE)) {
+        monitoring_data->bursts = NULL;
+        burst_free(bursts);
+    }
+    monitoring_data_unref(monitoring_data);
+    return TRUE;
+}
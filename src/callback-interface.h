@@ -23,6 +23,20 @@
 
 #include <glib.h>
 
+struct SpillStore;
+struct InotifyWatches;
+struct FanotifyWatches;
+struct WatchBudget;
+struct PendingEvents;
+struct ChangeSetCollector;
+struct MonitorWorker;
+struct MonitorStats;
+struct DeferredWatches;
+struct MountWatch;
+struct BurstDetector;
+struct Subscribers;
+struct EntryIndex;
+
 /**
  * A callback function that will be called when a file or directory with
  * a file monitor have reported a change, i.e. a file or directory has
@@ -49,13 +63,210 @@ typedef void (*callback)(gboolean deleted,
                          gpointer data);
 
 
+/**
+ * A callback function that will be called when a file or directory in
+ * a tree has been moved or renamed to a place that is also in the
+ * tree. See set_moved_callback.
+ *
+ * @old_path@ is the path the file or directory had before. The memory
+ * will be freed after the call to callback.
+ * @moved_node@ is the node of the file or directory. It is the same
+ * node as before the move, now at its new place and with its new path;
+ * the nodes below it have been kept as well.
+ * @root@ is the root node of the tree that @moved_node@ is part of.
+ * @data@ is user provided data that will be sent back to the callback
+ * function unaltered.
+ */
+typedef void (*moved_callback)(char *old_path,
+                               GNode *moved_node,
+                               GNode *root,
+                               gpointer data);
+
+
+/**
+ * The kinds of changes a subscriber can be told about. See
+ * add_subscriber.
+ */
+typedef enum {
+    TREE_EVENT_ADDED    = 1 << 0,
+    TREE_EVENT_REMOVED  = 1 << 1,
+    TREE_EVENT_MOVED    = 1 << 2,
+    TREE_EVENT_MODIFIED = 1 << 3
+} TreeEvent;
+
+#define TREE_EVENT_ALL (TREE_EVENT_ADDED | TREE_EVENT_REMOVED | TREE_EVENT_MOVED | TREE_EVENT_MODIFIED)
+
+/**
+ * A callback function that will be called for the changes below the
+ * node it subscribed to. See add_subscriber.
+ *
+ * @event@ is the kind of change. A file or directory that is moved in
+ * from outside the subscribed node is reported as added, and one that
+ * is moved out of it as removed. A file that has been written to or had
+ * its attributes changed is reported as modified; its node is kept and
+ * its display name read again.
+ * @path@ is the path to the file or directory that was affected, or
+ * its old path if it was moved or moved out. The memory will be freed
+ * after the call to callback.
+ * @node@ is the subtree that was affected, as for the callback given
+ * when the tree was created; it may point to an invalid structure if it
+ * was removed. If it was moved, it is at its new place.
+ * @root@ is the root node of the tree that @node@ is/was part of.
+ * @data@ is user provided data that will be sent back to the callback
+ * function unaltered.
+ */
+typedef void (*subscriber_callback)(TreeEvent event,
+                                    char *path,
+                                    GNode *node,
+                                    GNode *root,
+                                    gpointer data);
+
+
+/**
+ * The file system changes of a tree since the previous change set.
+ *
+ * @added@ holds the GNodes of the files and directories that have been
+ * added to @root@, in the order they were added.
+ * @removed@ holds the paths (char*) of the files and directories that
+ * have been removed. Their nodes have been freed.
+ * @moved@ holds the GNodes of the files and directories that have been
+ * moved to another place in @root@.
+ * @modified@ holds the GNodes of the files that have been written to or
+ * had their attributes changed. Added files are not in it.
+ * A node that was added and removed again in between two change sets
+ * is in neither list. The lists and paths are freed after the call.
+ */
+struct ChangeSet {
+    GList *added;
+    GList *removed;
+    GList *moved;
+    GList *modified;
+    GNode *root;
+};
+
+/**
+ * A callback function that is given all the changes of a tree since
+ * the previous call, instead of one call per change. See
+ * set_change_set_callback. @data@ is user provided data that will be
+ * sent back to the callback function unaltered.
+ */
+typedef void (*change_set_callback)(struct ChangeSet *changes, gpointer data);
+
+
+#define LATENCY_HISTOGRAM_BUCKETS 256
+
+/**
+ * A histogram of durations, in microseconds. Every bucket is at most
+ * 12.5% wide; see latency_histogram_get_percentile.
+ */
+struct LatencyHistogram {
+    guint64 count;
+    guint64 sum_usec;
+    guint64 max_usec;
+    guint64 buckets[LATENCY_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * How file system changes have been handled in a tree, since the
+ * statistics were enabled. See set_monitor_statistics.
+ *
+ * queueing is the time from when an event was received until it
+ * started being applied, such as while it was held back or waited for
+ * its turn. processing is the time from then until the callback was
+ * called, such as looking up the path and reading a new directory.
+ * callback is the time spent in the callback. total is the time from
+ * when an event was received until the callback had returned.
+ * Changes that were not caused by an event, such as those found by
+ * polling, only count towards callback. A change set counts as one
+ * change.
+ */
+struct MonitorStatistics {
+    guint64 events_received;
+    guint64 events_applied;
+    guint64 events_merged;
+    guint64 changes_reported;
+    guint64 overflows;
+    struct LatencyHistogram queueing;
+    struct LatencyHistogram processing;
+    struct LatencyHistogram callback;
+    struct LatencyHistogram total;
+};
+
+
+/**
+ * How file system changes are picked up.
+ * MONITOR_BACKEND_GIO uses one GFileMonitor per monitored file or
+ * directory.
+ * MONITOR_BACKEND_INOTIFY reads all changes of a tree from a single
+ * inotify descriptor. It is only available on Linux; elsewhere, or if
+ * inotify cannot be used, GIO is used instead.
+ * MONITOR_BACKEND_FANOTIFY covers all directories of a tree with one
+ * fanotify mark per file system, so it is not limited by the number of
+ * inotify watches. It needs Linux 5.9 and CAP_SYS_ADMIN; without them,
+ * inotify is used instead.
+ * MONITOR_BACKEND_POLLING watches no directories, but checks the
+ * modification time of each at an interval and reads the ones that
+ * changed again. Directories that change often are checked more often.
+ * Files given directly in a uri-list are monitored through GIO.
+ * With any backend, directories on NFS, SMB and FUSE file systems are
+ * polled, since changes made from other machines are not reported.
+ */
+typedef enum {
+    MONITOR_BACKEND_GIO,
+    MONITOR_BACKEND_INOTIFY,
+    MONITOR_BACKEND_FANOTIFY,
+    MONITOR_BACKEND_POLLING
+} MonitorBackend;
+
+
+/**
+ * Settings for how file system changes are handled. One instance is
+ * shared by all monitored files and directories of a tree, and it is
+ * freed when the last of them is destroyed.
+ */
 struct MonitoringData {
     gboolean include_hidden;
     gboolean include_dirs;
-    gboolean set_file_monitor_for_file;
-    GNode* tree;
     callback cb;
     gpointer cb_data;
+    moved_callback moved_cb;
+    gpointer moved_cb_data;
+    gint ref_count;
+    MonitorBackend backend;
+
+    struct SpillStore *spill_store;
+    struct InotifyWatches *inotify;
+    struct FanotifyWatches *fanotify;
+    struct WatchBudget *watch_budget;
+    struct PendingEvents *pending_events;
+    struct ChangeSetCollector *change_sets;
+    struct MonitorWorker *worker;
+    struct MonitorStats *stats;
+    struct DeferredWatches *deferred_watches;
+    struct MountWatch *mounts;
+    struct BurstDetector *bursts;
+    struct Subscribers *subscribers;
+    struct EntryIndex *entry_index;
+
+    // Files are added by changes once they have been written.
+    gboolean complete_files_only;
+
+    // Set while the tree is being created, and not yet handed out.
+    gboolean building;
+
+    // Automatic compaction; the threshold is a percentage, 0 when off.
+    guint compaction_threshold;
+    guint nodes_at_compaction;
+    guint nodes_changed;
+    // The block of the last compaction, held so that the strings freed
+    // from it since can be measured.
+    struct StringArena *string_arena;
+
+    // Recovery from lost events. Nothing that happened before
+    // in_sync_since, in nanoseconds since the epoch, is missing.
+    gint64 in_sync_since;
+    guint reconcile_source_id;
+    GNode *reconcile_root;
 };
 
 #endif /* __CALLBACK_INTERFACE_H__ */
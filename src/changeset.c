@@ -0,0 +1,387 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Change sets. Instead of a call to the callback per change, the
+ * changes of a tree are collected and handed over together, either
+ * when the main loop is next idle or after a time window.
+ */
+
+struct ChangeSetCollector {
+    struct MonitoringData *monitoring_data;
+    change_set_callback cb;
+    gpointer cb_data;
+    guint window_ms;
+    guint source_id;
+
+    GNode *root;
+    GQueue added;
+    GQueue removed;
+    GQueue moved;
+    GQueue modified;
+    // The nodes in added, moved and modified -> the TreeEvents of the
+    // lists they are in, so that destroyed nodes can be taken out of
+    // them.
+    GHashTable *nodes;
+    // Paths of nodes that were added and destroyed again before the
+    // change set was handed over.
+    GHashTable *cancelled;
+};
+
+
+static gboolean is_empty(struct ChangeSetCollector *collector) {
+    return g_queue_is_empty(&collector->added) &&
+           g_queue_is_empty(&collector->removed) &&
+           g_queue_is_empty(&collector->moved) &&
+           g_queue_is_empty(&collector->modified);
+}
+
+static void clear(struct ChangeSetCollector *collector) {
+    g_queue_clear(&collector->added);
+    g_queue_clear(&collector->moved);
+    g_queue_clear(&collector->modified);
+    while(!g_queue_is_empty(&collector->removed)) {
+        g_free(g_queue_pop_head(&collector->removed));
+    }
+    g_hash_table_remove_all(collector->nodes);
+    g_hash_table_remove_all(collector->cancelled);
+}
+
+static void deliver(struct ChangeSetCollector *collector) {
+    struct ChangeSet changes;
+
+    if(collector->source_id != 0) {
+        g_source_remove(collector->source_id);
+        collector->source_id = 0;
+    }
+    if(is_empty(collector)) {
+        return;
+    }
+    changes.added = collector->added.head;
+    changes.removed = collector->removed.head;
+    changes.moved = collector->moved.head;
+    changes.modified = collector->modified.head;
+    changes.root = collector->root;
+
+    // Detached first, since the callback may cause new changes.
+    GQueue added = collector->added, removed = collector->removed, moved = collector->moved;
+    GQueue modified = collector->modified;
+    g_queue_init(&collector->added);
+    g_queue_init(&collector->removed);
+    g_queue_init(&collector->moved);
+    g_queue_init(&collector->modified);
+    g_hash_table_remove_all(collector->nodes);
+    g_hash_table_remove_all(collector->cancelled);
+
+    collector->cb(&changes, collector->cb_data);
+
+    g_queue_clear(&added);
+    g_queue_clear(&moved);
+    g_queue_clear(&modified);
+    while(!g_queue_is_empty(&removed)) {
+        g_free(g_queue_pop_head(&removed));
+    }
+}
+
+static gboolean deliver_source(gpointer data) {
+    struct MonitoringData *monitoring_data = data;
+    struct ChangeSetCollector *collector = monitoring_data->change_sets;
+
+    // The callback may free the tree.
+    monitoring_data_ref(monitoring_data);
+    collector->source_id = 0;
+    gint64 started = stats_callback_begin(monitoring_data);
+    deliver(collector);
+    stats_callback_end(monitoring_data, started);
+    monitoring_data_unref(monitoring_data);
+    return G_SOURCE_REMOVE;
+}
+
+static void schedule(struct ChangeSetCollector *collector) {
+    if(collector->source_id != 0) {
+        return;
+    }
+    if(collector->window_ms == 0) {
+        collector->source_id = g_idle_add(deliver_source, collector->monitoring_data);
+    } else {
+        collector->source_id = g_timeout_add(collector->window_ms, deliver_source, collector->monitoring_data);
+    }
+}
+
+
+static void notify(struct MonitoringData *monitoring_data,
+                   gboolean deleted,
+                   char *path,
+                   GNode *node,
+                   GNode *root) {
+    struct ChangeSetCollector *collector = monitoring_data->change_sets;
+
+    if(collector == NULL) {
+        if(monitoring_data->cb != NULL) {
+            // The callback may free the tree.
+            monitoring_data_ref(monitoring_data);
+            gint64 started = stats_callback_begin(monitoring_data);
+            monitoring_data->cb(deleted, path, node, root, monitoring_data->cb_data);
+            stats_callback_end(monitoring_data, started);
+            monitoring_data_unref(monitoring_data);
+        }
+        return;
+    }
+
+    collector->root = root;
+    if(deleted) {
+        // Added and removed again before being handed over.
+        if(g_hash_table_remove(collector->cancelled, path)) {
+            return;
+        }
+        if(node != NULL && g_hash_table_remove(collector->nodes, node)) {
+            g_queue_remove(&collector->moved, node);
+            g_queue_remove(&collector->modified, node);
+            if(g_queue_remove(&collector->added, node)) {
+                return;
+            }
+        }
+        g_queue_push_tail(&collector->removed, g_strdup(path));
+    } else {
+        g_queue_push_tail(&collector->added, node);
+        g_hash_table_insert(collector->nodes, node, GUINT_TO_POINTER(TREE_EVENT_ADDED));
+    }
+    schedule(collector);
+}
+
+/*
+ * Puts @node@ in the list of @event@, unless it is in that list or
+ * among the added nodes already.
+ */
+static void collect(struct ChangeSetCollector *collector, GQueue *list, TreeEvent event, GNode *node) {
+    guint events = GPOINTER_TO_UINT(g_hash_table_lookup(collector->nodes, node));
+
+    if((events & (event | TREE_EVENT_ADDED)) == 0) {
+        g_queue_push_tail(list, node);
+        g_hash_table_insert(collector->nodes, node, GUINT_TO_POINTER(events | event));
+    }
+    schedule(collector);
+}
+
+/**
+ * Reports that @node@, with the path @path@, was added to or, if
+ * @deleted@ is TRUE, removed from the directory @parent@ in the tree
+ * with root @root@. Goes to the change set of the tree if it has one,
+ * and to the callback otherwise, and then to the subscribers.
+ */
+void changes_notify(struct MonitoringData *monitoring_data,
+                    gboolean deleted,
+                    char *path,
+                    GNode *node,
+                    GNode *parent,
+                    GNode *root) {
+    // Matched first, since the callback may free the nodes.
+    GArray *subscribers = subscribers_match(monitoring_data, deleted ? TREE_EVENT_REMOVED : TREE_EVENT_ADDED,
+                                            node, parent);
+
+    // Held, since the callback may free the tree.
+    monitoring_data_ref(monitoring_data);
+    notify(monitoring_data, deleted, path, node, root);
+    subscribers_deliver(monitoring_data, subscribers, path, deleted ? NULL : path, node, root);
+    monitoring_data_unref(monitoring_data);
+}
+
+static void notify_moved(struct MonitoringData *monitoring_data,
+                         char *old_path,
+                         GNode *node,
+                         GNode *root) {
+    struct ChangeSetCollector *collector = monitoring_data->change_sets;
+
+    if(collector == NULL) {
+        // The callback may free the tree.
+        monitoring_data_ref(monitoring_data);
+        gint64 started = stats_callback_begin(monitoring_data);
+        if(monitoring_data->moved_cb != NULL) {
+            monitoring_data->moved_cb(old_path, node, root, monitoring_data->moved_cb_data);
+        } else if(monitoring_data->cb != NULL) {
+            monitoring_data->cb(TRUE, old_path, NULL, root, monitoring_data->cb_data);
+            monitoring_data->cb(FALSE, ((VnrFile*) node->data)->path, node, root, monitoring_data->cb_data);
+        }
+        stats_callback_end(monitoring_data, started);
+        monitoring_data_unref(monitoring_data);
+        return;
+    }
+    collector->root = root;
+    collect(collector, &collector->moved, TREE_EVENT_MOVED, node);
+}
+
+/**
+ * Reports that @node@ has been moved from @old_path@, in the directory
+ * @old_parent@, to another place within the tree with root @root@.
+ * Without a change set or a moved callback, it is reported to the
+ * callback as a removal followed by an addition. Subscribers that only
+ * see one end of the move are told about a removal or an addition.
+ */
+void changes_notify_moved(struct MonitoringData *monitoring_data,
+                          char *old_path,
+                          GNode *node,
+                          GNode *old_parent,
+                          GNode *root) {
+    // Matched first, since the callback may free the nodes.
+    GArray *subscribers = subscribers_match_move(monitoring_data, node, old_parent);
+    char *new_path = g_strdup(((VnrFile*) node->data)->path);
+
+    // Held, since the callback may free the tree.
+    monitoring_data_ref(monitoring_data);
+    notify_moved(monitoring_data, old_path, node, root);
+    subscribers_deliver(monitoring_data, subscribers, old_path, new_path, node, root);
+    monitoring_data_unref(monitoring_data);
+    g_free(new_path);
+}
+
+/**
+ * Reports that the contents or attributes of the file @node@, with the
+ * path @path@, have changed. It goes to the change set of the tree if
+ * it has one, and to the subscribers; the callback given when the tree
+ * was created is not told about it.
+ */
+void changes_notify_modified(struct MonitoringData *monitoring_data,
+                             char *path,
+                             GNode *node,
+                             GNode *root) {
+    struct ChangeSetCollector *collector = monitoring_data->change_sets;
+    GArray *subscribers = subscribers_match(monitoring_data, TREE_EVENT_MODIFIED, node, node->parent);
+
+    if(collector != NULL) {
+        collector->root = root;
+        collect(collector, &collector->modified, TREE_EVENT_MODIFIED, node);
+    }
+    subscribers_deliver(monitoring_data, subscribers, path, path, node, root);
+}
+
+/**
+ * Takes @node@ out of the change set that has not been handed over
+ * yet. Called when the node is destroyed.
+ */
+void changes_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    struct MonitoringData *monitoring_data = vnrfile == NULL ? NULL : vnrfile->monitoring_data;
+
+    // Files have no monitoring data of their own, but are still in
+    // their directory while they are destroyed.
+    if(monitoring_data == NULL && node->parent != NULL && node->parent->data != NULL) {
+        monitoring_data = ((VnrFile*) node->parent->data)->monitoring_data;
+    }
+    if(monitoring_data == NULL || monitoring_data->change_sets == NULL) {
+        return;
+    }
+    struct ChangeSetCollector *collector = monitoring_data->change_sets;
+
+    if(g_hash_table_remove(collector->nodes, node)) {
+        if(g_queue_remove(&collector->added, node)) {
+            g_hash_table_add(collector->cancelled, g_strdup(vnrfile->path));
+        }
+        g_queue_remove(&collector->moved, node);
+        g_queue_remove(&collector->modified, node);
+    }
+}
+
+void changes_free(struct ChangeSetCollector *collector) {
+    if(collector == NULL) {
+        return;
+    }
+    if(collector->source_id != 0) {
+        g_source_remove(collector->source_id);
+    }
+    clear(collector);
+    g_hash_table_destroy(collector->nodes);
+    g_hash_table_destroy(collector->cancelled);
+    g_free(collector);
+}
+
+
+/**
+ * Makes the tree that @tree@ is part of report files and directories
+ * that are moved or renamed within the tree through @cb@, instead of
+ * as a removal and an addition through the callback given when the
+ * tree was created. The moved node is kept, along with the nodes below
+ * it. Setting @cb@ to NULL goes back to a removal and an addition.
+ * Change sets, if used, report moves in their own list.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_moved_callback(GNode *tree, moved_callback cb, gpointer cb_data) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        return FALSE;
+    }
+    monitoring_data->moved_cb = cb;
+    monitoring_data->moved_cb_data = cb_data;
+    return TRUE;
+}
+
+/**
+ * Makes the tree that @tree@ is part of report file system changes
+ * through @cb@, which is given all changes since the previous call at
+ * once, instead of through the callback given when the tree was
+ * created. With a @window_ms@ of 0, the changes are handed over when
+ * the main loop is next idle; otherwise, they are collected for
+ * @window_ms@ milliseconds after the first of them.
+ * Setting @cb@ to NULL hands over what has been collected and goes back
+ * to the callback given when the tree was created.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_change_set_callback(GNode *tree, change_set_callback cb, gpointer cb_data, guint window_ms) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        return FALSE;
+    }
+    struct ChangeSetCollector *collector = monitoring_data->change_sets;
+
+    if(cb == NULL) {
+        if(collector != NULL) {
+            monitoring_data_ref(monitoring_data);
+            deliver(collector);
+            changes_free(monitoring_data->change_sets);
+            monitoring_data->change_sets = NULL;
+            monitoring_data_unref(monitoring_data);
+        }
+        return TRUE;
+    }
+
+    if(collector == NULL) {
+        collector = g_new0(struct ChangeSetCollector, 1);
+        collector->monitoring_data = monitoring_data;
+        g_queue_init(&collector->added);
+        g_queue_init(&collector->removed);
+        g_queue_init(&collector->moved);
+        g_queue_init(&collector->modified);
+        collector->nodes = g_hash_table_new(g_direct_hash, g_direct_equal);
+        collector->cancelled = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        collector->root = get_root_node(tree);
+        monitoring_data->change_sets = collector;
+    }
+    collector->cb = cb;
+    collector->cb_data = cb_data;
+    collector->window_ms = window_ms;
+    return TRUE;
+}
@@ -0,0 +1,298 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Classification cache. Whether a file is an image of a supported type
+ * is decided from its content type, which may mean reading the start of
+ * the file. The result is remembered by the device, inode, size,
+ * modification time and name of the file, and can be written to a file
+ * so that opening the same directories again does not look into files
+ * that have not changed. The name is part of the key since the content
+ * type is also guessed from it, and a rename changes neither the inode
+ * nor the modification time.
+ *
+ * The file is a header followed by fixed size records.
+ */
+
+#define CACHE_MAGIC "CTRCLSF"
+#define CACHE_VERSION 1
+
+// How many files are written at most. Those that have been looked up
+// since the cache was set are written first.
+#define MAX_SAVED_ENTRIES (1 << 18)
+
+struct CacheHeader {
+    char magic[8];
+    guint32 version;
+    guint32 number_of_records;
+};
+
+struct CacheRecord {
+    struct ClassificationKey key;
+    guint8 is_supported;
+    guint8 padding[7];
+};
+
+struct CacheEntry {
+    struct ClassificationKey key;
+    gboolean is_supported;
+    // Looked up or stored since the cache was set.
+    gboolean used;
+};
+
+// Lookups come from worker threads as well as the main thread.
+static GMutex cache_mutex;
+static char *cache_path = NULL;
+static GHashTable *cache_entries = NULL;
+
+
+static guint entry_hash(gconstpointer a) {
+    const struct ClassificationKey *key = &((const struct CacheEntry*) a)->key;
+    return (guint) (key->device * 31 + key->inode) ^ (guint) key->size ^ (guint) key->mtime ^ key->name_hash;
+}
+
+static gboolean entry_equal(gconstpointer a, gconstpointer b) {
+    const struct ClassificationKey *key_a = &((const struct CacheEntry*) a)->key;
+    const struct ClassificationKey *key_b = &((const struct CacheEntry*) b)->key;
+    return key_a->device    == key_b->device &&
+           key_a->inode     == key_b->inode &&
+           key_a->size      == key_b->size &&
+           key_a->mtime     == key_b->mtime &&
+           key_a->name_hash == key_b->name_hash;
+}
+
+static void add_entry(const struct ClassificationKey *key, gboolean is_supported, gboolean used) {
+    struct CacheEntry *entry = g_new(struct CacheEntry, 1);
+    entry->key = *key;
+    entry->is_supported = is_supported;
+    entry->used = used;
+    g_hash_table_add(cache_entries, entry);
+}
+
+static gboolean read_cache_file(const char *path, GError **error) {
+    char *contents;
+    gsize length;
+    GError *read_error = NULL;
+
+    if(!g_file_get_contents(path, &contents, &length, &read_error)) {
+        gboolean missing = g_error_matches(read_error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+        if(missing) {
+            g_error_free(read_error);
+        } else {
+            g_propagate_error(error, read_error);
+        }
+        return missing;
+    }
+
+    struct CacheHeader header;
+    gboolean valid = length >= sizeof(header);
+    if(valid) {
+        memcpy(&header, contents, sizeof(header));
+        valid = memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+                header.version == CACHE_VERSION &&
+                length - sizeof(header) == (gsize) header.number_of_records * sizeof(struct CacheRecord);
+    }
+    if(!valid) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "%s is not a classification cache", path);
+        g_free(contents);
+        return FALSE;
+    }
+
+    const char *record_data = contents + sizeof(header);
+    for(guint32 i = 0; i < header.number_of_records; i++) {
+        struct CacheRecord record;
+        memcpy(&record, record_data + i * sizeof(record), sizeof(record));
+        add_entry(&record.key, record.is_supported != 0, FALSE);
+    }
+    g_free(contents);
+    return TRUE;
+}
+
+/**
+ * Makes whether files are images of a supported type be remembered in
+ * the file @path@, so that files that have not changed since are not
+ * looked into again when they are read into a tree. What @path@ holds
+ * is read by the call, and written by save_classification_cache. A
+ * @path@ of NULL turns the cache off.
+ * Returns FALSE, with @error@ set, if @path@ exists but could not be
+ * read. The cache then starts out empty.
+ */
+gboolean set_classification_cache(const char *path, GError **error) {
+    gboolean read = TRUE;
+
+    g_mutex_lock(&cache_mutex);
+    g_free(cache_path);
+    if(cache_entries != NULL) {
+        g_hash_table_destroy(cache_entries);
+    }
+    cache_path = g_strdup(path);
+    cache_entries = NULL;
+    if(path != NULL) {
+        cache_entries = g_hash_table_new_full(entry_hash, entry_equal, g_free, NULL);
+        read = read_cache_file(path, error);
+    }
+    g_mutex_unlock(&cache_mutex);
+    return read;
+}
+
+static gint compare_used_first(gconstpointer a, gconstpointer b) {
+    const struct CacheEntry *entry_a = *(struct CacheEntry* const*) a;
+    const struct CacheEntry *entry_b = *(struct CacheEntry* const*) b;
+    return (entry_b->used ? 1 : 0) - (entry_a->used ? 1 : 0);
+}
+
+/**
+ * Writes what is remembered to the file given to
+ * set_classification_cache, replacing what it held. Files that have
+ * been read into a tree since the cache was set are kept before others
+ * if there are too many to keep.
+ * Returns FALSE, with @error@ set, if the file could not be written,
+ * and also if no cache has been set.
+ */
+gboolean save_classification_cache(GError **error) {
+    g_mutex_lock(&cache_mutex);
+    if(cache_path == NULL) {
+        g_mutex_unlock(&cache_mutex);
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                            "No classification cache has been set");
+        return FALSE;
+    }
+
+    GPtrArray *entries = g_ptr_array_sized_new(g_hash_table_size(cache_entries));
+    GHashTableIter iter;
+    gpointer entry;
+    g_hash_table_iter_init(&iter, cache_entries);
+    while(g_hash_table_iter_next(&iter, &entry, NULL)) {
+        g_ptr_array_add(entries, entry);
+    }
+    if(entries->len > MAX_SAVED_ENTRIES) {
+        g_ptr_array_sort(entries, compare_used_first);
+        g_ptr_array_set_size(entries, MAX_SAVED_ENTRIES);
+    }
+
+    struct CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.number_of_records = entries->len;
+
+    GByteArray *buffer = g_byte_array_sized_new(sizeof(header) + entries->len * sizeof(struct CacheRecord));
+    g_byte_array_append(buffer, (guint8*) &header, sizeof(header));
+    for(guint i = 0; i < entries->len; i++) {
+        const struct CacheEntry *cache_entry = g_ptr_array_index(entries, i);
+        struct CacheRecord record;
+        memset(&record, 0, sizeof(record));
+        record.key = cache_entry->key;
+        record.is_supported = cache_entry->is_supported ? 1 : 0;
+        g_byte_array_append(buffer, (guint8*) &record, sizeof(record));
+    }
+
+    char *directory = g_path_get_dirname(cache_path);
+    gboolean saved = FALSE;
+    if(g_mkdir_with_parents(directory, 0700) != 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Could not create %s", directory);
+    } else {
+        saved = g_file_set_contents(cache_path, (const gchar*) buffer->data, buffer->len, error);
+    }
+    g_mutex_unlock(&cache_mutex);
+
+    g_free(directory);
+    g_byte_array_free(buffer, TRUE);
+    g_ptr_array_free(entries, TRUE);
+    return saved;
+}
+
+
+gboolean classify_enabled(void) {
+    g_mutex_lock(&cache_mutex);
+    gboolean enabled = cache_entries != NULL;
+    g_mutex_unlock(&cache_mutex);
+    return enabled;
+}
+
+/*
+ * Fills in @key@ with what identifies the contents of the file at
+ * @path@, from @fileinfo@, which was queried with
+ * CLASSIFY_KEY_ATTRIBUTES. Returns FALSE if the file system does not
+ * give them.
+ */
+gboolean classify_key(GFileInfo *fileinfo, const char *path, struct ClassificationKey *key) {
+    if(!g_file_info_has_attribute(fileinfo, G_FILE_ATTRIBUTE_UNIX_INODE) ||
+       !g_file_info_has_attribute(fileinfo, G_FILE_ATTRIBUTE_TIME_MODIFIED)) {
+        return FALSE;
+    }
+    char *name = g_path_get_basename(path);
+
+    memset(key, 0, sizeof(*key));
+    key->device = g_file_info_get_attribute_uint32(fileinfo, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+    key->inode = g_file_info_get_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_UNIX_INODE);
+    key->size = g_file_info_get_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+    key->mtime = (gint64) g_file_info_get_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_TIME_MODIFIED) * 1000000000;
+#ifdef G_FILE_ATTRIBUTE_TIME_MODIFIED_NSEC
+    if(g_file_info_has_attribute(fileinfo, G_FILE_ATTRIBUTE_TIME_MODIFIED_NSEC)) {
+        key->mtime += g_file_info_get_attribute_uint32(fileinfo, G_FILE_ATTRIBUTE_TIME_MODIFIED_NSEC);
+    } else
+#endif
+    {
+        key->mtime += (gint64) g_file_info_get_attribute_uint32(fileinfo, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC) * 1000;
+    }
+    key->name_hash = g_str_hash(name);
+
+    g_free(name);
+    return TRUE;
+}
+
+/*
+ * Sets @is_supported@ to what has been remembered for @key@. Returns
+ * FALSE if nothing has.
+ */
+gboolean classify_lookup(const struct ClassificationKey *key, gboolean *is_supported) {
+    struct CacheEntry lookup = { .key = *key };
+    gboolean found = FALSE;
+
+    g_mutex_lock(&cache_mutex);
+    struct CacheEntry *entry = cache_entries == NULL ? NULL : g_hash_table_lookup(cache_entries, &lookup);
+    if(entry != NULL) {
+        entry->used = TRUE;
+        *is_supported = entry->is_supported;
+        found = TRUE;
+    }
+    g_mutex_unlock(&cache_mutex);
+    return found;
+}
+
+/* Remembers @is_supported@ for @key@, if there is a cache. */
+void classify_store(const struct ClassificationKey *key, gboolean is_supported) {
+    g_mutex_lock(&cache_mutex);
+    if(cache_entries != NULL) {
+        add_entry(key, is_supported, TRUE);
+    }
+    g_mutex_unlock(&cache_mutex);
+}
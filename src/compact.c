@@ -0,0 +1,225 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Compaction. The strings of all files in a tree are copied into one
+ * block, in the order the tree is traversed, and the scattered copies
+ * are freed. The GNodes and VnrFiles themselves stay where they are,
+ * since callers hold pointers to them.
+ *
+ * A file whose strings live in a block holds a reference to it. A
+ * block is freed when the last such file is destroyed or moved into a
+ * newer block.
+ */
+
+struct StringArena {
+    gint ref_count;
+    gsize size;
+    // Bytes of strings that are no longer used by any file.
+    gsize dead;
+    gchar data[];
+};
+
+struct CompactionSizes {
+    guint number_of_nodes;
+    gsize strings_size;
+};
+
+
+static gsize string_size(const gchar *str) {
+    return str == NULL ? 0 : strlen(str) + 1;
+}
+
+static gsize strings_size(VnrFile *vnrfile) {
+    return string_size(vnrfile->path) +
+           string_size(vnrfile->display_name) +
+           string_size(vnrfile->display_name_collate);
+}
+
+static gchar* copy_string(const gchar *str, gchar **position) {
+    if(str == NULL) {
+        return NULL;
+    }
+    gchar *copy = *position;
+    *position = g_stpcpy(copy, str) + 1;
+    return copy;
+}
+
+/**
+ * Drops the reference that @vnrfile@ holds on the block containing its
+ * strings. The strings must not be used afterwards.
+ */
+void string_arena_release(VnrFile *vnrfile) {
+    struct StringArena *arena = vnrfile->arena;
+
+    arena->dead += strings_size(vnrfile);
+    vnrfile->arena = NULL;
+    vnrfile->path = NULL;
+    vnrfile->display_name = NULL;
+    vnrfile->display_name_collate = NULL;
+
+    string_arena_unref(arena);
+}
+
+void string_arena_unref(struct StringArena *arena) {
+    if(arena != NULL && --arena->ref_count == 0) {
+        g_free(arena);
+    }
+}
+
+
+static gboolean add_compaction_sizes(GNode *node, gpointer data) {
+    struct CompactionSizes *sizes = data;
+    VnrFile *vnrfile = node->data;
+
+    sizes->number_of_nodes++;
+    if(vnrfile != NULL) {
+        sizes->strings_size += strings_size(vnrfile);
+    }
+    return FALSE;
+}
+
+struct Compaction {
+    struct StringArena *arena;
+    gchar *position;
+};
+
+static gboolean move_strings(GNode *node, gpointer data) {
+    struct Compaction *compaction = data;
+    VnrFile *vnrfile = node->data;
+
+    if(vnrfile == NULL) {
+        return FALSE;
+    }
+    gchar *path = copy_string(vnrfile->path, &compaction->position);
+    gchar *display_name = copy_string(vnrfile->display_name, &compaction->position);
+    gchar *display_name_collate = copy_string(vnrfile->display_name_collate, &compaction->position);
+
+    if(vnrfile->arena != NULL) {
+        string_arena_release(vnrfile);
+    } else {
+        g_free(vnrfile->path);
+        g_free(vnrfile->display_name);
+        g_free((gpointer) vnrfile->display_name_collate);
+    }
+    vnrfile->path = path;
+    vnrfile->display_name = display_name;
+    vnrfile->display_name_collate = display_name_collate;
+    vnrfile->arena = compaction->arena;
+    compaction->arena->ref_count++;
+    return FALSE;
+}
+
+/**
+ * Moves the strings of all files in the tree that @tree@ is part of
+ * into one newly allocated block, in traversal order, and frees the
+ * old copies. Nodes and files keep their addresses, but the path,
+ * display name and collate key of every file are moved, so pointers to
+ * them must not be kept across the call. Files of packed directories
+ * are already stored together and are left alone, as are spilled
+ * directories.
+ * Returns the number of bytes of strings that were moved.
+ */
+gsize compact_tree(GNode *tree) {
+    struct CompactionSizes sizes = {0, 0};
+    struct Compaction compaction;
+    GNode *root = get_root_node(tree);
+
+    if(root == NULL) {
+        return 0;
+    }
+    g_node_traverse(root, G_PRE_ORDER, G_TRAVERSE_ALL, -1, add_compaction_sizes, &sizes);
+    if(sizes.strings_size == 0) {
+        return 0;
+    }
+
+    compaction.arena = g_malloc(sizeof(struct StringArena) + sizes.strings_size);
+    compaction.arena->ref_count = 1;
+    compaction.arena->size = sizes.strings_size;
+    compaction.arena->dead = 0;
+    compaction.position = compaction.arena->data;
+
+    g_node_traverse(root, G_PRE_ORDER, G_TRAVERSE_ALL, -1, move_strings, &compaction);
+
+    struct MonitoringData *monitoring_data = get_monitoring_data(root);
+    if(monitoring_data != NULL) {
+        monitoring_data->nodes_at_compaction = sizes.number_of_nodes;
+        monitoring_data->nodes_changed = 0;
+        // Takes over the reference of the compaction.
+        string_arena_unref(monitoring_data->string_arena);
+        monitoring_data->string_arena = compaction.arena;
+    } else {
+        // Only the files hold the block from now on.
+        string_arena_unref(compaction.arena);
+    }
+    return sizes.strings_size;
+}
+
+/**
+ * Makes the tree that @tree@ is part of compact itself, as with
+ * compact_tree, once the number of files and directories that have
+ * been added or removed by file system changes since the last
+ * compaction reaches @changed_percentage@ percent of the number of
+ * nodes in the tree at that time, or once the strings of removed and
+ * renamed files make up @changed_percentage@ percent of the block made
+ * by the last compaction.
+ * A @changed_percentage@ of 0 turns automatic compaction off.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_automatic_compaction(GNode *tree, guint changed_percentage) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        return FALSE;
+    }
+    monitoring_data->compaction_threshold = changed_percentage;
+    if(monitoring_data->nodes_at_compaction == 0) {
+        monitoring_data->nodes_at_compaction = g_node_n_nodes(get_root_node(tree), G_TRAVERSE_ALL);
+    }
+    return TRUE;
+}
+
+/**
+ * Counts a node that was added to or removed from the tree with root
+ * @root@, and compacts the tree if it has changed enough.
+ */
+void compact_note_change(GNode *root, struct MonitoringData *monitoring_data) {
+    struct StringArena *arena = monitoring_data->string_arena;
+    guint64 threshold = monitoring_data->compaction_threshold;
+
+    monitoring_data->nodes_changed++;
+    if(threshold == 0) {
+        return;
+    }
+    gboolean churned = (guint64) monitoring_data->nodes_changed * 100 >=
+                       threshold * MAX(monitoring_data->nodes_at_compaction, 1);
+    gboolean fragmented = arena != NULL && (guint64) arena->dead * 100 >= threshold * arena->size;
+
+    if(churned || fragmented) {
+        compact_tree(root);
+    }
+}
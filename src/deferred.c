@@ -0,0 +1,204 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Deferred monitors. Directories are read while the tree is created,
+ * but their monitors are created afterwards, a few at a time from the
+ * main loop, so that the tree can be returned sooner. Whatever changes
+ * in a directory before its monitor exists is not reported by it, so
+ * the modification time of every directory is taken before it is read
+ * and compared once it is monitored. The directories that differ are
+ * read again.
+ */
+
+// How long creating monitors may hold up the main loop at a time.
+#define INSTALL_BUDGET_USEC 5000
+
+struct DeferredWatch {
+    // Of the directory before it was read, in nanoseconds.
+    gint64 mtime;
+    gint64 read_at;
+};
+
+struct DeferredWatches {
+    // Directory node -> DeferredWatch, for the directories that have
+    // no monitor yet.
+    GHashTable *pending;
+    // In the order the monitors will be created, may hold nodes that
+    // have been freed since; only those in pending are looked at.
+    GQueue order;
+    // While TRUE, directories that are read get no monitor.
+    gboolean accepting;
+    guint source_id;
+};
+
+
+static gint64 now_ns() {
+    return g_get_real_time() * 1000;
+}
+
+struct DeferredWatches* deferred_watches_new() {
+    struct DeferredWatches *deferred = g_new0(struct DeferredWatches, 1);
+    deferred->pending = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    g_queue_init(&deferred->order);
+    deferred->accepting = TRUE;
+    return deferred;
+}
+
+/*
+ * Returns TRUE if directories of the tree with @monitoring_data@ that
+ * are read now should be passed to deferred_watch instead of getting a
+ * monitor.
+ */
+gboolean deferred_watches_accepting(struct MonitoringData *monitoring_data) {
+    return monitoring_data->deferred_watches != NULL && monitoring_data->deferred_watches->accepting;
+}
+
+/*
+ * Leaves creating the monitor of the directory @node@ for later.
+ * @mtime@ is its modification time from before it was read.
+ */
+void deferred_watch(GNode *node, struct MonitoringData *monitoring_data, gint64 mtime) {
+    deferred_watch_since(node, monitoring_data, mtime, now_ns());
+}
+
+/*
+ * Like deferred_watch, for a directory that was read at @read_at@, in
+ * nanoseconds since the epoch, rather than now.
+ */
+void deferred_watch_since(GNode *node, struct MonitoringData *monitoring_data, gint64 mtime, gint64 read_at) {
+    struct DeferredWatches *deferred = monitoring_data->deferred_watches;
+    VnrFile *vnrfile = node->data;
+    struct DeferredWatch *watch = g_new(struct DeferredWatch, 1);
+
+    // As in vnr_file_set_file_monitor, since it is how the directory
+    // finds the tree it belongs to.
+    if(vnrfile->monitoring_data == NULL) {
+        vnrfile->monitoring_data = monitoring_data_ref(monitoring_data);
+    }
+    watch->mtime = mtime;
+    watch->read_at = read_at;
+    g_hash_table_insert(deferred->pending, node, watch);
+    // The root is read last, but is the first to get a monitor.
+    g_queue_push_head(&deferred->order, node);
+}
+
+static gboolean needs_catch_up(const char *path, struct DeferredWatch *watch) {
+    gint64 mtime = vnr_file_get_mtime(path);
+    // A change in the same tick as the reading does not show in the
+    // modification time, so recently modified directories are read
+    // again regardless.
+    return mtime != watch->mtime || mtime >= watch->read_at - MTIME_SLACK_NS;
+}
+
+static void finish(struct MonitoringData *monitoring_data) {
+    struct DeferredWatches *deferred = monitoring_data->deferred_watches;
+    deferred->source_id = 0;
+    monitoring_data->deferred_watches = NULL;
+    deferred_watches_free(deferred);
+}
+
+static gboolean install_watches(gpointer data) {
+    struct MonitoringData *monitoring_data = data;
+    struct DeferredWatches *deferred = monitoring_data->deferred_watches;
+    gint64 deadline = g_get_monotonic_time() + INSTALL_BUDGET_USEC;
+
+    // The callbacks may free the tree.
+    monitoring_data_ref(monitoring_data);
+
+    while(!g_queue_is_empty(&deferred->order) && g_get_monotonic_time() < deadline) {
+        GNode *node = g_queue_pop_head(&deferred->order);
+        struct DeferredWatch *watch = g_hash_table_lookup(deferred->pending, node);
+        if(watch == NULL) {
+            continue;
+        }
+        g_hash_table_steal(deferred->pending, node);
+
+        vnr_file_set_file_monitor(node, monitoring_data);
+        if(needs_catch_up(((VnrFile*) node->data)->path, watch)) {
+            vnr_file_directory_rescan(node);
+        }
+        g_free(watch);
+    }
+
+    gboolean done = g_queue_is_empty(&deferred->order);
+    if(done) {
+        finish(monitoring_data);
+    }
+    monitoring_data_unref(monitoring_data);
+    return done ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+}
+
+/*
+ * Called when the tree with @monitoring_data@ has been created. The
+ * directories that were read get their monitors once the main loop
+ * runs.
+ */
+void deferred_watches_start(struct MonitoringData *monitoring_data) {
+    struct DeferredWatches *deferred = monitoring_data->deferred_watches;
+    if(deferred == NULL) {
+        return;
+    }
+    deferred->accepting = FALSE;
+    if(g_queue_is_empty(&deferred->order)) {
+        finish(monitoring_data);
+        return;
+    }
+    deferred->source_id = g_idle_add(install_watches, monitoring_data);
+}
+
+/*
+ * Returns TRUE if the directory @node@ is still waiting for its
+ * monitor.
+ */
+gboolean deferred_is_pending(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    if(vnrfile == NULL || vnrfile->monitoring_data == NULL ||
+       vnrfile->monitoring_data->deferred_watches == NULL) {
+        return FALSE;
+    }
+    return g_hash_table_contains(vnrfile->monitoring_data->deferred_watches->pending, node);
+}
+
+void deferred_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    if(vnrfile == NULL || vnrfile->monitoring_data == NULL ||
+       vnrfile->monitoring_data->deferred_watches == NULL) {
+        return;
+    }
+    g_hash_table_remove(vnrfile->monitoring_data->deferred_watches->pending, node);
+}
+
+void deferred_watches_free(struct DeferredWatches *deferred) {
+    if(deferred == NULL) {
+        return;
+    }
+    if(deferred->source_id != 0) {
+        g_source_remove(deferred->source_id);
+    }
+    g_hash_table_destroy(deferred->pending);
+    g_queue_clear(&deferred->order);
+    g_free(deferred);
+}
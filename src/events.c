@@ -0,0 +1,488 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Pending monitor events. When a tree has a coalescing delay, created,
+ * changed and deleted events are held back per path until the path has
+ * been quiet for the delay, and all events for a path within that time
+ * are merged into one. So are written events, if only complete files
+ * are added. Writing a large file thus becomes one event
+ * instead of a stream of changes, and a file that is created and
+ * removed again never touches the tree.
+ *
+ * When a tree has a time budget, events that are ready to be applied
+ * are applied from an idle source instead, a few at a time, until the
+ * budget for that main loop iteration is spent. The tree is changed
+ * one whole event at a time, so it is consistent between iterations.
+ */
+
+// A path that keeps changing is applied after this many delays anyway.
+#define MAX_DELAYS 10
+
+struct PendingEvent {
+    char *path;
+    // The other end of a move, or NULL.
+    char *other_path;
+    GNode *dir;
+    GFileMonitorEvent type;
+    // Whether the path did not exist before the earliest event.
+    gboolean created;
+    // Whether what was at the path before the earliest event was
+    // deleted, even if something has been created there since.
+    gboolean replaced;
+    // When the earliest of the merged events was received, for the
+    // statistics.
+    gint64 received;
+    gint64 first_seen;
+    gint64 deadline;
+};
+
+struct PendingEvents {
+    struct MonitoringData *monitoring_data;
+    gint64 delay_usec;
+    guint timeout_id;
+    // Path -> event, and the events in the order they arrived.
+    GHashTable *events;
+    GQueue order;
+    // Events taken out of the queue, in the order they are applied.
+    GQueue applying;
+    // 0 when ready events are applied all at once.
+    gint64 budget_usec;
+    guint idle_id;
+};
+
+
+static void pending_event_free(struct PendingEvent *event) {
+    g_free(event->path);
+    g_free(event->other_path);
+    g_free(event);
+}
+
+static struct PendingEvent* pending_event_new(char *path, GNode *dir, GFileMonitorEvent type, gint64 received) {
+    struct PendingEvent *event = g_new(struct PendingEvent, 1);
+    event->path = path;
+    event->other_path = NULL;
+    event->dir = dir;
+    event->type = type;
+    event->created = type == G_FILE_MONITOR_EVENT_CREATED;
+    event->replaced = FALSE;
+    event->received = received;
+    return event;
+}
+
+static gboolean is_coalesced(struct PendingEvents *pending, GFileMonitorEvent type) {
+    // Files are added when written, so that is held back as well.
+    if(type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT) {
+        return pending->monitoring_data->complete_files_only;
+    }
+    return type == G_FILE_MONITOR_EVENT_CREATED ||
+           type == G_FILE_MONITOR_EVENT_CHANGED ||
+           type == G_FILE_MONITOR_EVENT_DELETED;
+}
+
+/*
+ * Returns the single event that has the same effect as @event@
+ * followed by @later@, or -1 if the two cancel out. Only a path that
+ * did not exist before @event@ can cancel out; one that existed is
+ * deleted, and replaced if it is created again.
+ */
+static gint merge_event_types(struct PendingEvent *event, GFileMonitorEvent later) {
+    GFileMonitorEvent earlier = event->type;
+    if(event->created && later == G_FILE_MONITOR_EVENT_DELETED) {
+        return -1;
+    }
+    if(!event->created && earlier == G_FILE_MONITOR_EVENT_DELETED) {
+        event->replaced = TRUE;
+    }
+    if(earlier == G_FILE_MONITOR_EVENT_CREATED && later == G_FILE_MONITOR_EVENT_CHANGED) {
+        return G_FILE_MONITOR_EVENT_CREATED;
+    }
+    return later;
+}
+
+static void remove_event(struct PendingEvents *pending, struct PendingEvent *event) {
+    g_queue_remove(&pending->order, event);
+    g_hash_table_remove(pending->events, event->path);
+    pending_event_free(event);
+}
+
+static void apply_event(struct PendingEvents *pending, struct PendingEvent *event) {
+    GFile *file = g_file_new_for_path(event->path);
+    GFile *other_file = event->other_path == NULL ? NULL : g_file_new_for_path(event->other_path);
+
+    stats_apply_begin(pending->monitoring_data, event->received);
+    if(event->replaced && event->type != G_FILE_MONITOR_EVENT_DELETED) {
+        // The old one is removed first, so that the new one is read.
+        GNode *dir = event->dir;
+        node_guard(&dir);
+        vnr_file_apply_directory_event(dir, file, NULL, G_FILE_MONITOR_EVENT_DELETED);
+        node_unguard(&dir);
+        event->dir = dir;
+    }
+    if(event->dir != NULL) {
+        vnr_file_apply_directory_event(event->dir, file, other_file, event->type);
+    }
+    stats_apply_end(pending->monitoring_data);
+
+    g_object_unref(file);
+    if(other_file != NULL) {
+        g_object_unref(other_file);
+    }
+}
+
+/*
+ * Applies ready events until @budget_usec@ microseconds have passed,
+ * or all of them if it is 0. Returns the number of events applied.
+ */
+static guint apply_ready_events(struct PendingEvents *pending, gint64 budget_usec) {
+    struct MonitoringData *monitoring_data = pending->monitoring_data;
+    gint64 end = g_get_monotonic_time() + budget_usec;
+    guint applied = 0;
+
+    while(!g_queue_is_empty(&pending->applying)) {
+        struct PendingEvent *event = g_queue_pop_head(&pending->applying);
+        // NULL if the directory was removed by an earlier event.
+        if(event->dir != NULL) {
+            apply_event(pending, event);
+            applied++;
+        }
+        pending_event_free(event);
+
+        // The callback may have turned the pending events off.
+        if(monitoring_data->pending_events != pending ||
+           (budget_usec > 0 && g_get_monotonic_time() >= end)) {
+            break;
+        }
+    }
+    return applied;
+}
+
+static gboolean apply_events_idle(gpointer data) {
+    struct MonitoringData *monitoring_data = data;
+    struct PendingEvents *pending = monitoring_data->pending_events;
+
+    // The callbacks may free the tree.
+    monitoring_data_ref(monitoring_data);
+    apply_ready_events(pending, pending->budget_usec);
+
+    gboolean keep_going = monitoring_data->pending_events == pending && !g_queue_is_empty(&pending->applying);
+    if(!keep_going && monitoring_data->pending_events == pending) {
+        pending->idle_id = 0;
+    }
+    monitoring_data_unref(monitoring_data);
+    return keep_going ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/*
+ * Applies the ready events, right away or, with a time budget, from
+ * an idle source.
+ */
+static guint apply_or_schedule_ready_events(struct PendingEvents *pending) {
+    if(pending->budget_usec == 0) {
+        return apply_ready_events(pending, 0);
+    }
+    if(pending->idle_id == 0 && !g_queue_is_empty(&pending->applying)) {
+        pending->idle_id = g_idle_add(apply_events_idle, pending->monitoring_data);
+    }
+    return 0;
+}
+
+/*
+ * Makes the held back events whose time has come ready to be applied,
+ * or all of them if @all@ is TRUE.
+ */
+static void make_due_events_ready(struct PendingEvents *pending, gboolean all) {
+    gint64 now = g_get_monotonic_time();
+    GList *link = pending->order.head;
+
+    while(link != NULL) {
+        struct PendingEvent *event = link->data;
+        GList *next = link->next;
+        if(all || event->deadline <= now) {
+            g_queue_unlink(&pending->order, link);
+            g_hash_table_remove(pending->events, event->path);
+            g_queue_push_tail_link(&pending->applying, link);
+        }
+        link = next;
+    }
+}
+
+static gboolean apply_events_timeout(gpointer data) {
+    struct MonitoringData *monitoring_data = data;
+    struct PendingEvents *pending = monitoring_data->pending_events;
+
+    // The callbacks may free the tree.
+    monitoring_data_ref(monitoring_data);
+    make_due_events_ready(pending, FALSE);
+    apply_or_schedule_ready_events(pending);
+
+    gboolean keep_going = monitoring_data->pending_events == pending && !g_queue_is_empty(&pending->order);
+    if(!keep_going && monitoring_data->pending_events == pending) {
+        pending->timeout_id = 0;
+    }
+    monitoring_data_unref(monitoring_data);
+    return keep_going ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static void schedule(struct PendingEvents *pending) {
+    if(pending->timeout_id == 0) {
+        guint interval = MAX(pending->delay_usec / 1000 / 2, 1);
+        pending->timeout_id = g_timeout_add(interval, apply_events_timeout, pending->monitoring_data);
+    }
+}
+
+
+/**
+ * Holds back @type@ for @file@ in the directory @dir@ if the tree has a
+ * coalescing delay, merging it with what is already held back for the
+ * same path. Without a delay, or for a move, the event is queued if
+ * the tree has a time budget. @other_file@ is the other end of a move,
+ * or NULL. @received@ is when the event was received, for the
+ * statistics. Returns FALSE if the event should be applied right away.
+ */
+gboolean events_enqueue(GNode *dir, GFile *file, GFile *other_file, GFileMonitorEvent type, gint64 received) {
+    VnrFile *vnrfile = dir->data;
+    struct PendingEvents *pending = vnrfile->monitoring_data == NULL ? NULL : vnrfile->monitoring_data->pending_events;
+
+    if(pending == NULL) {
+        return FALSE;
+    }
+    if(pending->delay_usec == 0 || !is_coalesced(pending, type)) {
+        if(pending->budget_usec == 0) {
+            return FALSE;
+        }
+        struct PendingEvent *event = pending_event_new(g_file_get_path(file), dir, type, received);
+        event->other_path = other_file == NULL ? NULL : g_file_get_path(other_file);
+        g_queue_push_tail(&pending->applying, event);
+        apply_or_schedule_ready_events(pending);
+        return TRUE;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    char *path = g_file_get_path(file);
+    struct PendingEvent *event = g_hash_table_lookup(pending->events, path);
+
+    if(event == NULL) {
+        event = pending_event_new(path, dir, type, received);
+        event->first_seen = now;
+        g_hash_table_insert(pending->events, event->path, event);
+        g_queue_push_tail(&pending->order, event);
+    } else {
+        g_free(path);
+        stats_event_merged(pending->monitoring_data);
+        gint merged = merge_event_types(event, type);
+        if(merged == -1) {
+            remove_event(pending, event);
+            return TRUE;
+        }
+        event->type = merged;
+        event->dir = dir;
+    }
+    event->deadline = MIN(now + pending->delay_usec, event->first_seen + MAX_DELAYS * pending->delay_usec);
+
+    schedule(pending);
+    return TRUE;
+}
+
+/**
+ * Drops held back events that refer to the directory @node@. Called
+ * when the node is destroyed.
+ */
+void events_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    GList *link;
+
+    if(vnrfile == NULL || !vnrfile->is_directory || vnrfile->monitoring_data == NULL ||
+       vnrfile->monitoring_data->pending_events == NULL) {
+        return;
+    }
+    struct PendingEvents *pending = vnrfile->monitoring_data->pending_events;
+
+    link = pending->order.head;
+    while(link != NULL) {
+        struct PendingEvent *event = link->data;
+        link = link->next;
+        if(event->dir == node) {
+            remove_event(pending, event);
+        }
+    }
+    for(link = pending->applying.head; link != NULL; link = link->next) {
+        struct PendingEvent *event = link->data;
+        if(event->dir == node) {
+            event->dir = NULL;
+        }
+    }
+}
+
+static struct PendingEvents* get_pending_events(struct MonitoringData *monitoring_data) {
+    struct PendingEvents *pending = monitoring_data->pending_events;
+
+    if(pending == NULL) {
+        pending = g_new0(struct PendingEvents, 1);
+        pending->monitoring_data = monitoring_data;
+        pending->events = g_hash_table_new(g_str_hash, g_str_equal);
+        g_queue_init(&pending->order);
+        g_queue_init(&pending->applying);
+        monitoring_data->pending_events = pending;
+    }
+    return pending;
+}
+
+/*
+ * Applies everything and frees the pending events of @monitoring_data@
+ * once there is neither a delay nor a time budget.
+ */
+static void free_if_unused(struct MonitoringData *monitoring_data) {
+    struct PendingEvents *pending = monitoring_data->pending_events;
+
+    if(pending == NULL || pending->delay_usec != 0 || pending->budget_usec != 0) {
+        return;
+    }
+    make_due_events_ready(pending, TRUE);
+    apply_ready_events(pending, 0);
+
+    // Unless a callback has changed the settings again.
+    if(monitoring_data->pending_events == pending && pending->delay_usec == 0 && pending->budget_usec == 0) {
+        monitoring_data->pending_events = NULL;
+        events_free(pending);
+    }
+}
+
+/*
+ * Adds the directories that have events which have not been applied
+ * yet to the set @dirs@.
+ */
+void events_add_busy_directories(struct MonitoringData *monitoring_data, GHashTable *dirs) {
+    struct PendingEvents *pending = monitoring_data->pending_events;
+    GList *link;
+
+    if(pending == NULL) {
+        return;
+    }
+    for(link = pending->order.head; link != NULL; link = link->next) {
+        g_hash_table_add(dirs, ((struct PendingEvent*) link->data)->dir);
+    }
+    for(link = pending->applying.head; link != NULL; link = link->next) {
+        struct PendingEvent *event = link->data;
+        if(event->dir != NULL) {
+            g_hash_table_add(dirs, event->dir);
+        }
+    }
+}
+
+void events_free(struct PendingEvents *pending) {
+    if(pending == NULL) {
+        return;
+    }
+    if(pending->timeout_id != 0) {
+        g_source_remove(pending->timeout_id);
+    }
+    if(pending->idle_id != 0) {
+        g_source_remove(pending->idle_id);
+    }
+    while(!g_queue_is_empty(&pending->order)) {
+        pending_event_free(g_queue_pop_head(&pending->order));
+    }
+    while(!g_queue_is_empty(&pending->applying)) {
+        pending_event_free(g_queue_pop_head(&pending->applying));
+    }
+    g_hash_table_destroy(pending->events);
+    g_free(pending);
+}
+
+
+/**
+ * Makes the tree that @tree@ is part of hold back created, changed and
+ * deleted events for a path until no event has arrived for it in
+ * @delay_ms@ milliseconds, and then apply them as one. A path that
+ * keeps changing is applied after ten times the delay at the latest.
+ * A file that is created and deleted again within the delay is never
+ * added, and the callback is not called for it.
+ * A @delay_ms@ of 0 applies all held back events and turns coalescing
+ * off.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_event_coalescing(GNode *tree, guint delay_ms) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        return FALSE;
+    }
+    if(delay_ms == 0 && monitoring_data->pending_events == NULL) {
+        return TRUE;
+    }
+    struct PendingEvents *pending = get_pending_events(monitoring_data);
+    pending->delay_usec = (gint64) delay_ms * 1000;
+
+    if(delay_ms == 0) {
+        // The callbacks may free the tree.
+        monitoring_data_ref(monitoring_data);
+        make_due_events_ready(pending, TRUE);
+        apply_or_schedule_ready_events(pending);
+        free_if_unused(monitoring_data);
+        monitoring_data_unref(monitoring_data);
+    }
+    return TRUE;
+}
+
+/**
+ * Makes the tree that @tree@ is part of apply file system changes from
+ * an idle source, spending at most about @budget_ms@ milliseconds on
+ * them per main loop iteration, instead of all at once as they arrive.
+ * A burst of thousands of changes is then spread over many iterations,
+ * and the main loop keeps running in between. The tree is changed one
+ * whole change at a time, so it can be used between iterations. Works
+ * together with set_event_coalescing; changes that are held back are
+ * applied within the budget once their time has come.
+ * A @budget_ms@ of 0 applies all queued changes and turns the budget
+ * off.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_event_time_budget(GNode *tree, guint budget_ms) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        return FALSE;
+    }
+    if(budget_ms == 0 && monitoring_data->pending_events == NULL) {
+        return TRUE;
+    }
+    struct PendingEvents *pending = get_pending_events(monitoring_data);
+    pending->budget_usec = (gint64) budget_ms * 1000;
+
+    if(budget_ms == 0) {
+        if(pending->idle_id != 0) {
+            g_source_remove(pending->idle_id);
+            pending->idle_id = 0;
+        }
+        // The callbacks may free the tree.
+        monitoring_data_ref(monitoring_data);
+        apply_ready_events(pending, 0);
+        free_if_unused(monitoring_data);
+        monitoring_data_unref(monitoring_data);
+    }
+    return TRUE;
+}
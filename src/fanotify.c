@@ -0,0 +1,396 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+#define UNUSED(x) (void)(x)
+
+#ifdef __linux__
+#include <sys/fanotify.h>
+#endif
+
+#if defined(__linux__) && defined(FAN_REPORT_DFID_NAME)
+
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+/*
+ * Monitoring through fanotify. One mark per file system covers every
+ * directory of a tree on it, so the number of directories is not
+ * limited by fs.inotify.max_user_watches. Events carry the file handle
+ * of the directory and the name of the entry, and the handle is looked
+ * up among the handles of the directories in the tree.
+ *
+ * Marking a whole file system needs CAP_SYS_ADMIN. Without it, the
+ * tree falls back to the inotify backend.
+ */
+
+#define FANOTIFY_BUFFER_SIZE 16384
+
+// The mark covers the whole file system, so writes are only reported
+// when the file is closed, rather than for every write() anywhere on it.
+#define FANOTIFY_EVENTS (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | \
+                         FAN_CLOSE_WRITE | FAN_ONDIR)
+
+#ifdef FAN_RENAME
+// From Linux 5.17, a move is one event with both ends, so the nodes can
+// be kept. Older kernels reject it, and get the halves of the move as
+// a removal and an addition.
+#define FANOTIFY_RENAME_EVENTS (FAN_CREATE | FAN_DELETE | FAN_RENAME | \
+                                FAN_CLOSE_WRITE | FAN_ONDIR)
+#endif
+
+struct FanotifyWatches {
+    int fd;
+    guint source_id;
+    // File systems that have been marked, by st_dev.
+    GHashTable *marked_devices;
+    // File system id and directory handle -> GNode, and back.
+    GHashTable *nodes;
+    GHashTable *handles;
+};
+
+
+static GBytes* make_handle_key(const void *fsid, const struct file_handle *handle) {
+    gsize handle_size = sizeof(struct file_handle) + handle->handle_bytes;
+    guint8 *key = g_malloc(sizeof(__kernel_fsid_t) + handle_size);
+
+    memcpy(key, fsid, sizeof(__kernel_fsid_t));
+    memcpy(key + sizeof(__kernel_fsid_t), handle, handle_size);
+    return g_bytes_new_take(key, sizeof(__kernel_fsid_t) + handle_size);
+}
+
+static GBytes* get_directory_handle_key(const char *path) {
+    struct statfs fs;
+    int mount_id;
+    struct file_handle *handle = g_malloc(sizeof(struct file_handle) + MAX_HANDLE_SZ);
+    GBytes *key = NULL;
+
+    handle->handle_bytes = MAX_HANDLE_SZ;
+    if(statfs(path, &fs) == 0 && name_to_handle_at(AT_FDCWD, path, handle, &mount_id, 0) == 0) {
+        key = make_handle_key(&fs.f_fsid, handle);
+    }
+    g_free(handle);
+    return key;
+}
+
+
+static gboolean event_type_from_mask(guint64 mask, GFileMonitorEvent *type) {
+    if(mask & FAN_CREATE) {
+        *type = G_FILE_MONITOR_EVENT_CREATED;
+    } else if(mask & FAN_MOVED_TO) {
+        *type = G_FILE_MONITOR_EVENT_MOVED_IN;
+    } else if(mask & (FAN_DELETE | FAN_MOVED_FROM)) {
+        *type = G_FILE_MONITOR_EVENT_DELETED;
+    } else if(mask & FAN_CLOSE_WRITE) {
+        *type = G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT;
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Returns the directory in the tree that the directory handle of @fid@
+ * is for, or NULL if it is outside the tree, and points @name@ at the
+ * name of the entry that follows the handle.
+ */
+static GNode* find_directory(struct FanotifyWatches *fanotify, struct fanotify_event_info_fid *fid,
+                             const char **name) {
+    struct file_handle *handle = (struct file_handle*) fid->handle;
+    GBytes *key = make_handle_key(&fid->fsid, handle);
+    GNode *node = g_hash_table_lookup(fanotify->nodes, key);
+
+    g_bytes_unref(key);
+    *name = (const char*) handle->f_handle + handle->handle_bytes;
+    return node;
+}
+
+#ifdef FAN_RENAME
+/*
+ * A move has a record for the directory it was in and one for the
+ * directory it went to. If only one of them is in the tree, it is a
+ * removal or an addition.
+ */
+static void dispatch_rename(struct FanotifyWatches *fanotify, struct fanotify_event_metadata *metadata) {
+    GNode *from_node = NULL, *to_node = NULL;
+    const char *from_name = NULL, *to_name = NULL;
+    gsize offset = sizeof(*metadata);
+
+    while(offset + sizeof(struct fanotify_event_info_fid) <= (gsize) metadata->event_len) {
+        struct fanotify_event_info_fid *fid = (struct fanotify_event_info_fid*) ((gchar*) metadata + offset);
+        if(fid->hdr.len == 0) {
+            break;
+        }
+        if(fid->hdr.info_type == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME) {
+            from_node = find_directory(fanotify, fid, &from_name);
+        } else if(fid->hdr.info_type == FAN_EVENT_INFO_TYPE_NEW_DFID_NAME) {
+            to_node = find_directory(fanotify, fid, &to_name);
+        }
+        offset += fid->hdr.len;
+    }
+
+    if(from_node != NULL && to_node != NULL) {
+        vnr_file_directory_entry_moved(from_node, from_name, to_node, to_name);
+    } else if(from_node != NULL) {
+        vnr_file_directory_entry_updated(from_node, from_name, G_FILE_MONITOR_EVENT_DELETED);
+    } else if(to_node != NULL) {
+        vnr_file_directory_entry_updated(to_node, to_name, G_FILE_MONITOR_EVENT_MOVED_IN);
+    }
+}
+#endif
+
+static void dispatch_event(struct FanotifyWatches *fanotify, struct fanotify_event_metadata *metadata) {
+    struct fanotify_event_info_fid *fid = (struct fanotify_event_info_fid*) (metadata + 1);
+    GFileMonitorEvent type;
+    const char *name;
+
+#ifdef FAN_RENAME
+    if(metadata->mask & FAN_RENAME) {
+        dispatch_rename(fanotify, metadata);
+        return;
+    }
+#endif
+    if((gsize) metadata->event_len < sizeof(*metadata) + sizeof(*fid) ||
+       fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME ||
+       !event_type_from_mask(metadata->mask, &type)) {
+        return;
+    }
+
+    GNode *node = find_directory(fanotify, fid, &name);
+
+    // Events from directories outside the tree are dropped here.
+    if(node != NULL && strcmp(name, ".") != 0) {
+        vnr_file_directory_entry_updated(node, name, type);
+    }
+}
+
+static GNode* any_watched_node(struct FanotifyWatches *fanotify) {
+    GHashTableIter iter;
+    gpointer node = NULL;
+
+    g_hash_table_iter_init(&iter, fanotify->nodes);
+    g_hash_table_iter_next(&iter, NULL, &node);
+    return node;
+}
+
+static gboolean read_events(gint fd, GIOCondition condition, gpointer data) {
+    UNUSED(condition);
+    struct MonitoringData *monitoring_data = data;
+    gchar buffer[FANOTIFY_BUFFER_SIZE] __attribute__ ((aligned(__alignof__(struct fanotify_event_metadata))));
+    ssize_t length;
+
+    // The callbacks may free the tree; keep the watches until all read
+    // events have been looked at.
+    monitoring_data_ref(monitoring_data);
+
+    // Everything that happened before now is either in the queue or
+    // has been read already.
+    gint64 started = g_get_real_time() * 1000;
+    gboolean overflow = FALSE;
+
+    while((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        struct fanotify_event_metadata *metadata = (struct fanotify_event_metadata*) buffer;
+        while(FAN_EVENT_OK(metadata, length)) {
+            if(metadata->vers == FANOTIFY_METADATA_VERSION) {
+                if(metadata->mask & FAN_Q_OVERFLOW) {
+                    overflow = TRUE;
+                } else {
+                    dispatch_event(monitoring_data->fanotify, metadata);
+                }
+            }
+            metadata = FAN_EVENT_NEXT(metadata, length);
+        }
+    }
+
+    GNode *node = any_watched_node(monitoring_data->fanotify);
+    if(overflow && node != NULL) {
+        reconcile_overflow(node);
+    } else if(!overflow && errno == EAGAIN) {
+        reconcile_note_in_sync(monitoring_data, started);
+    }
+
+    monitoring_data_unref(monitoring_data);
+    return G_SOURCE_CONTINUE;
+}
+
+static struct FanotifyWatches* get_watches(struct MonitoringData *monitoring_data) {
+    if(monitoring_data->fanotify != NULL) {
+        return monitoring_data->fanotify;
+    }
+    int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY);
+    if(fd == -1) {
+        return NULL;
+    }
+
+    struct FanotifyWatches *fanotify = g_new0(struct FanotifyWatches, 1);
+    fanotify->fd = fd;
+    fanotify->marked_devices = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    fanotify->nodes = g_hash_table_new_full(g_bytes_hash, g_bytes_equal, (GDestroyNotify) g_bytes_unref, NULL);
+    fanotify->handles = g_hash_table_new(g_direct_hash, g_direct_equal);
+    fanotify->source_id = g_unix_fd_add(fd, G_IO_IN, read_events, monitoring_data);
+    monitoring_data->fanotify = fanotify;
+    return fanotify;
+}
+
+static gboolean mark_file_system(struct FanotifyWatches *fanotify, const char *path) {
+    struct stat st;
+    gint64 device;
+
+    if(stat(path, &st) != 0) {
+        return FALSE;
+    }
+    device = st.st_dev;
+    if(g_hash_table_contains(fanotify->marked_devices, &device)) {
+        return TRUE;
+    }
+#ifdef FAN_RENAME
+    if(fanotify_mark(fanotify->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_RENAME_EVENTS, AT_FDCWD, path) != 0 &&
+       (errno != EINVAL ||
+        fanotify_mark(fanotify->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_EVENTS, AT_FDCWD, path) != 0)) {
+        return FALSE;
+    }
+#else
+    if(fanotify_mark(fanotify->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_EVENTS, AT_FDCWD, path) != 0) {
+        return FALSE;
+    }
+#endif
+    gint64 *marked_device = g_new(gint64, 1);
+    *marked_device = device;
+    g_hash_table_add(fanotify->marked_devices, marked_device);
+    return TRUE;
+}
+
+/**
+ * Registers the directory @node@ with the fanotify mark of its file
+ * system if the tree uses the fanotify backend. Returns FALSE if the
+ * node has to be watched in some other way. If fanotify cannot be used
+ * at all, the tree is switched to the inotify backend.
+ */
+gboolean fanotify_watch(GNode *node, struct MonitoringData *monitoring_data) {
+    VnrFile *vnrfile = node->data;
+
+    // Files given directly in a URI list are watched by inotify.
+    if(monitoring_data->backend != MONITOR_BACKEND_FANOTIFY || !vnrfile->is_directory) {
+        return FALSE;
+    }
+    struct FanotifyWatches *fanotify = get_watches(monitoring_data);
+    if(fanotify == NULL || !mark_file_system(fanotify, vnrfile->path)) {
+        if(fanotify == NULL || g_hash_table_size(fanotify->marked_devices) == 0) {
+            g_warning("Could not use fanotify, using inotify instead: %s", g_strerror(errno));
+            fanotify_watches_free(fanotify);
+            monitoring_data->fanotify = NULL;
+            monitoring_data->backend = MONITOR_BACKEND_INOTIFY;
+        }
+        return FALSE;
+    }
+
+    GBytes *key = get_directory_handle_key(vnrfile->path);
+    if(key == NULL || g_hash_table_contains(fanotify->nodes, key)) {
+        if(key != NULL) {
+            g_bytes_unref(key);
+        }
+        return FALSE;
+    }
+    g_hash_table_insert(fanotify->nodes, key, node);
+    g_hash_table_insert(fanotify->handles, node, key);
+    return TRUE;
+}
+
+/**
+ * Stops resolving events to @node@. Called when the node is destroyed.
+ */
+void fanotify_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+
+    if(vnrfile == NULL || vnrfile->monitoring_data == NULL || vnrfile->monitoring_data->fanotify == NULL) {
+        return;
+    }
+    struct FanotifyWatches *fanotify = vnrfile->monitoring_data->fanotify;
+    GBytes *key = g_hash_table_lookup(fanotify->handles, node);
+    if(key != NULL) {
+        g_hash_table_remove(fanotify->handles, node);
+        g_hash_table_remove(fanotify->nodes, key);
+    }
+}
+
+void fanotify_watches_free(struct FanotifyWatches *fanotify) {
+    if(fanotify == NULL) {
+        return;
+    }
+    g_source_remove(fanotify->source_id);
+    close(fanotify->fd);
+    g_hash_table_destroy(fanotify->marked_devices);
+    g_hash_table_destroy(fanotify->handles);
+    g_hash_table_destroy(fanotify->nodes);
+    g_free(fanotify);
+}
+
+void fanotify_add_memory_usage(struct FanotifyWatches *fanotify, struct MemoryUsage *usage) {
+    GHashTableIter iter;
+    gpointer key;
+
+    if(fanotify == NULL) {
+        return;
+    }
+    usage->indexes += sizeof(struct FanotifyWatches) +
+                      g_hash_table_size(fanotify->marked_devices) * (HASH_TABLE_ENTRY_SIZE + sizeof(gint64));
+    // Each watch is in both tables, sharing the handle.
+    g_hash_table_iter_init(&iter, fanotify->nodes);
+    while(g_hash_table_iter_next(&iter, &key, NULL)) {
+        usage->indexes += 2 * HASH_TABLE_ENTRY_SIZE + g_bytes_get_size(key);
+    }
+}
+
+#else
+
+gboolean fanotify_watch(GNode *node, struct MonitoringData *monitoring_data) {
+    UNUSED(node);
+    if(monitoring_data->backend == MONITOR_BACKEND_FANOTIFY) {
+        monitoring_data->backend = MONITOR_BACKEND_INOTIFY;
+    }
+    return FALSE;
+}
+
+void fanotify_forget(GNode *node) {
+    UNUSED(node);
+}
+
+void fanotify_watches_free(struct FanotifyWatches *fanotify) {
+    UNUSED(fanotify);
+}
+
+void fanotify_add_memory_usage(struct FanotifyWatches *fanotify, struct MemoryUsage *usage) {
+    UNUSED(fanotify);
+    UNUSED(usage);
+}
+
+#endif
@@ -0,0 +1,316 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+#define UNUSED(x) (void)(x)
+
+#ifdef __linux__
+
+#include <glib-unix.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/*
+ * Monitoring through one inotify descriptor per tree. The watch
+ * descriptor of every monitored node maps straight to the node, and
+ * events are read in bulk and passed on to vnr_file_directory_updated
+ * as the GFileMonitor events that GIO would have emitted.
+ */
+
+#define INOTIFY_BUFFER_SIZE 16384
+
+// Writes are only reported when the file is closed, rather than for
+// every write(), which a file being copied in would flood the tree with.
+#define DIRECTORY_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                          IN_CLOSE_WRITE | IN_ATTRIB |                         \
+                          IN_DELETE_SELF | IN_MOVE_SELF)
+#define FILE_EVENTS      (IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct InotifyWatches {
+    int fd;
+    guint source_id;
+    // Watch descriptor -> GNode, and back.
+    GHashTable *nodes;
+    GHashTable *descriptors;
+};
+
+
+static gboolean event_type_from_mask(guint32 mask, GFileMonitorEvent *type) {
+    if(mask & IN_CREATE) {
+        *type = G_FILE_MONITOR_EVENT_CREATED;
+    } else if(mask & IN_MOVED_TO) {
+        // Moved in from outside, or its pair was not found.
+        *type = G_FILE_MONITOR_EVENT_MOVED_IN;
+    } else if(mask & (IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF)) {
+        *type = G_FILE_MONITOR_EVENT_DELETED;
+    } else if(mask & IN_CLOSE_WRITE) {
+        *type = G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT;
+    } else if(mask & IN_ATTRIB) {
+        *type = G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED;
+    } else if(mask & IN_UNMOUNT) {
+        *type = G_FILE_MONITOR_EVENT_UNMOUNTED;
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void remove_watch_mapping(struct InotifyWatches *inotify, int wd) {
+    GNode *node = g_hash_table_lookup(inotify->nodes, GINT_TO_POINTER(wd));
+    if(node != NULL) {
+        g_hash_table_remove(inotify->descriptors, node);
+        g_hash_table_remove(inotify->nodes, GINT_TO_POINTER(wd));
+    }
+}
+
+static void dispatch_event(struct InotifyWatches *inotify, struct inotify_event *event) {
+    GFileMonitorEvent type;
+    GNode *node = g_hash_table_lookup(inotify->nodes, GINT_TO_POINTER(event->wd));
+
+    if(node == NULL) {
+        return;
+    }
+    if(event->mask & IN_IGNORED) {
+        // The kernel dropped the watch, e.g. because the directory is
+        // gone or its file system was unmounted. Whether it should be
+        // watched again is decided after the events before this one,
+        // such as the unmount, have been applied.
+        remove_watch_mapping(inotify, event->wd);
+        vnr_file_directory_entry_updated(node, NULL, VNR_FILE_MONITOR_EVENT_WATCH_LOST);
+        return;
+    }
+    if(event->mask & IN_MOVE_SELF) {
+        // The watch follows the node, and a move within the tree is
+        // reported by the directory it was in. Only what is not in a
+        // directory of the tree has none: an entry of a uri-list is
+        // gone, and the root has lost its watch on the path.
+        if(node->parent != NULL && node->parent->data == NULL) {
+            vnr_file_directory_entry_updated(node, NULL, G_FILE_MONITOR_EVENT_DELETED);
+        } else if(node->parent == NULL) {
+            vnr_file_directory_entry_updated(node, NULL, VNR_FILE_MONITOR_EVENT_WATCH_LOST);
+        }
+        return;
+    }
+    if(!event_type_from_mask(event->mask, &type)) {
+        return;
+    }
+
+    vnr_file_directory_entry_updated(node, event->len > 0 ? event->name : NULL, type);
+}
+
+/*
+ * Both halves of a move within the tree arrive next to each other,
+ * with the same cookie. They are passed on as one move, so that the
+ * nodes can be kept.
+ */
+static gboolean dispatch_move(struct InotifyWatches *inotify,
+                              struct inotify_event *from,
+                              struct inotify_event *to) {
+    GNode *from_node = g_hash_table_lookup(inotify->nodes, GINT_TO_POINTER(from->wd));
+    GNode *to_node = g_hash_table_lookup(inotify->nodes, GINT_TO_POINTER(to->wd));
+
+    if(from_node == NULL || to_node == NULL || from->len == 0 || to->len == 0) {
+        return FALSE;
+    }
+    vnr_file_directory_entry_moved(from_node, from->name, to_node, to->name);
+    return TRUE;
+}
+
+static GNode* any_watched_node(struct InotifyWatches *inotify) {
+    GHashTableIter iter;
+    gpointer node = NULL;
+
+    g_hash_table_iter_init(&iter, inotify->nodes);
+    g_hash_table_iter_next(&iter, NULL, &node);
+    return node;
+}
+
+static gboolean read_events(gint fd, GIOCondition condition, gpointer data) {
+    UNUSED(condition);
+    struct MonitoringData *monitoring_data = data;
+    gchar buffer[INOTIFY_BUFFER_SIZE] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    // The callbacks may free the tree; keep the watches until all read
+    // events have been looked at.
+    monitoring_data_ref(monitoring_data);
+
+    // Everything that happened before now is either in the queue or
+    // has been read already.
+    gint64 started = g_get_real_time() * 1000;
+    gboolean overflow = FALSE;
+
+    while((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        struct inotify_event *moved_from = NULL;
+        ssize_t offset = 0;
+        while(offset < length) {
+            struct inotify_event *event = (struct inotify_event*) (buffer + offset);
+            offset += sizeof(struct inotify_event) + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW) {
+                overflow = TRUE;
+                continue;
+            }
+            if(moved_from != NULL && (event->mask & IN_MOVED_TO) && event->cookie == moved_from->cookie &&
+               dispatch_move(monitoring_data->inotify, moved_from, event)) {
+                moved_from = NULL;
+                continue;
+            }
+            if(moved_from != NULL) {
+                dispatch_event(monitoring_data->inotify, moved_from);
+                moved_from = NULL;
+            }
+            if(event->mask & IN_MOVED_FROM) {
+                moved_from = event;
+            } else {
+                dispatch_event(monitoring_data->inotify, event);
+            }
+        }
+        if(moved_from != NULL) {
+            dispatch_event(monitoring_data->inotify, moved_from);
+        }
+    }
+
+    GNode *node = any_watched_node(monitoring_data->inotify);
+    if(overflow && node != NULL) {
+        reconcile_overflow(node);
+    } else if(!overflow && errno == EAGAIN) {
+        reconcile_note_in_sync(monitoring_data, started);
+    }
+
+    monitoring_data_unref(monitoring_data);
+    return G_SOURCE_CONTINUE;
+}
+
+static struct InotifyWatches* get_watches(struct MonitoringData *monitoring_data) {
+    if(monitoring_data->inotify != NULL) {
+        return monitoring_data->inotify;
+    }
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd == -1) {
+        g_warning("Could not initialize inotify, using GIO monitors instead: %s", g_strerror(errno));
+        monitoring_data->backend = MONITOR_BACKEND_GIO;
+        return NULL;
+    }
+
+    struct InotifyWatches *inotify = g_new0(struct InotifyWatches, 1);
+    inotify->fd = fd;
+    inotify->nodes = g_hash_table_new(g_direct_hash, g_direct_equal);
+    inotify->descriptors = g_hash_table_new(g_direct_hash, g_direct_equal);
+    inotify->source_id = g_unix_fd_add(fd, G_IO_IN, read_events, monitoring_data);
+    monitoring_data->inotify = inotify;
+    return inotify;
+}
+
+/**
+ * Adds an inotify watch for @node@ if the tree uses the inotify or
+ * fanotify backend. Returns FALSE if the node should get a GFileMonitor instead.
+ */
+gboolean inotify_watch(GNode *node, struct MonitoringData *monitoring_data) {
+    // Also used for what the fanotify backend cannot watch.
+    if(monitoring_data->backend != MONITOR_BACKEND_INOTIFY && monitoring_data->backend != MONITOR_BACKEND_FANOTIFY) {
+        return FALSE;
+    }
+    struct InotifyWatches *inotify = get_watches(monitoring_data);
+    if(inotify == NULL) {
+        return FALSE;
+    }
+
+    VnrFile *vnrfile = node->data;
+    guint32 mask = vnrfile->is_directory ? DIRECTORY_EVENTS : FILE_EVENTS;
+    int wd = inotify_add_watch(inotify->fd, vnrfile->path, mask | IN_MASK_ADD);
+
+    // The same inode watched through two nodes would share one
+    // descriptor, so the second node gets a GFileMonitor.
+    if(wd == -1 || g_hash_table_contains(inotify->nodes, GINT_TO_POINTER(wd))) {
+        return FALSE;
+    }
+    g_hash_table_insert(inotify->nodes, GINT_TO_POINTER(wd), node);
+    g_hash_table_insert(inotify->descriptors, node, GINT_TO_POINTER(wd));
+    return TRUE;
+}
+
+/**
+ * Removes the inotify watch of @node@, if it has one. Called when the
+ * node is destroyed.
+ */
+void inotify_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    gpointer wd;
+
+    if(vnrfile == NULL || vnrfile->monitoring_data == NULL || vnrfile->monitoring_data->inotify == NULL) {
+        return;
+    }
+    struct InotifyWatches *inotify = vnrfile->monitoring_data->inotify;
+    if(g_hash_table_lookup_extended(inotify->descriptors, node, NULL, &wd)) {
+        inotify_rm_watch(inotify->fd, GPOINTER_TO_INT(wd));
+        remove_watch_mapping(inotify, GPOINTER_TO_INT(wd));
+    }
+}
+
+void inotify_watches_free(struct InotifyWatches *inotify) {
+    if(inotify == NULL) {
+        return;
+    }
+    g_source_remove(inotify->source_id);
+    close(inotify->fd);
+    g_hash_table_destroy(inotify->nodes);
+    g_hash_table_destroy(inotify->descriptors);
+    g_free(inotify);
+}
+
+void inotify_add_memory_usage(struct InotifyWatches *inotify, struct MemoryUsage *usage) {
+    if(inotify == NULL) {
+        return;
+    }
+    // Each watch is in both tables.
+    usage->indexes += sizeof(struct InotifyWatches) +
+                      2 * g_hash_table_size(inotify->nodes) * HASH_TABLE_ENTRY_SIZE;
+}
+
+#else
+
+gboolean inotify_watch(GNode *node, struct MonitoringData *monitoring_data) {
+    UNUSED(node);
+    UNUSED(monitoring_data);
+    return FALSE;
+}
+
+void inotify_forget(GNode *node) {
+    UNUSED(node);
+}
+
+void inotify_watches_free(struct InotifyWatches *inotify) {
+    UNUSED(inotify);
+}
+
+void inotify_add_memory_usage(struct InotifyWatches *inotify, struct MemoryUsage *usage) {
+    UNUSED(inotify);
+    UNUSED(usage);
+}
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Entry index. Files that are written to get an event for every write,
+ * and each has to find its node among the entries of its directory.
+ * The entries of a directory that gets such events are put in a hash
+ * table the first time, so that later lookups do not depend on how
+ * many entries there are. Nodes that are added later are put in it
+ * when they are first found the slow way. The entries of a directory
+ * that has not been looked in for a while are taken out again.
+ */
+
+// How long the entries of a directory stay in the index after it was
+// last looked in, and how often that is checked, in seconds.
+#define INDEX_IDLE_SEC 30
+
+struct EntryIndex {
+    // Path -> GNode. The paths are copies, since compaction and moves
+    // replace the strings of the nodes.
+    GHashTable *by_path;
+    // GNode -> the path it is stored under in by_path.
+    GHashTable *by_node;
+    // The directories whose entries have been put in the index -> when
+    // they were last looked in, in seconds of g_get_monotonic_time.
+    GHashTable *directories;
+    gint next_eviction;
+    // While evicting, the time before which directories are idle.
+    gint idle_before;
+};
+
+
+static void forget_entry(struct EntryIndex *index, GNode *node) {
+    char *path = g_hash_table_lookup(index->by_node, node);
+    if(path != NULL) {
+        g_hash_table_remove(index->by_node, node);
+        // Frees the path.
+        g_hash_table_remove(index->by_path, path);
+    }
+}
+
+/*
+ * Puts @node@, an entry of the directory @dir@, in the index if the
+ * entries of @dir@ are in it. Does nothing if @node@ is NULL.
+ */
+void entry_index_add(GNode *dir, GNode *node) {
+    struct EntryIndex *index = ((VnrFile*) dir->data)->monitoring_data->entry_index;
+
+    if(index == NULL || node == NULL || node->parent != dir || !g_hash_table_contains(index->directories, dir)) {
+        return;
+    }
+    forget_entry(index, node);
+    GNode *previous = g_hash_table_lookup(index->by_path, ((VnrFile*) node->data)->path);
+    if(previous != NULL) {
+        g_hash_table_remove(index->by_node, previous);
+    }
+    char *path = g_strdup(((VnrFile*) node->data)->path);
+    g_hash_table_replace(index->by_path, path, node);
+    g_hash_table_insert(index->by_node, node, path);
+}
+
+static void forget_directory(struct EntryIndex *index, GNode *dir) {
+    for(GNode *child = g_node_first_child(dir); child != NULL; child = g_node_next_sibling(child)) {
+        forget_entry(index, child);
+    }
+}
+
+static gboolean is_idle(gpointer key, gpointer value, gpointer data) {
+    struct EntryIndex *index = data;
+    if(GPOINTER_TO_INT(value) >= index->idle_before) {
+        return FALSE;
+    }
+    forget_directory(index, key);
+    return TRUE;
+}
+
+static void evict_idle_directories(struct EntryIndex *index, gint now) {
+    if(now < index->next_eviction) {
+        return;
+    }
+    index->next_eviction = now + INDEX_IDLE_SEC;
+    index->idle_before = now - INDEX_IDLE_SEC;
+    g_hash_table_foreach_remove(index->directories, is_idle, index);
+}
+
+/*
+ * Returns the entry of the directory @dir@ that has the path @path@,
+ * or NULL if it is not in the index. The entries of @dir@ are put in
+ * the index first if they are not already. Packed directories and
+ * those that have been moved out of memory are left to their own
+ * lookups.
+ */
+GNode* entry_index_find(GNode *dir, const char *path) {
+    struct MonitoringData *monitoring_data = ((VnrFile*) dir->data)->monitoring_data;
+    struct EntryIndex *index = monitoring_data->entry_index;
+
+    if(packed_get_number_of_files(dir) > 0 || spill_is_stub(dir)) {
+        return NULL;
+    }
+    if(index == NULL) {
+        index = g_new(struct EntryIndex, 1);
+        index->by_path = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        index->by_node = g_hash_table_new(g_direct_hash, g_direct_equal);
+        index->directories = g_hash_table_new(g_direct_hash, g_direct_equal);
+        index->next_eviction = 0;
+        monitoring_data->entry_index = index;
+    }
+    gint now = g_get_monotonic_time() / G_USEC_PER_SEC;
+    evict_idle_directories(index, now);
+
+    gboolean indexed = g_hash_table_contains(index->directories, dir);
+    g_hash_table_insert(index->directories, dir, GINT_TO_POINTER(now));
+    if(!indexed) {
+        for(GNode *child = g_node_first_child(dir); child != NULL; child = g_node_next_sibling(child)) {
+            entry_index_add(dir, child);
+        }
+    }
+
+    GNode *node = g_hash_table_lookup(index->by_path, path);
+    // A node that has been moved since is stored under its old path.
+    if(node != NULL && (node->parent != dir || strcmp(((VnrFile*) node->data)->path, path) != 0)) {
+        forget_entry(index, node);
+        return NULL;
+    }
+    return node;
+}
+
+/* Called when @node@ is destroyed. */
+void entry_index_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    struct MonitoringData *monitoring_data = vnrfile == NULL ? NULL : vnrfile->monitoring_data;
+
+    // Files have no monitoring data of their own, but are still in
+    // their directory while they are destroyed.
+    if(monitoring_data == NULL && vnrfile != NULL && node->parent != NULL && node->parent->data != NULL) {
+        monitoring_data = ((VnrFile*) node->parent->data)->monitoring_data;
+    }
+    if(monitoring_data == NULL || monitoring_data->entry_index == NULL) {
+        return;
+    }
+    forget_entry(monitoring_data->entry_index, node);
+    g_hash_table_remove(monitoring_data->entry_index->directories, node);
+}
+
+void entry_index_add_memory_usage(struct EntryIndex *index, struct MemoryUsage *usage) {
+    GHashTableIter iter;
+    gpointer path;
+
+    if(index == NULL) {
+        return;
+    }
+    usage->indexes += sizeof(struct EntryIndex) +
+                      g_hash_table_size(index->directories) * HASH_TABLE_ENTRY_SIZE;
+    // Each entry is in both tables, with a copy of its path.
+    g_hash_table_iter_init(&iter, index->by_path);
+    while(g_hash_table_iter_next(&iter, &path, NULL)) {
+        usage->indexes += 2 * HASH_TABLE_ENTRY_SIZE + strlen(path) + 1;
+    }
+}
+
+void entry_index_free(struct EntryIndex *index) {
+    if(index == NULL) {
+        return;
+    }
+    g_hash_table_destroy(index->by_path);
+    g_hash_table_destroy(index->by_node);
+    g_hash_table_destroy(index->directories);
+    g_free(index);
+}
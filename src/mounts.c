@@ -0,0 +1,198 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+#define UNUSED(x) (void)(x)
+
+#ifdef __linux__
+
+#include <glib-unix.h>
+#include <unistd.h>
+
+/*
+ * Remounts. When a file system in a tree is unmounted, the directory it
+ * was mounted on is removed from the tree, but remembered. The mount
+ * table of the process is watched, and once something is mounted on the
+ * directory again, it is added back and read from scratch. The root of
+ * a tree is kept, without its entries, and read again instead.
+ */
+
+struct Unmounted {
+    // The directory in the tree that the mount point is in, or the
+    // mount point itself if it is the root of the tree.
+    GNode *dir;
+    char *path;
+};
+
+struct MountWatch {
+    GSList *unmounted;
+    int fd;
+    guint source_id;
+};
+
+
+static void unmounted_free(struct Unmounted *unmounted) {
+    g_free(unmounted->path);
+    g_free(unmounted);
+}
+
+static gboolean is_mount_point(const char *path) {
+    struct stat st, parent_st;
+    char *parent = g_path_get_dirname(path);
+    gboolean mounted = stat(path, &st) == 0 && stat(parent, &parent_st) == 0 &&
+                       S_ISDIR(st.st_mode) && st.st_dev != parent_st.st_dev;
+    g_free(parent);
+    return mounted;
+}
+
+static struct Unmounted* take_remounted(struct MountWatch *mounts) {
+    GSList *it;
+    for(it = mounts->unmounted; it != NULL; it = it->next) {
+        struct Unmounted *unmounted = it->data;
+        if(is_mount_point(unmounted->path)) {
+            mounts->unmounted = g_slist_delete_link(mounts->unmounted, it);
+            return unmounted;
+        }
+    }
+    return NULL;
+}
+
+static gboolean mounts_changed(gint fd, GIOCondition condition, gpointer data) {
+    UNUSED(fd);
+    UNUSED(condition);
+    struct MonitoringData *monitoring_data = data;
+    struct MountWatch *mounts = monitoring_data->mounts;
+    struct Unmounted *unmounted;
+
+    // The callbacks may free the tree.
+    monitoring_data_ref(monitoring_data);
+
+    // One at a time, since a callback may free the other directories.
+    while((unmounted = take_remounted(mounts)) != NULL) {
+        if(strcmp(((VnrFile*) unmounted->dir->data)->path, unmounted->path) == 0) {
+            // The root of the tree, which was kept.
+            vnr_file_directory_entry_updated(unmounted->dir, NULL, VNR_FILE_MONITOR_EVENT_WATCH_LOST);
+        } else {
+            char *name = g_path_get_basename(unmounted->path);
+            vnr_file_directory_entry_updated(unmounted->dir, name, G_FILE_MONITOR_EVENT_CREATED);
+            g_free(name);
+        }
+        unmounted_free(unmounted);
+    }
+
+    gboolean keep_going = mounts->unmounted != NULL;
+    if(!keep_going) {
+        mounts->source_id = 0;
+        monitoring_data->mounts = NULL;
+        mounts_free(mounts);
+    }
+    monitoring_data_unref(monitoring_data);
+    return keep_going ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static struct MountWatch* get_mounts(struct MonitoringData *monitoring_data) {
+    if(monitoring_data->mounts != NULL) {
+        return monitoring_data->mounts;
+    }
+    // Polling it reports changes to the mount table.
+    int fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        return NULL;
+    }
+    struct MountWatch *mounts = g_new0(struct MountWatch, 1);
+    mounts->fd = fd;
+    mounts->source_id = g_unix_fd_add(fd, G_IO_PRI | G_IO_ERR, mounts_changed, monitoring_data);
+    monitoring_data->mounts = mounts;
+    return mounts;
+}
+
+/*
+ * Remembers that a file system mounted on @path@, in the directory
+ * @dir@, has been unmounted, so that @path@ is added to @dir@ again if
+ * something is mounted on it. If @dir@ is at @path@, it is read again
+ * instead.
+ */
+void mounts_watch_for_remount(GNode *dir, const char *path) {
+    struct MountWatch *mounts = get_mounts(((VnrFile*) dir->data)->monitoring_data);
+    if(mounts == NULL) {
+        return;
+    }
+    struct Unmounted *unmounted = g_new(struct Unmounted, 1);
+    unmounted->dir = dir;
+    unmounted->path = g_strdup(path);
+    mounts->unmounted = g_slist_prepend(mounts->unmounted, unmounted);
+}
+
+void mounts_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    GSList *it;
+
+    if(vnrfile == NULL || vnrfile->monitoring_data == NULL || vnrfile->monitoring_data->mounts == NULL) {
+        return;
+    }
+    struct MountWatch *mounts = vnrfile->monitoring_data->mounts;
+    it = mounts->unmounted;
+    while(it != NULL) {
+        GSList *next = it->next;
+        struct Unmounted *unmounted = it->data;
+        if(unmounted->dir == node) {
+            unmounted_free(unmounted);
+            mounts->unmounted = g_slist_delete_link(mounts->unmounted, it);
+        }
+        it = next;
+    }
+}
+
+void mounts_free(struct MountWatch *mounts) {
+    if(mounts == NULL) {
+        return;
+    }
+    if(mounts->source_id != 0) {
+        g_source_remove(mounts->source_id);
+    }
+    close(mounts->fd);
+    g_slist_free_full(mounts->unmounted, (GDestroyNotify) unmounted_free);
+    g_free(mounts);
+}
+
+#else
+
+void mounts_watch_for_remount(GNode *dir, const char *path) {
+    UNUSED(dir);
+    UNUSED(path);
+}
+
+void mounts_forget(GNode *node) {
+    UNUSED(node);
+}
+
+void mounts_free(struct MountWatch *mounts) {
+    UNUSED(mounts);
+}
+
+#endif
@@ -0,0 +1,377 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Packed directories. The files of a directory that has no
+ * subdirectories are stored as one array of fixed size records, sorted
+ * like the children they replace, and one block holding their strings.
+ * A GNode and a VnrFile are only created for a file when a caller
+ * needs a handle to it. Such a node is linked into the children of the
+ * directory, in the order of the array, but the children are only the
+ * files that have nodes; siblings are found through the index in the
+ * array instead.
+ */
+
+struct PackedFile {
+    guint32 name;
+    guint32 display_name;
+    guint32 collate_key;
+};
+
+struct PackedDirectory {
+    guint number_of_files;
+    struct PackedFile *files;
+    gchar *strings;
+    gsize strings_size;
+    // Created on demand; NULL until the first file is needed.
+    GNode **nodes;
+};
+
+
+
+static struct PackedDirectory* get_packed(GNode *dir) {
+    VnrFile *vnrfile = dir == NULL ? NULL : dir->data;
+    return vnrfile == NULL ? NULL : vnrfile->packed;
+}
+
+static GNode* create_node(GNode *dir, struct PackedDirectory *packed, guint index) {
+    struct PackedFile *file = &packed->files[index];
+    char *path = g_strjoin(G_DIR_SEPARATOR_S,
+                           ((VnrFile*) dir->data)->path,
+                           packed->strings + file->name,
+                           NULL);
+
+    VnrFile *vnrfile = vnr_file_create_with_collate_key(path,
+                                                        packed->strings + file->display_name,
+                                                        packed->strings + file->collate_key,
+                                                        FALSE);
+    g_free(path);
+    return g_node_new(vnrfile);
+}
+
+static GNode* materialize(GNode *dir, struct PackedDirectory *packed, guint index) {
+    if(packed->nodes == NULL) {
+        packed->nodes = g_new0(GNode*, packed->number_of_files);
+    }
+
+    if(packed->nodes[index] == NULL) {
+        GNode *previous = NULL;
+        guint i;
+
+        // Linked after the closest node before it, so that the children
+        // stay in the order of the array.
+        for(i = index; previous == NULL && i > 0; i--) {
+            previous = packed->nodes[i - 1];
+        }
+        packed->nodes[index] = create_node(dir, packed, index);
+        g_node_insert_after(dir, previous, packed->nodes[index]);
+        // Only created for a caller, which may hold on to it, so it is
+        // kept if the directory is packed again.
+        ((VnrFile*) packed->nodes[index]->data)->last_visited = g_get_monotonic_time();
+    }
+    return packed->nodes[index];
+}
+
+static void free_packed_directory(struct PackedDirectory *packed) {
+    g_free(packed->files);
+    g_free(packed->strings);
+    g_free(packed->nodes);
+    g_free(packed);
+}
+
+/* Returns the length of @path@ up to the file name, if it is in @dir@. */
+static gsize get_name_offset(GNode *dir, const char *path) {
+    const char *dir_path = ((VnrFile*) dir->data)->path;
+    gsize len = strlen(dir_path);
+
+    if(strncmp(path, dir_path, len) != 0 || path[len] != G_DIR_SEPARATOR ||
+       strchr(path + len + 1, G_DIR_SEPARATOR) != NULL) {
+        return 0;
+    }
+    return len + 1;
+}
+
+static gboolean can_be_packed(GNode *dir, guint minimum_number_of_files) {
+    VnrFile *vnrfile = dir->data;
+    GNode *child = g_node_first_child(dir);
+
+    if(vnrfile == NULL || !vnrfile->is_directory || vnrfile->packed != NULL ||
+       spill_is_stub(dir) || g_node_n_children(dir) < MAX(minimum_number_of_files, 1)) {
+        return FALSE;
+    }
+    while(child != NULL) {
+        VnrFile *child_file = child->data;
+        if(child_file->is_directory || child_file->monitor != NULL ||
+           get_name_offset(dir, child_file->path) == 0) {
+            return FALSE;
+        }
+        child = g_node_next_sibling(child);
+    }
+    return TRUE;
+}
+
+static void pack_directory(GNode *dir) {
+    struct PackedDirectory *packed = g_new0(struct PackedDirectory, 1);
+    gsize name_offset = strlen(((VnrFile*) dir->data)->path) + 1;
+    gsize offset = 0;
+    guint i = 0;
+    GNode *child;
+
+    packed->number_of_files = g_node_n_children(dir);
+    packed->files = g_new(struct PackedFile, packed->number_of_files);
+
+    for(child = g_node_first_child(dir); child != NULL; child = g_node_next_sibling(child)) {
+        VnrFile *vnrfile = child->data;
+        packed->strings_size += strlen(vnrfile->path + name_offset) + 1 +
+                                strlen(vnrfile->display_name) + 1 +
+                                strlen(vnrfile->display_name_collate) + 1;
+    }
+    packed->strings = g_malloc(packed->strings_size);
+
+    child = g_node_first_child(dir);
+    while(child != NULL) {
+        GNode *next = g_node_next_sibling(child);
+        VnrFile *vnrfile = child->data;
+        struct PackedFile *file = &packed->files[i];
+
+        file->name = offset;
+        offset = g_stpcpy(packed->strings + offset, vnrfile->path + name_offset) - packed->strings + 1;
+        file->display_name = offset;
+        offset = g_stpcpy(packed->strings + offset, vnrfile->display_name) - packed->strings + 1;
+        file->collate_key = offset;
+        offset = g_stpcpy(packed->strings + offset, vnrfile->display_name_collate) - packed->strings + 1;
+
+        if(vnrfile->last_visited != 0 || subscribers_within(((VnrFile*) dir->data)->monitoring_data, child)) {
+            // The caller may hold on to nodes it has been handed, so
+            // they stay linked.
+            if(packed->nodes == NULL) {
+                packed->nodes = g_new0(GNode*, packed->number_of_files);
+            }
+            packed->nodes[i] = child;
+        } else {
+            free_current_tree(child);
+        }
+        child = next;
+        i++;
+    }
+
+    ((VnrFile*) dir->data)->packed = packed;
+}
+
+
+
+guint packed_get_number_of_files(GNode *dir) {
+    struct PackedDirectory *packed = get_packed(dir);
+    return packed == NULL ? 0 : packed->number_of_files;
+}
+
+GNode* packed_get_child(GNode *dir, guint index) {
+    struct PackedDirectory *packed = get_packed(dir);
+    if(packed == NULL || index >= packed->number_of_files) {
+        return NULL;
+    }
+    return materialize(dir, packed, index);
+}
+
+/* Returns the index of @node@ in its packed directory, or -1. */
+gint packed_get_index(GNode *node) {
+    struct PackedDirectory *packed = node == NULL ? NULL : get_packed(node->parent);
+    if(packed == NULL || packed->nodes == NULL || node->data == NULL) {
+        return -1;
+    }
+    const char *collate_key = ((VnrFile*) node->data)->display_name_collate;
+
+    // The records are sorted by collate key; find the first one that is
+    // equal and look through the ones that are equal.
+    guint low = 0;
+    guint high = packed->number_of_files;
+    while(low < high) {
+        guint middle = low + (high - low) / 2;
+        if(g_strcmp0(packed->strings + packed->files[middle].collate_key, collate_key) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    while(low < packed->number_of_files &&
+          g_strcmp0(packed->strings + packed->files[low].collate_key, collate_key) == 0) {
+        if(packed->nodes[low] == node) {
+            return low;
+        }
+        low++;
+    }
+    return -1;
+}
+
+GNode* packed_find_path(GNode *dir, const char *path) {
+    struct PackedDirectory *packed = get_packed(dir);
+    gsize name_offset;
+    guint i;
+
+    if(packed == NULL || (name_offset = get_name_offset(dir, path)) == 0) {
+        return NULL;
+    }
+    for(i = 0; i < packed->number_of_files; i++) {
+        if(strcmp(packed->strings + packed->files[i].name, path + name_offset) == 0) {
+            return materialize(dir, packed, i);
+        }
+    }
+    return NULL;
+}
+
+/* Gives the record of file @index@ in @dir@; @path@ must be freed. */
+void packed_get_file(GNode *dir, guint index, char **path, const char **display_name, const char **collate_key) {
+    struct PackedDirectory *packed = get_packed(dir);
+    struct PackedFile *file = &packed->files[index];
+
+    *path = g_strjoin(G_DIR_SEPARATOR_S, ((VnrFile*) dir->data)->path, packed->strings + file->name, NULL);
+    *display_name = packed->strings + file->display_name;
+    *collate_key = packed->strings + file->collate_key;
+}
+
+/* Turns @dir@ back into an ordinary directory, keeping created nodes. */
+void packed_unpack(GNode *dir) {
+    struct PackedDirectory *packed = get_packed(dir);
+    GNode *last = NULL;
+    guint i;
+
+    if(packed == NULL) {
+        return;
+    }
+    for(i = 0; i < packed->number_of_files; i++) {
+        if(packed->nodes != NULL && packed->nodes[i] != NULL) {
+            // Linked already, and nothing unlinked is before it.
+            last = packed->nodes[i];
+        } else {
+            GNode *node = create_node(dir, packed, i);
+            g_node_insert_after(dir, last, node);
+            last = node;
+        }
+    }
+    ((VnrFile*) dir->data)->packed = NULL;
+    free_packed_directory(packed);
+}
+
+/*
+ * Called when @node@ is destroyed. Created nodes of a packed directory
+ * are its children, so they are destroyed before it.
+ */
+void packed_forget(GNode *node) {
+    gint index = packed_get_index(node);
+    if(index >= 0) {
+        get_packed(node->parent)->nodes[index] = NULL;
+    }
+
+    struct PackedDirectory *packed = get_packed(node);
+    if(packed == NULL) {
+        return;
+    }
+    ((VnrFile*) node->data)->packed = NULL;
+    free_packed_directory(packed);
+}
+
+void packed_add_memory_usage(GNode *dir, struct MemoryUsage *usage) {
+    struct PackedDirectory *packed = get_packed(dir);
+
+    if(packed == NULL) {
+        return;
+    }
+    usage->files += sizeof(struct PackedDirectory) + packed->number_of_files * sizeof(struct PackedFile);
+    usage->paths += packed->strings_size;
+
+    // The created nodes are children, and are counted as such.
+    if(packed->nodes != NULL) {
+        usage->indexes += packed->number_of_files * sizeof(GNode*);
+    }
+}
+
+
+
+static gboolean collect_directories(GNode *node, gpointer data) {
+    GSList **directories = data;
+    *directories = g_slist_prepend(*directories, node);
+    return FALSE;
+}
+
+static gboolean collect_packed_directories(GNode *node, gpointer data) {
+    if(get_packed(node) != NULL) {
+        collect_directories(node, data);
+    }
+    return FALSE;
+}
+
+/**
+ * Goes through the tree that @tree@ is part of, and stores the files of
+ * every directory that has at least @minimum_number_of_files@ files and
+ * no subdirectories in a packed array instead of as separate nodes.
+ * Nodes for the files are created again when they are needed; nodes
+ * that have been returned by navigation or get_child_in_directory stay
+ * valid. A directory is turned back into ordinary nodes when a file is
+ * added to or removed from it.
+ * Returns the number of directories that were packed.
+ */
+guint pack_file_only_directories(GNode *tree, guint minimum_number_of_files) {
+    GSList *directories = NULL;
+    GSList *it;
+    guint packed = 0;
+    GNode *root = get_root_node(tree);
+
+    if(root == NULL) {
+        return 0;
+    }
+    g_node_traverse(root, G_PRE_ORDER, G_TRAVERSE_NON_LEAVES, -1, collect_directories, &directories);
+
+    for(it = directories; it != NULL; it = it->next) {
+        if(can_be_packed(it->data, minimum_number_of_files)) {
+            pack_directory(it->data);
+            packed++;
+        }
+    }
+    g_slist_free(directories);
+    return packed;
+}
+
+/**
+ * Turns every packed directory in the tree that @tree@ is part of back
+ * into ordinary nodes.
+ */
+void unpack_directories(GNode *tree) {
+    GSList *directories = NULL;
+    GSList *it;
+    GNode *root = get_root_node(tree);
+
+    if(root == NULL) {
+        return;
+    }
+    g_node_traverse(root, G_PRE_ORDER, G_TRAVERSE_ALL, -1, collect_packed_directories, &directories);
+
+    for(it = directories; it != NULL; it = it->next) {
+        packed_unpack(it->data);
+    }
+    g_slist_free(directories);
+}
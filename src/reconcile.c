@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Recovery from lost events. When the event queue of a backend
+ * overflows, the changes that were in it are gone, and the tree no
+ * longer matches the file system. The monitored directories are then
+ * walked, and only the ones that have been modified since the tree was
+ * last known to be up to date are read again.
+ */
+
+
+static gint64 now_ns() {
+    return g_get_real_time() * 1000;
+}
+
+static guint reconcile_node(GNode *node, gint64 changed_after) {
+    VnrFile *vnrfile = node->data;
+    gboolean modified = FALSE;
+    guint changes = 0;
+
+    if(vnrfile != NULL) {
+        gint64 mtime = vnr_file_get_mtime(vnrfile->path);
+        if(mtime == -1) {
+            // Entries of a directory are taken care of when the
+            // directory is read again; entries of a uri-list are not.
+            if(node->parent != NULL && node->parent->data == NULL) {
+                vnr_file_directory_entry_updated(node, NULL, G_FILE_MONITOR_EVENT_DELETED);
+                changes++;
+            }
+            return changes;
+        }
+        if(!vnrfile->is_directory) {
+            return changes;
+        }
+        modified = mtime >= changed_after;
+        if(!modified && spill_is_stub(node)) {
+            // The spilled subdirectories are compared with the mtimes
+            // they were spilled with when they are brought back.
+            return changes;
+        }
+    }
+
+    // The callbacks may free the node and its children.
+    node_guard(&node);
+    if(modified) {
+        changes += vnr_file_directory_rescan(node);
+    }
+
+    GNode *child = node == NULL ? NULL : g_node_first_child(node);
+    while(child != NULL) {
+        GNode *next = g_node_next_sibling(child);
+        node_guard(&next);
+        // Files have no entries of their own, except in a uri-list.
+        if(vnrfile == NULL || vnr_file_is_directory(child->data)) {
+            changes += reconcile_node(child, changed_after);
+        }
+        node_unguard(&next);
+        child = node == NULL ? NULL : next;
+    }
+    node_unguard(&node);
+    return changes;
+}
+
+static guint reconcile(GNode *root, struct MonitoringData *monitoring_data) {
+    gint64 changed_after = monitoring_data->in_sync_since - MTIME_SLACK_NS;
+
+    // Changes from now on are either still in the queue, or seen by
+    // the walk below.
+    monitoring_data->in_sync_since = now_ns();
+    return reconcile_node(root, changed_after);
+}
+
+static gboolean reconcile_source(gpointer data) {
+    struct MonitoringData *monitoring_data = data;
+    GNode *root = monitoring_data->reconcile_root;
+
+    // The callbacks may free the tree.
+    monitoring_data_ref(monitoring_data);
+    monitoring_data->reconcile_source_id = 0;
+    monitoring_data->reconcile_root = NULL;
+    reconcile(root, monitoring_data);
+    monitoring_data_unref(monitoring_data);
+    return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * Called by a backend that has read everything in its event queue
+ * without it having overflowed. Nothing that happened before @since@,
+ * in nanoseconds since the epoch, has been lost.
+ */
+void reconcile_note_in_sync(struct MonitoringData *monitoring_data, gint64 since) {
+    // Until a pending pass has run, the tree is not known to be in sync.
+    if(monitoring_data->reconcile_source_id == 0) {
+        monitoring_data->in_sync_since = since;
+    }
+}
+
+/*
+ * Called by a backend whose event queue has overflowed. @node@ is any
+ * node of the tree. The tree is reconciled when the main loop is idle,
+ * so that the events that are still queued are read first.
+ */
+void reconcile_overflow(GNode *node) {
+    struct MonitoringData *monitoring_data = ((VnrFile*) node->data)->monitoring_data;
+
+    if(monitoring_data->reconcile_source_id != 0) {
+        return;
+    }
+    g_warning("Event queue overflow; reading modified directories again");
+    stats_overflow(monitoring_data);
+    monitoring_data->reconcile_root = get_root_node(node);
+    monitoring_data->reconcile_source_id = g_idle_add(reconcile_source, monitoring_data);
+}
+
+/*
+ * Removes a pending pass. Called when the monitoring data is freed.
+ */
+void reconcile_cancel(struct MonitoringData *monitoring_data) {
+    if(monitoring_data->reconcile_source_id != 0) {
+        g_source_remove(monitoring_data->reconcile_source_id);
+        monitoring_data->reconcile_source_id = 0;
+    }
+    monitoring_data->reconcile_root = NULL;
+}
+
+
+/**
+ * Brings the tree that @tree@ is part of up to date with the file
+ * system, for when changes may have gone unreported. This happens on
+ * its own when the event queue of the inotify or fanotify backend
+ * overflows; GIO does not tell.
+ * Only directories that have been modified since the tree was last
+ * known to be up to date are read again. Each difference is reported
+ * like any other change.
+ * Returns the number of changes.
+ */
+guint reconcile_tree(GNode *tree) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        return 0;
+    }
+
+    // The callbacks may free the tree.
+    monitoring_data_ref(monitoring_data);
+    reconcile_cancel(monitoring_data);
+    guint changes = reconcile(get_root_node(tree), monitoring_data);
+    monitoring_data_unref(monitoring_data);
+    return changes;
+}
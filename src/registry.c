@@ -0,0 +1,351 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+#define UNUSED(x) (void)(x)
+
+/*
+ * What trees over the same directories have in common. Directories
+ * with the same path share one GIO monitor, whose events are passed on
+ * to every node that watches it, as long as the trees run in the same
+ * main context. What a directory contains is read once and kept for a
+ * short while, so that trees created together do not read it again,
+ * and threads that want a directory that is being read wait for it
+ * instead of reading it too. A timer drops the listings that have
+ * expired. Everything here is shared by the whole process.
+ */
+
+// How long a listing may be used after the directory was read.
+#define LISTING_TTL_USEC (2 * G_USEC_PER_SEC)
+#define LISTING_PURGE_INTERVAL_SEC 2
+
+#define SHARED_MONITOR_KEY "c-trees-shared-monitor"
+
+struct SharedMonitor {
+    gint ref_count;
+    char *key;
+    char *path;
+    GFileMonitor *monitor;
+    // The nodes watching it, all in the same main context.
+    GPtrArray *nodes;
+};
+
+static GMutex registry_lock;
+static GHashTable *shared_monitors = NULL;
+// Path -> struct Listing, for the directories being read or read a
+// moment ago.
+static GHashTable *listings = NULL;
+static GCond listing_done;
+static guint purge_source_id = 0;
+
+
+static char* monitor_key(const char *path) {
+    GMainContext *context = g_main_context_ref_thread_default();
+    char *key = g_strdup_printf("%p:%s", (gpointer) context, path);
+    g_main_context_unref(context);
+    return key;
+}
+
+static void shared_monitor_unref(struct SharedMonitor *shared) {
+    if(--shared->ref_count > 0) {
+        return;
+    }
+    g_file_monitor_cancel(shared->monitor);
+    g_object_unref(shared->monitor);
+    g_ptr_array_free(shared->nodes, TRUE);
+    g_free(shared->path);
+    g_free(shared->key);
+    g_free(shared);
+}
+
+static void dispatch(GFileMonitor      *monitor,
+                     GFile             *file,
+                     GFile             *other_file,
+                     GFileMonitorEvent  type,
+                     gpointer           data) {
+    struct SharedMonitor *shared = data;
+    guint i;
+
+    listing_invalidate(shared->path);
+
+    // A callback may stop any of the nodes from watching, or free them.
+    shared->ref_count++;
+    GPtrArray *nodes = g_ptr_array_new();
+    for(i = 0; i < shared->nodes->len; i++) {
+        g_ptr_array_add(nodes, g_ptr_array_index(shared->nodes, i));
+    }
+    for(i = 0; i < nodes->len; i++) {
+        GNode *node = g_ptr_array_index(nodes, i);
+        if(g_ptr_array_find(shared->nodes, node, NULL)) {
+            vnr_file_directory_updated(monitor, file, other_file, type, node);
+        }
+    }
+    g_ptr_array_free(nodes, TRUE);
+    shared_monitor_unref(shared);
+}
+
+/*
+ * Returns a GIO monitor for the file or directory @node@, whose events
+ * are passed to vnr_file_directory_updated with @node@. It is shared
+ * with other nodes of the same path, and is given back by
+ * registry_forget. Returns NULL if it cannot be monitored.
+ */
+GFileMonitor* registry_acquire_monitor(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    char *key = monitor_key(vnrfile->path);
+    struct SharedMonitor *shared;
+
+    g_mutex_lock(&registry_lock);
+    if(shared_monitors == NULL) {
+        shared_monitors = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+    shared = g_hash_table_lookup(shared_monitors, key);
+    g_mutex_unlock(&registry_lock);
+
+    if(shared != NULL) {
+        g_free(key);
+        g_ptr_array_add(shared->nodes, node);
+        return shared->monitor;
+    }
+
+    GFile *file = g_file_new_for_path(vnrfile->path);
+    // It's not fatal if directory monitoring isn't supported,
+    // so set error to NULL.
+    GFileMonitor *monitor = g_file_monitor(file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+    g_object_unref(file);
+    if(monitor == NULL) {
+        g_free(key);
+        return NULL;
+    }
+
+    shared = g_new(struct SharedMonitor, 1);
+    shared->ref_count = 1;
+    shared->key = key;
+    shared->path = g_strdup(vnrfile->path);
+    shared->monitor = monitor;
+    shared->nodes = g_ptr_array_new();
+    g_ptr_array_add(shared->nodes, node);
+    g_object_set_data(G_OBJECT(monitor), SHARED_MONITOR_KEY, shared);
+    g_signal_connect(monitor, "changed", G_CALLBACK(dispatch), shared);
+
+    g_mutex_lock(&registry_lock);
+    g_hash_table_insert(shared_monitors, shared->key, shared);
+    g_mutex_unlock(&registry_lock);
+    return monitor;
+}
+
+static void release_monitor(GNode *node, GFileMonitor *monitor) {
+    struct SharedMonitor *shared = g_object_get_data(G_OBJECT(monitor), SHARED_MONITOR_KEY);
+
+    g_ptr_array_remove_fast(shared->nodes, node);
+    if(shared->nodes->len > 0) {
+        return;
+    }
+    g_mutex_lock(&registry_lock);
+    g_hash_table_remove(shared_monitors, shared->key);
+    g_mutex_unlock(&registry_lock);
+    // Stopped at once, even if its events are still being passed on.
+    g_signal_handlers_disconnect_by_func(monitor, G_CALLBACK(dispatch), shared);
+    shared_monitor_unref(shared);
+}
+
+/*
+ * Stops @node@ from watching its GIO monitor. The monitor is cancelled
+ * when no node watches it any more.
+ */
+void registry_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    if(vnrfile != NULL && vnrfile->monitor != NULL) {
+        release_monitor(node, vnrfile->monitor);
+        vnrfile->monitor = NULL;
+    }
+}
+
+
+static void listed_entry_clear(gpointer data) {
+    struct ListedEntry *entry = data;
+    g_free(entry->name);
+    g_free(entry->display_name);
+    g_free(entry->display_name_collate);
+}
+
+static struct Listing* listing_new(const char *path) {
+    struct Listing *listing = g_new0(struct Listing, 1);
+    listing->ref_count = 1;
+    listing->path = g_strdup(path);
+    listing->entries = g_array_new(FALSE, FALSE, sizeof(struct ListedEntry));
+    g_array_set_clear_func(listing->entries, listed_entry_clear);
+    return listing;
+}
+
+static void listing_unref_locked(struct Listing *listing) {
+    if(--listing->ref_count > 0) {
+        return;
+    }
+    g_array_free(listing->entries, TRUE);
+    g_clear_error(&listing->error);
+    g_free(listing->path);
+    g_free(listing);
+}
+
+void listing_unref(struct Listing *listing) {
+    g_mutex_lock(&registry_lock);
+    listing_unref_locked(listing);
+    g_mutex_unlock(&registry_lock);
+}
+
+static void read_listing(struct Listing *listing) {
+    const char *name;
+    GDir *dir;
+
+    // Taken first, so that a change while reading makes it stale.
+    listing->mtime = vnr_file_get_mtime(listing->path);
+    listing->read_at = g_get_real_time() * 1000;
+
+    dir = g_dir_open(listing->path, 0, NULL);
+    if(dir == NULL) {
+        return;
+    }
+    while((name = g_dir_read_name(dir)) != NULL) {
+        struct ListedEntry entry;
+        char *path = g_build_filename(listing->path, name, NULL);
+        GError *error = NULL;
+
+        if(vnr_file_list_entry(path, &entry, &error)) {
+            g_array_append_val(listing->entries, entry);
+        } else if(listing->error == NULL) {
+            listing->error = error;
+        } else {
+            g_clear_error(&error);
+        }
+        g_free(path);
+    }
+    g_dir_close(dir);
+}
+
+static gboolean is_fresh(struct Listing *listing) {
+    // A change in the same tick as the reading would not show in the
+    // modification time, so recently modified directories are read
+    // again regardless.
+    return g_get_monotonic_time() < listing->expires &&
+           listing->mtime != -1 &&
+           listing->mtime < listing->read_at - MTIME_SLACK_NS &&
+           vnr_file_get_mtime(listing->path) == listing->mtime;
+}
+
+static gboolean is_expired(gpointer key, gpointer value, gpointer data) {
+    UNUSED(key);
+    struct Listing *listing = value;
+    if(listing->done && *((gint64*) data) >= listing->expires) {
+        listing_unref_locked(listing);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static gboolean purge_listings(gpointer data) {
+    UNUSED(data);
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&registry_lock);
+    g_hash_table_foreach_remove(listings, is_expired, &now);
+    // Started again by the next listing that is kept.
+    gboolean done = g_hash_table_size(listings) == 0;
+    if(done) {
+        purge_source_id = 0;
+    }
+    g_mutex_unlock(&registry_lock);
+    return done ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+}
+
+/*
+ * Returns what the directory @path@ contains. A listing that another
+ * tree got a moment ago is used if the directory has not been modified
+ * since; if another thread is reading the directory, this waits for it
+ * to finish. May be called from any thread. Must be given back with
+ * listing_unref.
+ */
+struct Listing* listing_get(const char *path) {
+    struct Listing *listing;
+
+    g_mutex_lock(&registry_lock);
+    if(listings == NULL) {
+        listings = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+
+    listing = g_hash_table_lookup(listings, path);
+    if(listing != NULL && !listing->done) {
+        // Held, since it may be invalidated while waiting.
+        listing->ref_count++;
+        while(!listing->done) {
+            g_cond_wait(&listing_done, &registry_lock);
+        }
+        g_mutex_unlock(&registry_lock);
+        return listing;
+    }
+    if(listing != NULL) {
+        if(is_fresh(listing)) {
+            listing->ref_count++;
+            g_mutex_unlock(&registry_lock);
+            return listing;
+        }
+        g_hash_table_remove(listings, path);
+        listing_unref_locked(listing);
+    }
+
+    listing = listing_new(path);
+    // One reference for the table, one for the caller.
+    listing->ref_count++;
+    g_hash_table_insert(listings, listing->path, listing);
+    g_mutex_unlock(&registry_lock);
+
+    read_listing(listing);
+
+    g_mutex_lock(&registry_lock);
+    listing->done = TRUE;
+    listing->expires = g_get_monotonic_time() + LISTING_TTL_USEC;
+    // Kept unless invalidated while it was read.
+    if(g_hash_table_lookup(listings, path) == listing && purge_source_id == 0) {
+        purge_source_id = g_timeout_add_seconds(LISTING_PURGE_INTERVAL_SEC, purge_listings, NULL);
+    }
+    g_cond_broadcast(&listing_done);
+    g_mutex_unlock(&registry_lock);
+    return listing;
+}
+
+/*
+ * Makes sure that the next listing_get of @path@ reads the directory,
+ * rather than waiting for a reading that may have started before a
+ * change.
+ */
+void listing_invalidate(const char *path) {
+    g_mutex_lock(&registry_lock);
+    struct Listing *listing = listings == NULL ? NULL : g_hash_table_lookup(listings, path);
+    // The thread reading it keeps a reference of its own.
+    if(listing != NULL) {
+        g_hash_table_remove(listings, path);
+        listing_unref_locked(listing);
+    }
+    g_mutex_unlock(&registry_lock);
+}
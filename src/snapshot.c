@@ -0,0 +1,381 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Snapshots. What a tree holds can be written to a file, and a tree
+ * that is created later for the same directory with the same settings
+ * starts from that file instead of reading every directory. Every
+ * directory in the file carries its modification time from when the
+ * file was written. The monitors are then created the way deferred
+ * monitors are, and the directories whose modification times differ
+ * are read again, with a call to the callback for each difference.
+ *
+ * The file is a header followed by the records of the tree in
+ * depth-first order. The strings of a record follow it directly.
+ */
+
+#define SNAPSHOT_MAGIC "CTRSNAP"
+#define SNAPSHOT_VERSION 1
+
+// The modification time of a directory that must be read again.
+#define STALE_MTIME ((gint64) -1)
+
+struct SnapshotHeader {
+    char magic[8];
+    guint32 version;
+    guint8 include_hidden;
+    guint8 include_dirs;
+    // When the snapshot was written, in nanoseconds since the epoch.
+    gint64 saved_at;
+    guint32 path_len;
+};
+
+struct SnapshotRecord {
+    guint8 is_directory;
+    guint32 number_of_children;
+    gint64 mtime;
+    guint32 name_len;
+    guint32 display_name_len;
+    guint32 collate_key_len;
+};
+
+struct SnapshotReader {
+    const guint8 *data;
+    const guint8 *end;
+    gint64 saved_at;
+    struct MonitoringData *monitoring_data;
+};
+
+static char *snapshot_directory = NULL;
+
+
+static char* get_snapshot_path(const char *path, gboolean include_hidden, gboolean include_dirs) {
+    char *key = g_strdup_printf("%s\n%d\n%d", path, include_hidden ? 1 : 0, include_dirs ? 1 : 0);
+    char *name = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+    char *file_name = g_strconcat(name, ".snapshot", NULL);
+    char *snapshot_path = g_build_filename(snapshot_directory, file_name, NULL);
+
+    g_free(file_name);
+    g_free(name);
+    g_free(key);
+    return snapshot_path;
+}
+
+
+
+static void write_record(GByteArray *buffer, gboolean is_directory, guint number_of_children, gint64 mtime,
+                         const char *name, const char *display_name, const char *collate_key) {
+    struct SnapshotRecord record;
+    memset(&record, 0, sizeof(record));
+
+    record.is_directory = is_directory;
+    record.number_of_children = number_of_children;
+    record.mtime = mtime;
+    record.name_len = strlen(name);
+    record.display_name_len = strlen(display_name);
+    record.collate_key_len = strlen(collate_key);
+
+    g_byte_array_append(buffer, (guint8*) &record, sizeof(record));
+    g_byte_array_append(buffer, (guint8*) name, record.name_len);
+    g_byte_array_append(buffer, (guint8*) display_name, record.display_name_len);
+    g_byte_array_append(buffer, (guint8*) collate_key, record.collate_key_len);
+}
+
+/*
+ * Writes @node@ and, unless it has been moved out of memory, everything
+ * below it. Directories in @busy@ have changes that are not in the tree
+ * yet, so they are written to be read again.
+ */
+static void write_node(GByteArray *buffer, GNode *node, GHashTable *busy) {
+    VnrFile *vnrfile = node->data;
+    char *name = g_path_get_basename(vnrfile->path);
+
+    if(!vnrfile->is_directory) {
+        write_record(buffer, FALSE, 0, 0, name, vnrfile->display_name, vnrfile->display_name_collate);
+
+    } else if(spill_is_stub(node)) {
+        write_record(buffer, TRUE, 0, STALE_MTIME, name, vnrfile->display_name, vnrfile->display_name_collate);
+
+    } else {
+        gboolean stale = g_hash_table_contains(busy, node) || deferred_is_pending(node);
+        gint64 mtime = stale ? STALE_MTIME : vnr_file_get_mtime(vnrfile->path);
+        guint packed_files = packed_get_number_of_files(node);
+        guint i;
+
+        write_record(buffer, TRUE, packed_files > 0 ? packed_files : g_node_n_children(node), mtime,
+                     name, vnrfile->display_name, vnrfile->display_name_collate);
+        for(i = 0; i < packed_files; i++) {
+            char *path, *file_name;
+            const char *display_name, *collate_key;
+
+            packed_get_file(node, i, &path, &display_name, &collate_key);
+            file_name = g_path_get_basename(path);
+            write_record(buffer, FALSE, 0, 0, file_name, display_name, collate_key);
+            g_free(file_name);
+            g_free(path);
+        }
+        // Nodes handed out for packed files are linked into the
+        // directory as well, but were written with the packed files.
+        if(packed_files > 0) {
+            g_free(name);
+            return;
+        }
+        for(GNode *child = g_node_first_child(node); child != NULL; child = g_node_next_sibling(child)) {
+            write_node(buffer, child, busy);
+        }
+    }
+    g_free(name);
+}
+
+static gboolean save_directory(GNode *dir, struct MonitoringData *monitoring_data, GError **error) {
+    VnrFile *vnrfile = dir->data;
+    struct SnapshotHeader header;
+    GByteArray *buffer = g_byte_array_new();
+    GHashTable *busy = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.include_hidden = monitoring_data->include_hidden ? 1 : 0;
+    header.include_dirs = monitoring_data->include_dirs ? 1 : 0;
+    header.saved_at = g_get_real_time() * 1000;
+    header.path_len = strlen(vnrfile->path);
+    g_byte_array_append(buffer, (guint8*) &header, sizeof(header));
+    g_byte_array_append(buffer, (guint8*) vnrfile->path, header.path_len);
+
+    events_add_busy_directories(monitoring_data, busy);
+    worker_add_busy_directories(monitoring_data, busy);
+    burst_add_busy_directories(monitoring_data, busy);
+    write_node(buffer, dir, busy);
+
+    char *snapshot_path = get_snapshot_path(vnrfile->path, monitoring_data->include_hidden,
+                                            monitoring_data->include_dirs);
+    gboolean saved = FALSE;
+    if(g_mkdir_with_parents(snapshot_directory, 0700) != 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Could not create %s", snapshot_directory);
+    } else {
+        // Written to a temporary file and renamed, so a reader never
+        // sees half of it.
+        saved = g_file_set_contents(snapshot_path, (const gchar*) buffer->data, buffer->len, error);
+    }
+
+    g_free(snapshot_path);
+    g_hash_table_destroy(busy);
+    g_byte_array_free(buffer, TRUE);
+    return saved;
+}
+
+
+
+static gboolean read_bytes(struct SnapshotReader *reader, void *dest, gsize length) {
+    if((gsize) (reader->end - reader->data) < length) {
+        return FALSE;
+    }
+    memcpy(dest, reader->data, length);
+    reader->data += length;
+    return TRUE;
+}
+
+static char* read_string(struct SnapshotReader *reader, guint32 length) {
+    if((gsize) (reader->end - reader->data) < length) {
+        return NULL;
+    }
+    char *str = g_strndup((const char*) reader->data, length);
+    reader->data += length;
+    return str;
+}
+
+/*
+ * Reads @number_of_children@ records, with everything below them, into
+ * the directory @tree@. Returns FALSE if the snapshot is damaged.
+ */
+static gboolean read_children(struct SnapshotReader *reader, GNode *tree, const char *path,
+                              guint32 number_of_children) {
+    guint32 i;
+
+    for(i = 0; i < number_of_children; i++) {
+        struct SnapshotRecord record;
+        char *name = NULL, *display_name = NULL, *collate_key = NULL;
+        gboolean ok = read_bytes(reader, &record, sizeof(record)) &&
+                      (name = read_string(reader, record.name_len)) != NULL &&
+                      (display_name = read_string(reader, record.display_name_len)) != NULL &&
+                      (collate_key = read_string(reader, record.collate_key_len)) != NULL;
+
+        if(ok) {
+            char *child_path = g_build_filename(path, name, NULL);
+            VnrFile *vnrfile = vnr_file_create_with_collate_key(child_path, display_name, collate_key,
+                                                                record.is_directory);
+            GNode *node = g_node_append_data(tree, vnrfile);
+
+            if(record.is_directory) {
+                ok = read_children(reader, node, child_path, record.number_of_children);
+                // After the directories below it, so that the monitors
+                // are created from the top.
+                deferred_watch_since(node, reader->monitoring_data, record.mtime, reader->saved_at);
+            }
+            g_free(child_path);
+        }
+        g_free(name);
+        g_free(display_name);
+        g_free(collate_key);
+        if(!ok) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static GNode* read_snapshot(struct SnapshotReader *reader, VnrFile *vnrfile) {
+    struct SnapshotHeader header;
+    struct SnapshotRecord record;
+    struct MonitoringData *monitoring_data = reader->monitoring_data;
+
+    if(!read_bytes(reader, &header, sizeof(header)) ||
+       memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+       header.version != SNAPSHOT_VERSION ||
+       header.include_hidden != (monitoring_data->include_hidden ? 1 : 0) ||
+       header.include_dirs != (monitoring_data->include_dirs ? 1 : 0) ||
+       header.path_len != strlen(vnrfile->path) ||
+       (gsize) (reader->end - reader->data) < header.path_len ||
+       memcmp(reader->data, vnrfile->path, header.path_len) != 0) {
+        return NULL;
+    }
+    reader->data += header.path_len;
+    reader->saved_at = header.saved_at;
+
+    if(!read_bytes(reader, &record, sizeof(record)) || !record.is_directory ||
+       (gsize) (reader->end - reader->data) < (gsize) record.name_len + record.display_name_len + record.collate_key_len) {
+        return NULL;
+    }
+    // The root is the one that was just looked up.
+    reader->data += record.name_len + record.display_name_len + record.collate_key_len;
+
+    if(monitoring_data->deferred_watches == NULL) {
+        monitoring_data->deferred_watches = deferred_watches_new();
+    }
+    GNode *tree = g_node_new(NULL);
+    if(!read_children(reader, tree, vnrfile->path, record.number_of_children) || reader->data != reader->end) {
+        free_current_tree(tree);
+        return NULL;
+    }
+    tree->data = vnrfile;
+    deferred_watch_since(tree, monitoring_data, record.mtime, reader->saved_at);
+    return tree;
+}
+
+
+/*
+ * Returns the tree of the directory @vnrfile@ from its snapshot, if
+ * there is one for the settings in @monitoring_data@, with @vnrfile@ as
+ * the root. Only for a tree that is being created, since its monitors
+ * are deferred until deferred_watches_start, and the directories that
+ * have changed since the snapshot are read again once they are created.
+ * Returns NULL, leaving @vnrfile@ alone, if there is no usable
+ * snapshot.
+ */
+GNode* snapshot_load(VnrFile *vnrfile, struct MonitoringData *monitoring_data) {
+    struct SnapshotReader reader;
+    struct stat st;
+    GNode *tree = NULL;
+
+    if(snapshot_directory == NULL) {
+        return NULL;
+    }
+    char *snapshot_path = get_snapshot_path(vnrfile->path, monitoring_data->include_hidden,
+                                            monitoring_data->include_dirs);
+    int fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+    g_free(snapshot_path);
+
+    if(fd < 0) {
+        return NULL;
+    }
+    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED) {
+            reader.data = map;
+            reader.end = reader.data + st.st_size;
+            reader.monitoring_data = monitoring_data;
+            tree = read_snapshot(&reader, vnrfile);
+            munmap(map, st.st_size);
+        }
+    }
+    close(fd);
+    return tree;
+}
+
+
+/**
+ * Makes trees that are created after the call start from a snapshot in
+ * @directory@, written by save_snapshot, instead of reading all their
+ * directories. Only snapshots of the same directory with the same
+ * settings are used. The monitors are then created from the main loop,
+ * as with set_deferred_monitors, and the directories that have changed
+ * since the snapshot was written are read again, with a call to the
+ * callback for each difference. A @directory@ of NULL turns snapshots
+ * off.
+ */
+void set_snapshot_directory(const char *directory) {
+    g_free(snapshot_directory);
+    snapshot_directory = g_strdup(directory);
+}
+
+/**
+ * Writes a snapshot of the tree that @tree@ is part of to the directory
+ * given to set_snapshot_directory, replacing any earlier snapshot of
+ * it. For a tree created from a uri-list, every directory in the list
+ * gets a snapshot of its own. Directories with changes that have been
+ * picked up but not yet applied are read again when the snapshot is
+ * used.
+ * Returns FALSE, with @error@ set, if a snapshot could not be written,
+ * and also if no snapshot directory has been set or nothing in the tree
+ * is monitored.
+ */
+gboolean save_snapshot(GNode *tree, GError **error) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    GNode *root = get_root_node(tree);
+
+    if(snapshot_directory == NULL || monitoring_data == NULL) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                            "No snapshot directory has been set, or the tree contains no directories");
+        return FALSE;
+    }
+    if(root->data != NULL) {
+        return save_directory(root, monitoring_data, error);
+    }
+    for(GNode *child = g_node_first_child(root); child != NULL; child = g_node_next_sibling(child)) {
+        if(vnr_file_is_directory(child->data) && !save_directory(child, monitoring_data, error)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
@@ -0,0 +1,659 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Out-of-core mode. Directories that have not been visited for a while
+ * have their children serialized to a memory mapped backing file, after
+ * which the children are freed. The directory node itself stays in the
+ * tree as a stub that knows where its children are stored, how many
+ * there were and how many files they contained. The children are read
+ * back when something needs to enter the stub.
+ */
+
+typedef enum {SPILLED_FILE, SPILLED_DIRECTORY, SPILLED_STUB} SpillKind;
+
+// How many of the nodes last handed out by navigation and lookups are
+// kept from being spilled, together with the directories above them.
+#define PINNED_NODES 16
+
+struct SpillStore {
+    GNode *root;
+    int fd;
+    gsize file_size;
+    gsize live_bytes;
+    guint8 *map;
+    gsize map_size;
+    gint64 idle_usec;
+    guint timeout_id;
+    GHashTable *stubs;
+    // The nodes last handed out, most recent first.
+    GQueue *pinned;
+};
+
+struct SpillStub {
+    gsize offset;
+    gsize length;
+    guint number_of_children;
+    gint number_of_leaves;
+    gint64 mtime;
+    // Set when the directory was without a monitor for a while, so
+    // changes on disk may have been missed.
+    gboolean check_mtime;
+};
+
+struct SpillRecord {
+    guint8  kind;
+    // A file that had a monitor of its own.
+    guint8  monitored;
+    guint32 number_of_children;
+    gint32  number_of_leaves;
+    gint64  mtime;
+    guint64 offset;
+    guint64 length;
+    guint32 path_len;
+    guint32 display_name_len;
+    guint32 collate_key_len;
+};
+
+
+
+static struct SpillStore* get_store(GNode *node) {
+    VnrFile *vnrfile = node == NULL ? NULL : node->data;
+    if(vnrfile == NULL || vnrfile->monitoring_data == NULL) {
+        return NULL;
+    }
+    return vnrfile->monitoring_data->spill_store;
+}
+
+/*
+ * Like get_store, but also for files, which have no monitoring data of
+ * their own and are looked up through their directory.
+ */
+static struct SpillStore* find_store(GNode *node) {
+    struct SpillStore *store = get_store(node);
+    if(store == NULL && node != NULL && node->data != NULL && node->parent != NULL) {
+        store = get_store(node->parent);
+    }
+    return store;
+}
+
+static struct SpillStub* get_stub(GNode *node) {
+    struct SpillStore *store = get_store(node);
+    return store == NULL ? NULL : g_hash_table_lookup(store->stubs, node);
+}
+
+static void release_bytes(struct SpillStore *store, gsize length) {
+    store->live_bytes -= length;
+
+    if(store->live_bytes == 0 && store->file_size > 0) {
+        // Nothing is spilled any more; start over with an empty file.
+        if(store->map != NULL) {
+            munmap(store->map, store->map_size);
+            store->map = NULL;
+            store->map_size = 0;
+        }
+        if(ftruncate(store->fd, 0) == 0) {
+            store->file_size = 0;
+        }
+    }
+}
+
+
+
+static gboolean map_backing_file(struct SpillStore *store) {
+    if(store->map != NULL && store->map_size >= store->file_size) {
+        return TRUE;
+    }
+    if(store->map != NULL) {
+        munmap(store->map, store->map_size);
+    }
+    store->map = mmap(NULL, store->file_size, PROT_READ, MAP_SHARED, store->fd, 0);
+    if(store->map == MAP_FAILED) {
+        store->map = NULL;
+        store->map_size = 0;
+        return FALSE;
+    }
+    store->map_size = store->file_size;
+    return TRUE;
+}
+
+
+
+static void write_record(GByteArray *buffer, SpillKind kind, VnrFile *vnrfile,
+                         guint number_of_children, struct SpillStub *stub) {
+    struct SpillRecord record;
+    memset(&record, 0, sizeof(record));
+
+    record.kind = kind;
+    record.monitored = kind == SPILLED_FILE && vnrfile->monitoring_data != NULL;
+    record.number_of_children = number_of_children;
+    record.path_len = strlen(vnrfile->path);
+    record.display_name_len = strlen(vnrfile->display_name);
+    record.collate_key_len = strlen(vnrfile->display_name_collate);
+
+    if(kind == SPILLED_DIRECTORY) {
+        record.mtime = vnr_file_get_mtime(vnrfile->path);
+    } else if(kind == SPILLED_STUB) {
+        record.mtime = stub->mtime;
+        record.offset = stub->offset;
+        record.length = stub->length;
+        record.number_of_children = stub->number_of_children;
+        record.number_of_leaves = stub->number_of_leaves;
+    }
+
+    g_byte_array_append(buffer, (guint8*) &record, sizeof(record));
+    g_byte_array_append(buffer, (guint8*) vnrfile->path, record.path_len);
+    g_byte_array_append(buffer, (guint8*) vnrfile->display_name, record.display_name_len);
+    g_byte_array_append(buffer, (guint8*) vnrfile->display_name_collate, record.collate_key_len);
+}
+
+static void write_packed_record(GByteArray *buffer, GNode *dir, guint index) {
+    struct SpillRecord record;
+    char *path;
+    const char *display_name, *collate_key;
+
+    packed_get_file(dir, index, &path, &display_name, &collate_key);
+    memset(&record, 0, sizeof(record));
+    record.kind = SPILLED_FILE;
+    record.path_len = strlen(path);
+    record.display_name_len = strlen(display_name);
+    record.collate_key_len = strlen(collate_key);
+
+    g_byte_array_append(buffer, (guint8*) &record, sizeof(record));
+    g_byte_array_append(buffer, (guint8*) path, record.path_len);
+    g_byte_array_append(buffer, (guint8*) display_name, record.display_name_len);
+    g_byte_array_append(buffer, (guint8*) collate_key, record.collate_key_len);
+    g_free(path);
+}
+
+static gint serialize_children(struct SpillStore *store, GNode *tree, GByteArray *buffer) {
+    gint leaves = 0;
+    GNode *child = g_node_first_child(tree);
+
+    while(child != NULL) {
+        VnrFile *vnrfile = child->data;
+        struct SpillStub *stub = g_hash_table_lookup(store->stubs, child);
+
+        if(stub != NULL) {
+            write_record(buffer, SPILLED_STUB, vnrfile, 0, stub);
+            leaves += stub->number_of_leaves;
+        } else if(packed_get_number_of_files(child) > 0) {
+            // Read back as an ordinary directory.
+            guint packed_files = packed_get_number_of_files(child);
+            guint i;
+            write_record(buffer, SPILLED_DIRECTORY, vnrfile, packed_files, NULL);
+            for(i = 0; i < packed_files; i++) {
+                write_packed_record(buffer, child, i);
+            }
+            leaves += packed_files;
+        } else if(vnrfile->is_directory) {
+            write_record(buffer, SPILLED_DIRECTORY, vnrfile, g_node_n_children(child), NULL);
+            leaves += serialize_children(store, child, buffer);
+        } else {
+            write_record(buffer, SPILLED_FILE, vnrfile, 0, NULL);
+            leaves++;
+        }
+        child = g_node_next_sibling(child);
+    }
+    return leaves;
+}
+
+static gboolean append_to_backing_file(struct SpillStore *store, GByteArray *buffer, gsize *offset) {
+    gsize written = 0;
+
+    while(written < buffer->len) {
+        ssize_t n = pwrite(store->fd, buffer->data + written, buffer->len - written, store->file_size + written);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        } else if(n < 0) {
+            return FALSE;
+        }
+        written += n;
+    }
+    *offset = store->file_size;
+    store->file_size += buffer->len;
+    return TRUE;
+}
+
+static gboolean steal_stub(GNode *node, gpointer data) {
+    struct SpillStore *store = data;
+    // The stub is now referenced from the spilled data of its parent,
+    // so its bytes in the backing file are still in use.
+    g_hash_table_remove(store->stubs, node);
+    return FALSE;
+}
+
+static gboolean spill_subtree(struct SpillStore *store, GNode *tree) {
+    VnrFile *vnrfile = tree->data;
+    GByteArray *buffer = g_byte_array_new();
+    gsize offset;
+
+    gint leaves = serialize_children(store, tree, buffer);
+    gboolean written = append_to_backing_file(store, buffer, &offset);
+
+    if(written) {
+        struct SpillStub *stub = g_new(struct SpillStub, 1);
+        stub->offset = offset;
+        stub->length = buffer->len;
+        stub->number_of_children = g_node_n_children(tree);
+        stub->number_of_leaves = leaves;
+        stub->mtime = vnr_file_get_mtime(vnrfile->path);
+        stub->check_mtime = FALSE;
+
+        while(tree->children != NULL) {
+            GNode *child = tree->children;
+            g_node_traverse(child, G_PRE_ORDER, G_TRAVERSE_ALL, -1, steal_stub, store);
+            free_current_tree(child);
+        }
+        g_hash_table_insert(store->stubs, tree, stub);
+        store->live_bytes += buffer->len;
+    }
+
+    g_byte_array_free(buffer, TRUE);
+    return written;
+}
+
+
+
+static const guint8* read_record(const guint8 *data, struct SpillRecord *record,
+                                 char **path, char **display_name, char **collate_key) {
+    memcpy(record, data, sizeof(*record));
+    data += sizeof(*record);
+
+    *path = g_strndup((const char*) data, record->path_len);
+    data += record->path_len;
+    *display_name = g_strndup((const char*) data, record->display_name_len);
+    data += record->display_name_len;
+    *collate_key = g_strndup((const char*) data, record->collate_key_len);
+    data += record->collate_key_len;
+    return data;
+}
+
+static void release_stub(struct SpillStore *store, gsize offset, gsize length, guint32 number_of_children);
+
+/*
+ * Steps past @number_of_records@ records and the records of the
+ * directories among them. The stubs among them are not coming back, so
+ * their bytes are released.
+ */
+static const guint8* skip_records(struct SpillStore *store, const guint8 *data, guint32 number_of_records) {
+    struct SpillRecord record;
+    guint32 i;
+
+    for(i = 0; i < number_of_records; i++) {
+        memcpy(&record, data, sizeof(record));
+        data += sizeof(record) + record.path_len + record.display_name_len + record.collate_key_len;
+
+        if(record.kind == SPILLED_DIRECTORY) {
+            data = skip_records(store, data, record.number_of_children);
+        } else if(record.kind == SPILLED_STUB) {
+            release_stub(store, record.offset, record.length, record.number_of_children);
+        }
+    }
+    return data;
+}
+
+/*
+ * Releases the bytes of a stub whose children will not be read back,
+ * and those of the stubs that were spilled within it.
+ */
+static void release_stub(struct SpillStore *store, gsize offset, gsize length, guint32 number_of_children) {
+    // The stub itself is still live, so the file is not truncated while
+    // it is walked.
+    if(map_backing_file(store)) {
+        skip_records(store, store->map + offset, number_of_children);
+    }
+    release_bytes(store, length);
+}
+
+static void rescan_into(GNode *tree, struct MonitoringData *monitoring_data) {
+    VnrFile *vnrfile = tree->data;
+    VnrFile *copy = vnr_file_create_with_collate_key(vnrfile->path,
+                                                     vnrfile->display_name,
+                                                     vnrfile->display_name_collate,
+                                                     TRUE);
+    GNode *scanned = vnr_file_dir_content_to_list(copy, monitoring_data, NULL);
+
+    while(scanned->children != NULL) {
+        GNode *child = scanned->children;
+        g_node_unlink(child);
+        g_node_append(tree, child);
+    }
+    free_current_tree(scanned);
+}
+
+static const guint8* restore_children(struct SpillStore *store,
+                                      GNode *tree,
+                                      const guint8 *data,
+                                      guint32 number_of_children,
+                                      struct MonitoringData *monitoring_data) {
+    guint32 i;
+
+    for(i = 0; i < number_of_children; i++) {
+        struct SpillRecord record;
+        char *path, *display_name, *collate_key;
+        data = read_record(data, &record, &path, &display_name, &collate_key);
+
+        // Taken from the directory, which may have moved since.
+        char *name = g_path_get_basename(path);
+        g_free(path);
+        path = g_build_filename(((VnrFile*) tree->data)->path, name, NULL);
+        g_free(name);
+
+        gint64 mtime = record.kind == SPILLED_FILE ? 0 : vnr_file_get_mtime(path);
+
+        if(mtime == -1) {
+            // The directory is gone from disk.
+            if(record.kind == SPILLED_DIRECTORY) {
+                data = skip_records(store, data, record.number_of_children);
+            } else if(record.kind == SPILLED_STUB) {
+                release_stub(store, record.offset, record.length, record.number_of_children);
+            }
+
+        } else {
+            VnrFile *vnrfile = vnr_file_create_with_collate_key(path, display_name, collate_key,
+                                                                record.kind != SPILLED_FILE);
+            GNode *node = g_node_new(vnrfile);
+
+            if(record.kind == SPILLED_DIRECTORY && record.mtime != mtime) {
+                // It had no monitor while spilled, so read it from disk.
+                data = skip_records(store, data, record.number_of_children);
+                rescan_into(node, monitoring_data);
+
+            } else if(record.kind == SPILLED_DIRECTORY) {
+                data = restore_children(store, node, data, record.number_of_children, monitoring_data);
+
+            } else if(record.kind == SPILLED_STUB) {
+                struct SpillStub *stub = g_new(struct SpillStub, 1);
+                stub->offset = record.offset;
+                stub->length = record.length;
+                stub->number_of_children = record.number_of_children;
+                stub->number_of_leaves = record.number_of_leaves;
+                stub->mtime = record.mtime;
+                stub->check_mtime = TRUE;
+                g_hash_table_insert(store->stubs, node, stub);
+            }
+
+            if(record.kind != SPILLED_FILE || record.monitored) {
+                vnr_file_set_file_monitor(node, monitoring_data);
+            }
+            g_node_append(tree, node);
+        }
+
+        g_free(path);
+        g_free(display_name);
+        g_free(collate_key);
+    }
+    return data;
+}
+
+
+
+
+gboolean spill_is_stub(GNode *node) {
+    return get_stub(node) != NULL;
+}
+
+/* Whether @path@ can be the path of something in the spilled subtree. */
+gboolean spill_may_contain(GNode *stub, const char *path) {
+    const char *stub_path = ((VnrFile*) stub->data)->path;
+    size_t len = strlen(stub_path);
+    return strncmp(path, stub_path, len) == 0 && path[len] == G_DIR_SEPARATOR;
+}
+
+guint spill_get_number_of_children(GNode *node) {
+    struct SpillStub *stub = get_stub(node);
+    return stub == NULL ? 0 : stub->number_of_children;
+}
+
+gint spill_get_number_of_leaves(GNode *stub) {
+    struct SpillStub *spill_stub = get_stub(stub);
+    return spill_stub == NULL ? 0 : spill_stub->number_of_leaves;
+}
+
+/* Brings back the children of @node@ if it is a stub. */
+void spill_fault_in(GNode *node) {
+    struct SpillStore *store = get_store(node);
+    struct SpillStub *stub = store == NULL ? NULL : g_hash_table_lookup(store->stubs, node);
+    if(stub == NULL) {
+        return;
+    }
+    g_hash_table_steal(store->stubs, node);
+
+    VnrFile *vnrfile = node->data;
+    struct MonitoringData *monitoring_data = vnrfile->monitoring_data;
+
+    if((stub->check_mtime && stub->mtime != vnr_file_get_mtime(vnrfile->path)) || !map_backing_file(store)) {
+        rescan_into(node, monitoring_data);
+        release_stub(store, stub->offset, stub->length, stub->number_of_children);
+    } else {
+        restore_children(store, node, store->map + stub->offset, stub->number_of_children, monitoring_data);
+        release_bytes(store, stub->length);
+    }
+    g_free(stub);
+}
+
+/*
+ * Marks @node@ and the directories above it as recently visited, and
+ * pins @node@, which has been handed out, so that it is not freed by
+ * spilling while it is likely to be held on to.
+ */
+void spill_touch(GNode *node) {
+    gint64 now = g_get_monotonic_time();
+    struct SpillStore *store = find_store(node);
+
+    if(store != NULL) {
+        g_queue_remove(store->pinned, node);
+        g_queue_push_head(store->pinned, node);
+        if(g_queue_get_length(store->pinned) > PINNED_NODES) {
+            g_queue_pop_tail(store->pinned);
+        }
+    }
+    while(node != NULL) {
+        VnrFile *vnrfile = node->data;
+        if(vnrfile != NULL) {
+            vnrfile->last_visited = now;
+        }
+        node = node->parent;
+    }
+}
+
+/* Called when @node@ is destroyed. */
+void spill_forget(GNode *node) {
+    struct SpillStore *store = find_store(node);
+    if(store == NULL) {
+        return;
+    }
+    struct SpillStub *stub = g_hash_table_lookup(store->stubs, node);
+
+    g_queue_remove(store->pinned, node);
+    if(stub != NULL) {
+        g_hash_table_steal(store->stubs, node);
+        release_stub(store, stub->offset, stub->length, stub->number_of_children);
+        g_free(stub);
+    }
+}
+
+void spill_add_memory_usage(GNode *node, struct MemoryUsage *usage) {
+    if(spill_is_stub(node)) {
+        // The stub and its entry in the hash table (key, value, hash).
+        usage->indexes += sizeof(struct SpillStub) + HASH_TABLE_ENTRY_SIZE;
+    }
+}
+
+void spill_store_free(struct SpillStore *store) {
+    if(store == NULL) {
+        return;
+    }
+    if(store->timeout_id != 0) {
+        g_source_remove(store->timeout_id);
+    }
+    if(store->map != NULL) {
+        munmap(store->map, store->map_size);
+    }
+    close(store->fd);
+    g_hash_table_destroy(store->stubs);
+    g_queue_free(store->pinned);
+    g_free(store);
+}
+
+
+
+static guint spill_cold_children(struct SpillStore *store, GNode *tree, gint64 now, GHashTable *pinned) {
+    guint spilled = 0;
+    GNode *child = g_node_first_child(tree);
+
+    while(child != NULL) {
+        VnrFile *vnrfile = child->data;
+
+        if(vnrfile != NULL && vnrfile->is_directory && child->children != NULL) {
+            // Subscribers and those that were handed a node hold on to it.
+            if(now - vnrfile->last_visited > store->idle_usec &&
+               !g_hash_table_contains(pinned, child) &&
+               !subscribers_within(vnrfile->monitoring_data, child)) {
+                spilled += spill_subtree(store, child) ? 1 : 0;
+            } else {
+                spilled += spill_cold_children(store, child, now, pinned);
+            }
+        }
+        child = g_node_next_sibling(child);
+    }
+    return spilled;
+}
+
+static guint spill_cold(struct SpillStore *store) {
+    GHashTable *pinned = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    // A directory with a pinned node anywhere below it stays.
+    for(GList *it = store->pinned->head; it != NULL; it = it->next) {
+        for(GNode *node = it->data; node != NULL; node = node->parent) {
+            g_hash_table_add(pinned, node);
+        }
+    }
+    guint spilled = spill_cold_children(store, store->root, g_get_monotonic_time(), pinned);
+    g_hash_table_destroy(pinned);
+    return spilled;
+}
+
+static gboolean spill_timeout(gpointer data) {
+    spill_cold(data);
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Spills the directories of the tree that @tree@ is part of that have
+ * not been visited within the time given to enable_out_of_core_mode.
+ * Returns the number of directories that were spilled.
+ */
+guint spill_cold_subtrees(GNode *tree) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL || monitoring_data->spill_store == NULL) {
+        return 0;
+    }
+    return spill_cold(monitoring_data->spill_store);
+}
+
+/**
+ * Enables out-of-core mode for the tree that @tree@ is part of. Every
+ * @idle_seconds@ seconds, the directories that have not been visited
+ * for @idle_seconds@ will have their children written to a memory
+ * mapped backing file and freed. The directory stays in the tree, and
+ * its children are read back as soon as navigation or
+ * get_child_in_directory enters it. Positions and totals of files are
+ * reported as before, without reading anything back.
+ *
+ * Nodes below a spilled directory are freed, so pointers to them must
+ * not be kept. The nodes last returned by navigation and
+ * get_child_in_directory, and those of subscribers, are never freed
+ * this way. Changes on disk in subdirectories of a spilled directory
+ * are picked up when it is read back, without calls to the callback.
+ *
+ * Returns FALSE and sets @error@ if the backing file could not be
+ * created.
+ */
+gboolean enable_out_of_core_mode(GNode *tree, guint idle_seconds, GError **error) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                            "The tree contains no directories");
+        return FALSE;
+    }
+    idle_seconds = MAX(idle_seconds, 1);
+
+    struct SpillStore *store = monitoring_data->spill_store;
+    if(store != NULL) {
+        g_source_remove(store->timeout_id);
+    } else {
+        char *backing_file_path = NULL;
+        int fd = g_file_open_tmp("c-trees-spill-XXXXXX", &backing_file_path, error);
+        if(fd == -1) {
+            return FALSE;
+        }
+        // Only the descriptor is needed; the file goes away with it.
+        unlink(backing_file_path);
+        g_free(backing_file_path);
+
+        store = g_new0(struct SpillStore, 1);
+        store->root = get_root_node(tree);
+        store->fd = fd;
+        store->stubs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+        store->pinned = g_queue_new();
+        monitoring_data->spill_store = store;
+    }
+    store->idle_usec = (gint64) idle_seconds * G_USEC_PER_SEC;
+    store->timeout_id = g_timeout_add_seconds(idle_seconds, spill_timeout, store);
+    return TRUE;
+}
+
+/**
+ * Reads back everything that has been spilled in the tree that @tree@
+ * is part of and disables out-of-core mode for it.
+ */
+void disable_out_of_core_mode(GNode *tree) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL || monitoring_data->spill_store == NULL) {
+        return;
+    }
+    struct SpillStore *store = monitoring_data->spill_store;
+
+    // Reading back a stub can bring back stubs that were inside it.
+    while(g_hash_table_size(store->stubs) > 0) {
+        GList *stubs = g_hash_table_get_keys(store->stubs);
+        GList *it;
+        for(it = stubs; it != NULL; it = it->next) {
+            spill_fault_in(it->data);
+        }
+        g_list_free(stubs);
+    }
+
+    monitoring_data->spill_store = NULL;
+    spill_store_free(store);
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Monitoring statistics. Events are timestamped when they are
+ * received, and the time until they are applied, the time spent
+ * applying them up to the callback, and the time in the callback are
+ * recorded in histograms, along with the time from receipt until the
+ * callback has returned.
+ *
+ * The histograms are log-linear: values below 8 microseconds have a
+ * bucket each, and every power of two above that is split in 8 equal
+ * buckets, so a bucket is never more than 12.5% wide.
+ */
+
+#define SUB_BUCKET_BITS 3
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+
+struct MonitorStats {
+    struct MonitorStatistics statistics;
+    // Nesting of events being applied; only the outermost is recorded.
+    guint depth;
+    gint64 received;
+    // When the current event started being applied, or its previous
+    // change was reported.
+    gint64 processing_since;
+};
+
+
+static guint bucket_index(guint64 usec) {
+    if(usec < SUB_BUCKETS) {
+        return (guint) usec;
+    }
+    guint exponent = g_bit_storage(usec) - 1;
+    guint sub_bucket = (guint) (usec >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    guint index = (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+    return MIN(index, LATENCY_HISTOGRAM_BUCKETS - 1);
+}
+
+static guint64 bucket_upper_bound(guint index) {
+    if(index < SUB_BUCKETS) {
+        return index;
+    }
+    guint shift = index / SUB_BUCKETS - 1;
+    guint64 lower = (guint64) (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return lower + ((guint64) 1 << shift) - 1;
+}
+
+static void record(struct LatencyHistogram *histogram, gint64 usec) {
+    guint64 value = usec < 0 ? 0 : (guint64) usec;
+    histogram->count++;
+    histogram->sum_usec += value;
+    histogram->max_usec = MAX(histogram->max_usec, value);
+    histogram->buckets[bucket_index(value)]++;
+}
+
+static struct MonitorStats* get_stats(struct MonitoringData *monitoring_data) {
+    return monitoring_data == NULL ? NULL : monitoring_data->stats;
+}
+
+
+/*
+ * Returns the time at which an event is received, or 0 if the tree
+ * keeps no statistics.
+ */
+gint64 stats_event_received(struct MonitoringData *monitoring_data) {
+    struct MonitorStats *stats = get_stats(monitoring_data);
+    if(stats == NULL) {
+        return 0;
+    }
+    stats->statistics.events_received++;
+    return g_get_monotonic_time();
+}
+
+/*
+ * Records that an event was merged with one that is held back, or
+ * cancelled out by it.
+ */
+void stats_event_merged(struct MonitoringData *monitoring_data) {
+    struct MonitorStats *stats = get_stats(monitoring_data);
+    if(stats != NULL) {
+        stats->statistics.events_merged++;
+    }
+}
+
+/*
+ * Records that the event queue of a backend overflowed.
+ */
+void stats_overflow(struct MonitoringData *monitoring_data) {
+    struct MonitorStats *stats = get_stats(monitoring_data);
+    if(stats != NULL) {
+        stats->statistics.overflows++;
+    }
+}
+
+static void begin(struct MonitoringData *monitoring_data, gint64 received, gboolean resumed) {
+    struct MonitorStats *stats = get_stats(monitoring_data);
+    if(stats == NULL || stats->depth++ > 0 || received == 0) {
+        return;
+    }
+    gint64 now = g_get_monotonic_time();
+    if(!resumed) {
+        stats->statistics.events_applied++;
+        record(&stats->statistics.queueing, now - received);
+    }
+    stats->received = received;
+    stats->processing_since = now;
+}
+
+/*
+ * Called when an event received at @received@ starts being applied.
+ * Must be followed by stats_apply_end.
+ */
+void stats_apply_begin(struct MonitoringData *monitoring_data, gint64 received) {
+    begin(monitoring_data, received, FALSE);
+}
+
+/*
+ * Like stats_apply_begin, for the rest of an event whose application
+ * was handed to the monitor thread. It has been counted already.
+ */
+void stats_apply_resume(struct MonitoringData *monitoring_data, gint64 received) {
+    begin(monitoring_data, received, TRUE);
+}
+
+void stats_apply_end(struct MonitoringData *monitoring_data) {
+    struct MonitorStats *stats = get_stats(monitoring_data);
+    if(stats != NULL && stats->depth > 0 && --stats->depth == 0) {
+        stats->received = 0;
+    }
+}
+
+/*
+ * Returns the time at which the event that is being applied was
+ * received, or 0 if none is.
+ */
+gint64 stats_current_received(struct MonitoringData *monitoring_data) {
+    struct MonitorStats *stats = get_stats(monitoring_data);
+    return stats == NULL ? 0 : stats->received;
+}
+
+/*
+ * Called right before the callback is called for a change. Returns
+ * the time, to be passed to stats_callback_end.
+ */
+gint64 stats_callback_begin(struct MonitoringData *monitoring_data) {
+    struct MonitorStats *stats = get_stats(monitoring_data);
+    if(stats == NULL) {
+        return 0;
+    }
+    gint64 now = g_get_monotonic_time();
+    if(stats->received != 0) {
+        record(&stats->statistics.processing, now - stats->processing_since);
+    }
+    return now;
+}
+
+/*
+ * Called right after the callback has returned for a change.
+ */
+void stats_callback_end(struct MonitoringData *monitoring_data, gint64 started) {
+    struct MonitorStats *stats = get_stats(monitoring_data);
+    if(stats == NULL || started == 0) {
+        return;
+    }
+    gint64 now = g_get_monotonic_time();
+    stats->statistics.changes_reported++;
+    record(&stats->statistics.callback, now - started);
+    if(stats->received != 0) {
+        record(&stats->statistics.total, now - stats->received);
+        stats->processing_since = now;
+    }
+}
+
+void stats_free(struct MonitorStats *stats) {
+    g_free(stats);
+}
+
+
+/**
+ * Returns the smallest value, in microseconds, that at least
+ * @percentile@ percent of the values in @histogram@ are at or below,
+ * rounded up to the end of its bucket. Returns 0 for an empty
+ * histogram.
+ */
+guint64 latency_histogram_get_percentile(const struct LatencyHistogram *histogram, gdouble percentile) {
+    guint64 wanted, seen = 0;
+    guint i;
+
+    if(histogram->count == 0) {
+        return 0;
+    }
+    percentile = CLAMP(percentile, 0.0, 100.0);
+    wanted = MAX((guint64) (percentile / 100.0 * histogram->count + 0.5), 1);
+
+    for(i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if(seen >= wanted) {
+            return MIN(bucket_upper_bound(i), histogram->max_usec);
+        }
+    }
+    return histogram->max_usec;
+}
+
+/**
+ * Makes the tree that @tree@ is part of keep statistics on how file
+ * system changes are handled, or stop keeping them if @enabled@ is
+ * FALSE. Enabling them again starts over from zero.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_monitor_statistics(GNode *tree, gboolean enabled) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        return FALSE;
+    }
+    stats_free(monitoring_data->stats);
+    monitoring_data->stats = enabled ? g_new0(struct MonitorStats, 1) : NULL;
+    return TRUE;
+}
+
+/**
+ * Places the statistics of the tree that @tree@ is part of in
+ * @statistics@. Returns FALSE, leaving @statistics@ untouched, if the
+ * tree keeps none.
+ */
+gboolean get_monitor_statistics(GNode *tree, struct MonitorStatistics *statistics) {
+    struct MonitorStats *stats = get_stats(get_monitoring_data(tree));
+    if(stats == NULL) {
+        return FALSE;
+    }
+    memcpy(statistics, &stats->statistics, sizeof(*statistics));
+    return TRUE;
+}
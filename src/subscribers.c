@@ -0,0 +1,342 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+/*
+ * Subscribers. Besides the callback given when a tree is created, any
+ * number of listeners can ask to be told about the changes below one
+ * node, and only about the kinds they name. The subscriptions are
+ * indexed by the node they were made on, so a change only needs to
+ * look at the nodes from its directory up to the root.
+ */
+
+struct Subscription {
+    guint id;
+    GNode *node;
+    guint events;
+    subscriber_callback cb;
+    gpointer cb_data;
+};
+
+struct Subscribers {
+    guint next_id;
+    // Id -> Subscription.
+    GHashTable *by_id;
+    // Node -> GPtrArray of the Subscriptions made on it.
+    GHashTable *by_node;
+    // Subscriptions whose node has been destroyed. They are told about
+    // the removal that caused it, and then freed.
+    GPtrArray *ended;
+};
+
+struct Delivery {
+    guint id;
+    TreeEvent event;
+};
+
+
+static void add_delivery(GArray *deliveries, struct Subscription *subscription, TreeEvent event) {
+    if(subscription->events & event) {
+        struct Delivery delivery = { subscription->id, event };
+        g_array_append_val(deliveries, delivery);
+    }
+}
+
+/*
+ * Adds @event@ for the subscriptions on @node@ and all nodes above it
+ * that want it, innermost first.
+ */
+static void match_upwards(struct Subscribers *subscribers, GNode *node, TreeEvent event, GArray *deliveries) {
+    guint i;
+
+    for(; node != NULL; node = node->parent) {
+        GPtrArray *on_node = g_hash_table_lookup(subscribers->by_node, node);
+        for(i = 0; on_node != NULL && i < on_node->len; i++) {
+            add_delivery(deliveries, g_ptr_array_index(on_node, i), event);
+        }
+    }
+}
+
+static void add_upwards(struct Subscribers *subscribers, GNode *node, GHashTable *set) {
+    guint i;
+
+    for(; node != NULL; node = node->parent) {
+        GPtrArray *on_node = g_hash_table_lookup(subscribers->by_node, node);
+        for(i = 0; on_node != NULL && i < on_node->len; i++) {
+            g_hash_table_add(set, g_ptr_array_index(on_node, i));
+        }
+    }
+}
+
+/*
+ * Returns the subscriptions to tell about @event@ for @node@, in the
+ * directory @parent@. The nodes are looked at now, since the callback
+ * may free them. Returns NULL if nobody is subscribed.
+ */
+GArray* subscribers_match(struct MonitoringData *monitoring_data,
+                          TreeEvent event,
+                          GNode *node,
+                          GNode *parent) {
+    struct Subscribers *subscribers = monitoring_data->subscribers;
+
+    if(subscribers == NULL) {
+        return NULL;
+    }
+    GArray *deliveries = g_array_new(FALSE, FALSE, sizeof(struct Delivery));
+    // A removed node has been freed already.
+    match_upwards(subscribers, event == TREE_EVENT_REMOVED ? parent : node, event, deliveries);
+    return deliveries;
+}
+
+/*
+ * Returns the subscriptions to tell that @node@ has been moved out of
+ * the directory @old_parent@. Subscriptions that see both ends of the
+ * move are told about a move, those that only see the new end about an
+ * addition and those that only see the old end about a removal.
+ */
+GArray* subscribers_match_move(struct MonitoringData *monitoring_data, GNode *node, GNode *old_parent) {
+    struct Subscribers *subscribers = monitoring_data->subscribers;
+    GHashTableIter iter;
+    gpointer subscription;
+    guint i;
+
+    if(subscribers == NULL) {
+        return NULL;
+    }
+    GArray *deliveries = g_array_new(FALSE, FALSE, sizeof(struct Delivery));
+    GHashTable *before = g_hash_table_new(g_direct_hash, g_direct_equal);
+    add_upwards(subscribers, old_parent, before);
+    // Subscriptions on the node itself have moved along with it.
+    add_upwards(subscribers, node, before);
+
+    for(GNode *above = node; above != NULL; above = above->parent) {
+        GPtrArray *on_node = g_hash_table_lookup(subscribers->by_node, above);
+        for(i = 0; on_node != NULL && i < on_node->len; i++) {
+            subscription = g_ptr_array_index(on_node, i);
+            gboolean seen_before = g_hash_table_remove(before, subscription);
+            add_delivery(deliveries, subscription, seen_before ? TREE_EVENT_MOVED : TREE_EVENT_ADDED);
+        }
+    }
+    g_hash_table_iter_init(&iter, before);
+    while(g_hash_table_iter_next(&iter, &subscription, NULL)) {
+        add_delivery(deliveries, subscription, TREE_EVENT_REMOVED);
+    }
+    g_hash_table_destroy(before);
+    return deliveries;
+}
+
+static void call(struct Subscription *subscription, TreeEvent event, char *path, GNode *node, GNode *root) {
+    subscription->cb(event, path, node, root, subscription->cb_data);
+}
+
+/*
+ * Calls the subscriptions in @deliveries@, made by subscribers_match or
+ * subscribers_match_move, and frees it. @path@ is the path of the
+ * change, or the old path of a move. @new_path@ is the path of an
+ * addition or the new path of a move, and NULL for a removal.
+ * Subscriptions that have ended since they were matched are skipped.
+ * A removal also goes to the subscriptions that it ended.
+ */
+void subscribers_deliver(struct MonitoringData *monitoring_data,
+                         GArray *deliveries,
+                         char *path,
+                         char *new_path,
+                         GNode *node,
+                         GNode *root) {
+    guint i;
+
+    if(deliveries == NULL) {
+        return;
+    }
+    // The callbacks may free the tree.
+    monitoring_data_ref(monitoring_data);
+    struct Subscribers *subscribers = monitoring_data->subscribers;
+
+    for(i = 0; i < deliveries->len; i++) {
+        struct Delivery *delivery = &g_array_index(deliveries, struct Delivery, i);
+        // Looked up again, since a callback may remove the others.
+        struct Subscription *subscription = g_hash_table_lookup(subscribers->by_id, GUINT_TO_POINTER(delivery->id));
+        if(subscription == NULL) {
+            continue;
+        }
+        call(subscription, delivery->event, delivery->event == TREE_EVENT_ADDED ? new_path : path, node, root);
+    }
+    // One at a time, since a callback may end more of them.
+    while(new_path == NULL && subscribers->ended->len > 0) {
+        struct Subscription *subscription = g_ptr_array_remove_index(subscribers->ended, 0);
+        if(subscription->events & TREE_EVENT_REMOVED) {
+            call(subscription, TREE_EVENT_REMOVED, path, node, root);
+        }
+        g_free(subscription);
+    }
+    g_array_free(deliveries, TRUE);
+    monitoring_data_unref(monitoring_data);
+}
+
+/*
+ * Returns TRUE if a subscription has been made on @node@ or on a node
+ * below it, which must then not be freed to save memory.
+ */
+gboolean subscribers_within(struct MonitoringData *monitoring_data, GNode *node) {
+    GHashTableIter iter;
+    gpointer subscribed;
+
+    if(monitoring_data == NULL || monitoring_data->subscribers == NULL) {
+        return FALSE;
+    }
+    g_hash_table_iter_init(&iter, monitoring_data->subscribers->by_node);
+    while(g_hash_table_iter_next(&iter, &subscribed, NULL)) {
+        if(subscribed == node || g_node_is_ancestor(node, subscribed)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Ends the subscriptions made on @node@. Called when it is destroyed. */
+void subscribers_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    struct MonitoringData *monitoring_data = vnrfile == NULL ? NULL : vnrfile->monitoring_data;
+    guint i;
+
+    // Files have no monitoring data of their own, but are still in
+    // their directory while they are destroyed.
+    if(monitoring_data == NULL && vnrfile != NULL && node->parent != NULL && node->parent->data != NULL) {
+        monitoring_data = ((VnrFile*) node->parent->data)->monitoring_data;
+    }
+    if(monitoring_data == NULL || monitoring_data->subscribers == NULL) {
+        return;
+    }
+    struct Subscribers *subscribers = monitoring_data->subscribers;
+    GPtrArray *on_node = g_hash_table_lookup(subscribers->by_node, node);
+
+    if(on_node == NULL) {
+        return;
+    }
+    g_hash_table_steal(subscribers->by_node, node);
+    for(i = 0; i < on_node->len; i++) {
+        struct Subscription *subscription = g_ptr_array_index(on_node, i);
+        g_hash_table_steal(subscribers->by_id, GUINT_TO_POINTER(subscription->id));
+        subscription->node = NULL;
+        g_ptr_array_add(subscribers->ended, subscription);
+    }
+    g_ptr_array_free(on_node, TRUE);
+}
+
+void subscribers_free(struct Subscribers *subscribers) {
+    if(subscribers == NULL) {
+        return;
+    }
+    g_hash_table_destroy(subscribers->by_node);
+    g_hash_table_destroy(subscribers->by_id);
+    g_ptr_array_free(subscribers->ended, TRUE);
+    g_free(subscribers);
+}
+
+void subscribers_add_memory_usage(struct Subscribers *subscribers, struct MemoryUsage *usage) {
+    GHashTableIter iter;
+    gpointer on_node;
+
+    if(subscribers == NULL) {
+        return;
+    }
+    usage->indexes += sizeof(struct Subscribers) +
+                      g_hash_table_size(subscribers->by_id) * (HASH_TABLE_ENTRY_SIZE + sizeof(struct Subscription)) +
+                      subscribers->ended->len * sizeof(gpointer);
+    g_hash_table_iter_init(&iter, subscribers->by_node);
+    while(g_hash_table_iter_next(&iter, NULL, &on_node)) {
+        usage->indexes += HASH_TABLE_ENTRY_SIZE + sizeof(GPtrArray) + ((GPtrArray*) on_node)->len * sizeof(gpointer);
+    }
+}
+
+
+/**
+ * Calls @cb@ for the changes of the kinds in @events@, a combination
+ * of TreeEvent values, to @subtree@ and the files and directories
+ * below it. It is called in addition to the callback given when the
+ * tree was created, also when change sets are used, and right after
+ * it.
+ * The subscription ends when @subtree@ is removed from the tree; @cb@
+ * is then called for that removal if @events@ has TREE_EVENT_REMOVED.
+ * Returns an id for remove_subscriber, or 0 if nothing in the tree is
+ * monitored.
+ */
+guint add_subscriber(GNode *subtree, guint events, subscriber_callback cb, gpointer cb_data) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(subtree);
+    if(monitoring_data == NULL || cb == NULL) {
+        return 0;
+    }
+    struct Subscribers *subscribers = monitoring_data->subscribers;
+
+    if(subscribers == NULL) {
+        subscribers = g_new0(struct Subscribers, 1);
+        subscribers->next_id = 1;
+        subscribers->by_id = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+        subscribers->by_node = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                                     (GDestroyNotify) g_ptr_array_unref);
+        subscribers->ended = g_ptr_array_new_with_free_func(g_free);
+        monitoring_data->subscribers = subscribers;
+    }
+    struct Subscription *subscription = g_new(struct Subscription, 1);
+    subscription->id = subscribers->next_id++;
+    subscription->node = subtree;
+    subscription->events = events;
+    subscription->cb = cb;
+    subscription->cb_data = cb_data;
+
+    GPtrArray *on_node = g_hash_table_lookup(subscribers->by_node, subtree);
+    if(on_node == NULL) {
+        on_node = g_ptr_array_new();
+        g_hash_table_insert(subscribers->by_node, subtree, on_node);
+    }
+    g_ptr_array_add(on_node, subscription);
+    g_hash_table_insert(subscribers->by_id, GUINT_TO_POINTER(subscription->id), subscription);
+    return subscription->id;
+}
+
+/**
+ * Ends the subscription with the id @id@, made by add_subscriber on a
+ * node in the tree that @tree@ is part of. It may be called from a
+ * callback. Returns FALSE if there is no such subscription.
+ */
+gboolean remove_subscriber(GNode *tree, guint id) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL || monitoring_data->subscribers == NULL) {
+        return FALSE;
+    }
+    struct Subscribers *subscribers = monitoring_data->subscribers;
+    struct Subscription *subscription = g_hash_table_lookup(subscribers->by_id, GUINT_TO_POINTER(id));
+
+    if(subscription == NULL) {
+        return FALSE;
+    }
+    GPtrArray *on_node = g_hash_table_lookup(subscribers->by_node, subscription->node);
+    g_ptr_array_remove(on_node, subscription);
+    if(on_node->len == 0) {
+        g_hash_table_remove(subscribers->by_node, subscription->node);
+    }
+    // Frees the subscription.
+    g_hash_table_remove(subscribers->by_id, GUINT_TO_POINTER(id));
+    return TRUE;
+}
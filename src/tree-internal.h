@@ -0,0 +1,313 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TREE_INTERNAL_H__
+#define __TREE_INTERNAL_H__
+
+#include <glib.h>
+#include "callback-interface.h"
+#include "vnrfile.h"
+
+/*
+ * Functions shared between the source files of c-trees. They are not
+ * part of the public interface in tree.h.
+ */
+
+struct ListedEntry;
+
+// How far apart, in nanoseconds, a modification time from
+// vnr_file_get_mtime and the clock must be to tell them apart, on file
+// systems whose timestamps are coarser than the clock.
+#define MTIME_SLACK_NS ((gint64) 2 * 1000000000)
+
+// Roughly what an entry in a GHashTable takes: key, value and hash.
+#define HASH_TABLE_ENTRY_SIZE (2 * sizeof(gpointer) + sizeof(guint))
+
+// Not one of GIO's events. Sent by a backend whose watch on a directory
+// was dropped, so that the directory is watched and read again if it is
+// still there once the events before it have been applied.
+#define VNR_FILE_MONITOR_EVENT_WATCH_LOST ((GFileMonitorEvent) 0x100)
+
+
+/* tree.c */
+GNode* vnr_file_dir_content_to_list(VnrFile *vnrfile,
+                                    struct MonitoringData *monitoring_data,
+                                    GError **error);
+void   vnr_file_set_file_monitor   (GNode *tree,
+                                    struct MonitoringData *monitoring_data);
+void   vnr_file_directory_updated  (GFileMonitor *monitor,
+                                    GFile *file,
+                                    GFile *other_file,
+                                    GFileMonitorEvent type,
+                                    gpointer data);
+void   vnr_file_directory_entry_updated(GNode *tree,
+                                        const char *name,
+                                        GFileMonitorEvent type);
+void   vnr_file_directory_entry_moved(GNode *from_tree,
+                                      const char *from_name,
+                                      GNode *to_tree,
+                                      const char *to_name);
+void   vnr_file_apply_directory_event(GNode *tree,
+                                      GFile *file,
+                                      GFile *other_file,
+                                      GFileMonitorEvent type);
+void   vnr_file_remove_file_monitor(GNode *tree);
+gint64 vnr_file_get_mtime          (const char *path);
+guint  vnr_file_directory_rescan   (GNode *tree);
+GNode* vnr_file_prepare_node       (char *path,
+                                    struct MonitoringData *monitoring_data);
+gboolean vnr_file_list_entry       (const char *path,
+                                    struct ListedEntry *entry,
+                                    GError **error);
+void   vnr_file_splice_node        (GNode *tree,
+                                    GNode *newnode);
+void   node_guard                  (GNode **node);
+void   node_unguard                (GNode **node);
+
+
+/* spill.c */
+gboolean spill_is_stub               (GNode *node);
+gboolean spill_may_contain           (GNode *stub, const char *path);
+guint    spill_get_number_of_children(GNode *node);
+gint     spill_get_number_of_leaves  (GNode *stub);
+void     spill_fault_in              (GNode *node);
+void     spill_touch                 (GNode *node);
+void     spill_forget                (GNode *node);
+void     spill_add_memory_usage      (GNode *node, struct MemoryUsage *usage);
+void     spill_store_free            (struct SpillStore *store);
+
+
+/* packed.c */
+guint    packed_get_number_of_files(GNode *dir);
+GNode*   packed_get_child          (GNode *dir, guint index);
+gint     packed_get_index          (GNode *node);
+GNode*   packed_find_path          (GNode *dir, const char *path);
+void     packed_get_file           (GNode *dir, guint index, char **path,
+                                    const char **display_name, const char **collate_key);
+void     packed_unpack             (GNode *dir);
+void     packed_forget             (GNode *dir);
+void     packed_add_memory_usage   (GNode *dir, struct MemoryUsage *usage);
+
+
+/* compact.c */
+void     string_arena_release(VnrFile *vnrfile);
+void     string_arena_unref  (struct StringArena *arena);
+void     compact_note_change (GNode *root, struct MonitoringData *monitoring_data);
+
+
+/* inotify.c */
+gboolean inotify_watch       (GNode *node, struct MonitoringData *monitoring_data);
+void     inotify_forget      (GNode *node);
+void     inotify_watches_free(struct InotifyWatches *inotify);
+void     inotify_add_memory_usage(struct InotifyWatches *inotify, struct MemoryUsage *usage);
+
+
+/* fanotify.c */
+gboolean fanotify_watch       (GNode *node, struct MonitoringData *monitoring_data);
+void     fanotify_forget      (GNode *node);
+void     fanotify_watches_free(struct FanotifyWatches *fanotify);
+void     fanotify_add_memory_usage(struct FanotifyWatches *fanotify, struct MemoryUsage *usage);
+
+
+/* budget.c */
+void     budget_watch_added (GNode *dir, struct MonitoringData *monitoring_data);
+void     budget_watch_failed(GNode *dir, struct MonitoringData *monitoring_data);
+gboolean budget_poll_instead(GNode *dir, struct MonitoringData *monitoring_data);
+void     budget_touch       (GNode *node);
+void     budget_forget      (GNode *node);
+void     budget_free        (struct WatchBudget *budget);
+void     budget_add_memory_usage(struct WatchBudget *budget, struct MemoryUsage *usage);
+
+
+/* events.c */
+gboolean events_enqueue(GNode *dir, GFile *file, GFile *other_file, GFileMonitorEvent type, gint64 received);
+void     events_forget (GNode *node);
+void     events_add_busy_directories(struct MonitoringData *monitoring_data, GHashTable *dirs);
+void     events_free   (struct PendingEvents *pending);
+
+
+/* changeset.c */
+void     changes_notify      (struct MonitoringData *monitoring_data,
+                              gboolean deleted,
+                              char *path,
+                              GNode *node,
+                              GNode *parent,
+                              GNode *root);
+void     changes_notify_moved(struct MonitoringData *monitoring_data,
+                              char *old_path,
+                              GNode *node,
+                              GNode *old_parent,
+                              GNode *root);
+void     changes_notify_modified(struct MonitoringData *monitoring_data,
+                                 char *path,
+                                 GNode *node,
+                                 GNode *root);
+void     changes_forget      (GNode *node);
+void     changes_free        (struct ChangeSetCollector *collector);
+
+
+/* reconcile.c */
+void     reconcile_note_in_sync(struct MonitoringData *monitoring_data, gint64 since);
+void     reconcile_overflow    (GNode *node);
+void     reconcile_cancel      (struct MonitoringData *monitoring_data);
+
+
+/* worker.c */
+gboolean worker_submit(GNode *dir, char *path);
+void     worker_cancel(struct MonitoringData *monitoring_data, char *path);
+void     worker_forget(GNode *node);
+void     worker_add_busy_directories(struct MonitoringData *monitoring_data, GHashTable *dirs);
+void     worker_free  (struct MonitorWorker *worker);
+
+
+/* stats.c */
+gint64   stats_event_received  (struct MonitoringData *monitoring_data);
+void     stats_event_merged    (struct MonitoringData *monitoring_data);
+void     stats_overflow        (struct MonitoringData *monitoring_data);
+void     stats_apply_begin     (struct MonitoringData *monitoring_data, gint64 received);
+void     stats_apply_resume    (struct MonitoringData *monitoring_data, gint64 received);
+void     stats_apply_end       (struct MonitoringData *monitoring_data);
+gint64   stats_current_received(struct MonitoringData *monitoring_data);
+gint64   stats_callback_begin  (struct MonitoringData *monitoring_data);
+void     stats_callback_end    (struct MonitoringData *monitoring_data, gint64 started);
+void     stats_free            (struct MonitorStats *stats);
+
+
+/* deferred.c */
+struct DeferredWatches* deferred_watches_new(void);
+gboolean deferred_watches_accepting(struct MonitoringData *monitoring_data);
+void     deferred_watch            (GNode *node, struct MonitoringData *monitoring_data, gint64 mtime);
+void     deferred_watch_since      (GNode *node,
+                                    struct MonitoringData *monitoring_data,
+                                    gint64 mtime,
+                                    gint64 read_at);
+void     deferred_watches_start    (struct MonitoringData *monitoring_data);
+gboolean deferred_is_pending       (GNode *node);
+void     deferred_forget           (GNode *node);
+void     deferred_watches_free     (struct DeferredWatches *deferred);
+
+
+/* registry.c */
+struct ListedEntry {
+    char *name;
+    char *display_name;
+    char *display_name_collate;
+    gboolean is_directory;
+    gboolean is_hidden;
+    // An image of a supported type.
+    gboolean is_supported;
+};
+
+struct Listing {
+    gint ref_count;
+    char *path;
+    GArray *entries;
+    // The first entry that could not be looked at, if any.
+    GError *error;
+    // Of the directory before it was read, in nanoseconds.
+    gint64 mtime;
+    gint64 read_at;
+    gboolean done;
+    gint64 expires;
+};
+
+GFileMonitor*   registry_acquire_monitor(GNode *node);
+void            registry_forget         (GNode *node);
+struct Listing* listing_get             (const char *path);
+void            listing_unref           (struct Listing *listing);
+void            listing_invalidate      (const char *path);
+
+
+/* mounts.c */
+void     mounts_watch_for_remount(GNode *dir, const char *path);
+void     mounts_forget           (GNode *node);
+void     mounts_free             (struct MountWatch *mounts);
+
+
+/* burst.c */
+gboolean burst_absorb(GNode *dir, GFile *file, GFile *other_file, GFileMonitorEvent type);
+void     burst_forget(GNode *node);
+void     burst_add_busy_directories(struct MonitoringData *monitoring_data, GHashTable *dirs);
+void     burst_free  (struct BurstDetector *bursts);
+
+
+/* subscribers.c */
+GArray*  subscribers_match      (struct MonitoringData *monitoring_data,
+                                 TreeEvent event,
+                                 GNode *node,
+                                 GNode *parent);
+GArray*  subscribers_match_move (struct MonitoringData *monitoring_data, GNode *node, GNode *old_parent);
+void     subscribers_deliver    (struct MonitoringData *monitoring_data,
+                                 GArray *deliveries,
+                                 char *path,
+                                 char *new_path,
+                                 GNode *node,
+                                 GNode *root);
+gboolean subscribers_within     (struct MonitoringData *monitoring_data, GNode *node);
+void     subscribers_forget     (GNode *node);
+void     subscribers_free       (struct Subscribers *subscribers);
+void     subscribers_add_memory_usage(struct Subscribers *subscribers, struct MemoryUsage *usage);
+
+
+/* lookup.c */
+void   entry_index_add   (GNode *dir, GNode *node);
+GNode* entry_index_find  (GNode *dir, const char *path);
+void   entry_index_forget(GNode *node);
+void   entry_index_free  (struct EntryIndex *index);
+void   entry_index_add_memory_usage(struct EntryIndex *index, struct MemoryUsage *usage);
+
+
+/* snapshot.c */
+GNode* snapshot_load(VnrFile *vnrfile, struct MonitoringData *monitoring_data);
+
+
+/* classify.c */
+// What identifies the contents of a file, and so its content type.
+struct ClassificationKey {
+    guint64 device;
+    guint64 inode;
+    guint64 size;
+    // In nanoseconds since the epoch.
+    gint64 mtime;
+    guint32 name_hash;
+};
+
+// What classify_key needs from the GFileInfo of a file.
+#ifdef G_FILE_ATTRIBUTE_TIME_MODIFIED_NSEC
+#define CLASSIFY_KEY_ATTRIBUTES G_FILE_ATTRIBUTE_UNIX_DEVICE"," \
+                                G_FILE_ATTRIBUTE_UNIX_INODE"," \
+                                G_FILE_ATTRIBUTE_STANDARD_SIZE"," \
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED"," \
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC"," \
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED_NSEC
+#else
+#define CLASSIFY_KEY_ATTRIBUTES G_FILE_ATTRIBUTE_UNIX_DEVICE"," \
+                                G_FILE_ATTRIBUTE_UNIX_INODE"," \
+                                G_FILE_ATTRIBUTE_STANDARD_SIZE"," \
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED"," \
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
+#endif
+
+gboolean classify_enabled(void);
+gboolean classify_key    (GFileInfo *fileinfo, const char *path, struct ClassificationKey *key);
+gboolean classify_lookup (const struct ClassificationKey *key, gboolean *is_supported);
+void     classify_store  (const struct ClassificationKey *key, gboolean is_supported);
+
+#endif /* __TREE_INTERNAL_H__ */
@@ -20,10 +20,13 @@
 
 #include <glib/gi18n.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include <gtk/gtk.h>
 
 #include "tree.h"
+#include "tree-internal.h"
 
 #define UNUSED(x) (void)(x)
 
@@ -31,42 +34,48 @@ typedef enum {RIGHT, LEFT} Direction;
 typedef enum {CONTINUE, RETREAT} Course;
 
 
-struct Preference_Settings {
-    gboolean include_hidden;
-    gboolean include_dirs;
-    gboolean set_file_monitor_for_file;
-    callback cb;
-    gpointer cb_data;
-};
-
-
-
-static GNode*
-vnr_file_dir_content_to_list(VnrFile  *vnrfile,
-                             struct Preference_Settings* preference_settings,
-                             GError   **error);
-
 static gboolean
 vnr_file_get_file_info(char *filepath,
                        VnrFile **vnrfile,
                        gboolean include_hidden,
                        GError **error);
 
-static void
-vnr_file_set_file_monitor(GNode* tree, struct Preference_Settings* preference_settings);
-
 
 static void
-add_file_list_to_tree(GNode **tree, GList **file_list, struct Preference_Settings *preference_settings);
+add_file_list_to_tree(GNode **tree, GList **file_list, struct MonitoringData *monitoring_data, gboolean set_file_monitor_for_file);
 
 static void
-add_directory_list_to_tree(GNode **tree, GList **dir_list, struct Preference_Settings *preference_settings, GError **error);
+add_directory_list_to_tree(GNode **tree, GList **dir_list, struct MonitoringData *monitoring_data, gboolean watch, GError **error);
+
+static GNode*
+read_directory(VnrFile *vnrfile, struct MonitoringData *monitoring_data, gboolean watch, GError **error);
+
+static GNode*
+read_watched_directory(VnrFile *vnrfile, struct MonitoringData *monitoring_data, GError **error);
 
 static gboolean
 tree_contains_path(GNode *tree, char *path);
 
+static GNode*
+recursively_get_child_in_directory(GNode *tree, char* path);
+
+static gboolean
+node_has_path(GNode *node, char *path);
+
 GList * supported_mime_types;
 
+// The roots of all trees created by this file that have not yet been
+// freed. Used for reporting the memory usage of the whole process.
+static GHashTable *live_trees;
+G_LOCK_DEFINE_STATIC(live_trees);
+
+// The nodes given to node_guard.
+static GSList *guarded_nodes = NULL;
+G_LOCK_DEFINE_STATIC(guarded_nodes);
+
+static MonitorBackend default_monitor_backend = MONITOR_BACKEND_GIO;
+static gboolean default_deferred_monitors = FALSE;
+
 
 
 gint compare_quarks (gconstpointer a, gconstpointer b) {
@@ -124,105 +133,399 @@ static gboolean vnr_file_is_supported_mime_type(const char *mime_type) {
 }
 
 
-static struct Preference_Settings* create_preference_settings(gboolean include_hidden,
-                                                              gboolean include_dirs,
-                                                              gboolean set_file_monitor_for_file,
-                                                              callback cb,
-                                                              gpointer cb_data) {
+/*
+ * Returns the node of @path@, which an event from the monitor of @tree@
+ * is about. Only the entries of @tree@ are looked at if @path@ is in
+ * it, so that a stream of removals does not search the whole tree for
+ * each one.
+ */
+static GNode* find_event_node(GNode *tree, char *path) {
+    VnrFile *vnrfile = tree->data;
+    gsize length = strlen(vnrfile->path);
 
-    struct Preference_Settings* preference_settings = malloc(sizeof(*preference_settings));
-    preference_settings->include_hidden = include_hidden;
-    preference_settings->include_dirs = include_dirs;
-    preference_settings->set_file_monitor_for_file = set_file_monitor_for_file;
-    preference_settings->cb = cb;
-    preference_settings->cb_data = cb_data;
-    return preference_settings;
+    if(node_has_path(tree, path)) {
+        return tree;
+    }
+    gboolean is_entry = strncmp(path, vnrfile->path, length) == 0 &&
+                        path[length] == G_DIR_SEPARATOR &&
+                        strchr(path + length + 1, G_DIR_SEPARATOR) == NULL;
+    if(!is_entry || spill_is_stub(tree)) {
+        // Not get_child_in_directory, since this is not a visit.
+        return recursively_get_child_in_directory(get_root_node(tree), path);
+    }
+    if(packed_get_number_of_files(tree) > 0) {
+        return packed_find_path(tree, path);
+    }
+    GNode *child = g_node_first_child(tree);
+    while(child != NULL && !node_has_path(child, path)) {
+        child = g_node_next_sibling(child);
+    }
+    return child;
 }
 
+/*
+ * Unlinks @child@ from the tree with root @root@ and frees it.
+ */
+static void drop_node(GNode *child, GNode *root, struct MonitoringData *monitoring_data) {
+    if(packed_get_index(child) >= 0) {
+        packed_unpack(child->parent);
+    }
+    // Unlinked when freed, so that it is still in its directory while
+    // it is destroyed.
+    free_current_tree(child);
+    if(child != root) {
+        compact_note_change(root, monitoring_data);
+    }
+}
 
-static void remove_file_from_tree(struct MonitoringData *monitoring_data, GFile *file) {
+static void remove_file_from_tree(GNode *tree, GFile *file) {
 
-    GNode* tree = monitoring_data->tree;
-    callback tree_changed_callback = monitoring_data->cb;
-    gpointer cb_data = monitoring_data->cb_data;
+    // Held, since @tree@ itself may be what is removed.
+    struct MonitoringData *monitoring_data = monitoring_data_ref(((VnrFile*) tree->data)->monitoring_data);
 
     GNode *root = get_root_node(tree);
 
     char *file_path = g_file_get_path(file);
-    GNode* child = get_child_in_directory(tree, file_path);
+    GNode* child = find_event_node(tree, file_path);
+    GNode *parent = child != NULL ? child->parent : tree;
 
     if(child != NULL) {
-        g_node_unlink(child);
-        free_current_tree(child);
+        drop_node(child, root, monitoring_data);
     }
+    // An addition still being read on the worker thread is void too.
+    worker_cancel(monitoring_data, file_path);
 
-    if(tree_changed_callback != NULL) {
-        tree_changed_callback(TRUE, file_path, child, root, cb_data);
-    }
+    changes_notify(monitoring_data, TRUE, file_path, child, parent, root);
 
     g_free(file_path);
+    monitoring_data_unref(monitoring_data);
 }
 
-static void add_file_to_tree(struct MonitoringData *monitoring_data, GFile *file) {
+/*
+ * Returns TRUE if the name of @path@ is one that programs commonly
+ * write a file under before renaming it to its real name.
+ */
+static gboolean has_temporary_name(const char *path) {
+    static const char *suffixes[] = { "~", ".tmp", ".temp", ".part", ".partial", ".filepart",
+                                      ".crdownload", ".download", ".swp", NULL };
+    const char *name = strrchr(path, G_DIR_SEPARATOR);
+    const char *dot;
+    int i;
 
-    VnrFile* vnrfile_new = NULL;
+    name = name == NULL ? path : name + 1;
+    if(name[0] == '#' || g_str_has_prefix(name, ".#")) {
+        return TRUE;
+    }
+    for(i = 0; suffixes[i] != NULL; i++) {
+        if(g_str_has_suffix(name, suffixes[i])) {
+            return TRUE;
+        }
+    }
+    // As written by g_file_set_contents: "name.png.XXXXXX".
+    dot = strrchr(name, '.');
+    if(dot != NULL && dot != name && strlen(dot + 1) == 6 && memchr(name, '.', dot - name) != NULL) {
+        for(i = 1; i <= 6 && g_ascii_isalnum(dot[i]); i++);
+        return i > 6;
+    }
+    return FALSE;
+}
 
-    GNode* tree = monitoring_data->tree;
-    gboolean include_hidden = monitoring_data->include_hidden;
-    gboolean include_dirs = monitoring_data->include_dirs;
-    gboolean set_file_monitor_for_file = monitoring_data->set_file_monitor_for_file;
-    callback tree_changed_callback = monitoring_data->cb;
-    gpointer cb_data = monitoring_data->cb_data;
+/*
+ * Adds @file@ to the directory @tree@ if it belongs there. Returns TRUE
+ * if it was added, or handed to the worker thread to be added.
+ */
+static gboolean add_file_to_tree(GNode *tree, GFile *file) {
 
-    GNode *root = get_root_node(tree);
+    struct MonitoringData *monitoring_data = ((VnrFile*) tree->data)->monitoring_data;
     char *file_path = g_file_get_path(file);
+    gboolean added = FALSE;
 
-    if(!tree_contains_path(tree, file_path)) {
+    if(monitoring_data->complete_files_only && has_temporary_name(file_path) &&
+       !g_file_test(file_path, G_FILE_TEST_IS_DIR)) {
+        // Added once it is renamed to its real name.
+        g_free(file_path);
+        return FALSE;
+    }
 
-        vnr_file_get_file_info(file_path,
-                               &vnrfile_new,
-                               include_hidden,
-                               NULL);
-
-        gboolean file_added_to_tree = FALSE;
-        GNode *newnode = NULL;
-        if(vnr_file_is_directory(vnrfile_new)) {
-            if(include_dirs) {
-                // Newly created directory. It might already have been populated.
-
-                struct Preference_Settings* preference_settings = create_preference_settings(include_hidden,
-                                                                                             include_dirs,
-                                                                                             set_file_monitor_for_file,
-                                                                                             tree_changed_callback,
-                                                                                             cb_data);
-
-                newnode = vnr_file_dir_content_to_list(vnrfile_new, preference_settings, NULL);
-                add_node_in_tree(tree, newnode);
-                vnr_file_set_file_monitor(newnode, preference_settings);
-
-                file_added_to_tree = TRUE;
-                free(preference_settings);
+    if(!tree_contains_path(tree, file_path)) {
+        // Looked up here, so that the worker thread finds them ready.
+        vnr_file_get_supported_mime_types();
+
+        added = worker_submit(tree, file_path);
+        if(!added) {
+            GNode *newnode = vnr_file_prepare_node(file_path, monitoring_data);
+            if(newnode != NULL) {
+                vnr_file_splice_node(tree, newnode);
+                added = TRUE;
             }
+        }
+    }
+    g_free(file_path);
+    return added;
+}
+
+/*
+ * Reads what is at @path@ into a node that is not part of any tree,
+ * the way a file system change would add it, but without creating any
+ * monitors. A directory is read with everything in it. Returns NULL if
+ * @path@ does not belong in a tree with the settings of
+ * @monitoring_data@. Only the settings are read, so this may be called
+ * from another thread.
+ */
+GNode* vnr_file_prepare_node(char *path, struct MonitoringData *monitoring_data) {
+    VnrFile* vnrfile_new = NULL;
+
+    vnr_file_get_file_info(path,
+                           &vnrfile_new,
+                           monitoring_data->include_hidden,
+                           NULL);
+
+    if(vnr_file_is_directory(vnrfile_new)) {
+        if(monitoring_data->include_dirs) {
+            // Newly created directory. It might already have been populated.
+            return read_directory(vnrfile_new, monitoring_data, FALSE, NULL);
+        }
+
+    } else if(vnr_file_is_image_file(vnrfile_new)) {
+        return g_node_new(vnrfile_new);
+    }
+
+    if(vnrfile_new != NULL) {
+        vnr_file_destroy_data(vnrfile_new);
+    }
+    return NULL;
+}
+
+static gboolean watch_directory(GNode *node, gpointer data) {
+    if(vnr_file_is_directory(node->data)) {
+        vnr_file_set_file_monitor(node, data);
+    }
+    return FALSE;
+}
+
+/*
+ * Inserts @newnode@, made by vnr_file_prepare_node, in the directory
+ * @tree@, creates its monitors and reports it as added. If the path of
+ * @newnode@ is in the tree already, @newnode@ is freed instead.
+ */
+void vnr_file_splice_node(GNode *tree, GNode *newnode) {
+
+    struct MonitoringData *monitoring_data = ((VnrFile*) tree->data)->monitoring_data;
+    char *file_path = ((VnrFile*) newnode->data)->path;
+
+    GNode *root = get_root_node(tree);
+
+    if(tree_contains_path(tree, file_path)) {
+        free_current_tree(newnode);
+        return;
+    }
+    // Compacting the tree moves the path of the node.
+    file_path = g_strdup(file_path);
+
+    add_node_in_tree(tree, newnode);
+    entry_index_add(tree, newnode);
+    g_node_traverse(newnode, G_PRE_ORDER, G_TRAVERSE_ALL, -1, watch_directory, monitoring_data);
+
+    compact_note_change(root, monitoring_data);
+    changes_notify(monitoring_data, FALSE, file_path, newnode, tree, root);
+    g_free(file_path);
+}
+
+
+struct PathPrefix {
+    gsize old_length;
+    const char *new_prefix;
+};
+
+static gboolean replace_path_prefix(GNode *node, gpointer data) {
+    struct PathPrefix *prefix = data;
+    VnrFile *vnrfile = node->data;
+    char *path = g_strconcat(prefix->new_prefix, vnrfile->path + prefix->old_length, NULL);
+
+    vnr_file_rename(vnrfile, path, NULL);
+    g_free(path);
+    return FALSE;
+}
+
+static gboolean rewatch_directory(GNode *node, gpointer data) {
+    // GIO reports paths from when the monitor was created. Inotify and
+    // fanotify watches follow the inode, and polling reads the current
+    // path, so those are left alone.
+    if(((VnrFile*) node->data)->monitor != NULL) {
+        vnr_file_remove_file_monitor(node);
+        vnr_file_set_file_monitor(node, data);
+    }
+    return FALSE;
+}
 
-        } else if(vnr_file_is_image_file(vnrfile_new)) {
-            newnode = g_node_new(vnrfile_new);
-            add_node_in_tree(tree, newnode);
-            file_added_to_tree = TRUE;
+static void relink_node(GNode *node,
+                        GNode *new_parent,
+                        const char *old_path,
+                        const char *new_path,
+                        const char *display_name,
+                        struct MonitoringData *monitoring_data) {
+    struct PathPrefix prefix = { strlen(old_path), new_path };
+
+    if(packed_get_index(node) >= 0) {
+        packed_unpack(node->parent);
+    }
+    g_node_unlink(node);
+
+    // Spilled and packed children are stored by name, and get their
+    // paths from the directory when they are brought back.
+    g_node_traverse(node, G_PRE_ORDER, G_TRAVERSE_ALL, -1, replace_path_prefix, &prefix);
+    vnr_file_rename(node->data, new_path, display_name);
+    g_node_traverse(node, G_PRE_ORDER, G_TRAVERSE_ALL, -1, rewatch_directory, monitoring_data);
+
+    add_node_in_tree(new_parent, node);
+    entry_index_add(new_parent, node);
+}
+
+/*
+ * Moves what is at @file@ in the tree to @other_file@, keeping the
+ * nodes. If only one end of the move is in the tree, it is handled as
+ * a removal or an addition.
+ */
+static void move_file_in_tree(GNode *tree, GFile *file, GFile *other_file) {
+
+    // Held, since the callbacks may free the tree.
+    struct MonitoringData *monitoring_data = monitoring_data_ref(((VnrFile*) tree->data)->monitoring_data);
+
+    GNode *root = get_root_node(tree);
+    char *old_path = g_file_get_path(file);
+    char *new_path = g_file_get_path(other_file);
+    char *new_parent_path = g_path_get_dirname(new_path);
+
+    GNode *node = recursively_get_child_in_directory(root, old_path);
+    GNode *new_parent = recursively_get_child_in_directory(root, new_parent_path);
+    VnrFile *moved = NULL;
+
+    // What is still being read at the old path would be added there.
+    worker_cancel(monitoring_data, old_path);
+
+    if(new_parent != NULL && !vnr_file_is_directory(new_parent->data)) {
+        new_parent = NULL;
+    }
+    if(node != NULL && new_parent != NULL && node != new_parent && !g_node_is_ancestor(node, new_parent)) {
+        // The new name decides whether it still belongs in the tree.
+        vnr_file_get_file_info(new_path, &moved, monitoring_data->include_hidden, NULL);
+    }
+
+    if(moved != NULL && vnr_file_is_directory(moved) == vnr_file_is_directory(node->data)) {
+        GNode *old_parent = node->parent;
+        GNode *replaced = find_event_node(new_parent, new_path);
+
+        if(replaced != NULL && replaced != new_parent && replaced != node) {
+            // Moved onto an existing file, as when saving atomically.
+            // The callbacks may free the tree.
+            node_guard(&node);
+            node_guard(&new_parent);
+            drop_node(replaced, root, monitoring_data);
+            changes_notify(monitoring_data, TRUE, new_path, replaced, new_parent, root);
+            node_unguard(&node);
+            node_unguard(&new_parent);
+        }
+        if(node != NULL && new_parent != NULL) {
+            relink_node(node, new_parent, old_path, new_path, moved->display_name, monitoring_data);
+            compact_note_change(root, monitoring_data);
+            changes_notify_moved(monitoring_data, old_path, node, old_parent, root);
+        }
+
+    } else if(node != NULL) {
+        remove_file_from_tree(tree, file);
+        if(new_parent != NULL) {
+            add_file_to_tree(new_parent, other_file);
         }
 
-        if(file_added_to_tree && tree_changed_callback != NULL) {
-            tree_changed_callback(FALSE, file_path, newnode, root, cb_data);
+    } else if(new_parent != NULL) {
+        add_file_to_tree(new_parent, other_file);
+    }
+
+    if(moved != NULL) {
+        vnr_file_destroy_data(moved);
+    }
+    g_free(old_path);
+    g_free(new_path);
+    g_free(new_parent_path);
+    monitoring_data_unref(monitoring_data);
+}
+
+
+/*
+ * Gives the file @node@ the display name of @fresh@, which has been
+ * read from the file system again, and moves it to its new place among
+ * its siblings if that changes the order. Returns FALSE if it already
+ * had that display name.
+ */
+static gboolean refresh_node(GNode *node, VnrFile *fresh) {
+    VnrFile *vnrfile = node->data;
+    GNode *parent = node->parent;
+
+    if(g_strcmp0(vnrfile->display_name, fresh->display_name) == 0) {
+        return FALSE;
+    }
+    gboolean resort = g_strcmp0(vnrfile->display_name_collate, fresh->display_name_collate) != 0;
+    vnr_file_rename(vnrfile, vnrfile->path, fresh->display_name);
+
+    if(resort && parent != NULL) {
+        if(packed_get_index(node) >= 0) {
+            packed_unpack(parent);
         }
+        g_node_unlink(node);
+        add_node_in_tree(parent, node);
+    }
+    return TRUE;
+}
+
+/*
+ * Brings the file @file@ in @tree@ up to date after @type@, which is
+ * CHANGED, CHANGES_DONE_HINT or ATTRIBUTE_CHANGED. One that is not in
+ * the tree is added, except after ATTRIBUTE_CHANGED. Otherwise, a file
+ * is only read again once its contents are done changing, or when its
+ * attributes change; one that is no longer a supported image is then
+ * removed. It is reported as modified when its contents are done
+ * changing, and after ATTRIBUTE_CHANGED only if that changed its node.
+ */
+static void modify_file_in_tree(GNode *tree, GFile *file, GFileMonitorEvent type) {
 
-        if(!file_added_to_tree) {
-            vnr_file_destroy_data(vnrfile_new);
+    // Held, since the callbacks may free the tree.
+    struct MonitoringData *monitoring_data = monitoring_data_ref(((VnrFile*) tree->data)->monitoring_data);
+
+    char *file_path = g_file_get_path(file);
+    GNode *node = entry_index_find(tree, file_path);
+    VnrFile *fresh = NULL;
+
+    if(node == NULL) {
+        node = find_event_node(tree, file_path);
+        entry_index_add(tree, node);
+    }
+
+    if(node == NULL) {
+        if(type != G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED) {
+            add_file_to_tree(tree, file);
+        }
+    // What is in a directory is followed by its own monitor. A write
+    // gives many CHANGED, which are covered by the CHANGES_DONE_HINT
+    // that follows them.
+    } else if(!vnr_file_is_directory(node->data) && type != G_FILE_MONITOR_EVENT_CHANGED) {
+        vnr_file_get_file_info(file_path, &fresh, monitoring_data->include_hidden, NULL);
+
+        if(!vnr_file_is_image_file(fresh)) {
+            remove_file_from_tree(tree, file);
+        } else if(refresh_node(node, fresh) || type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT) {
+            changes_notify_modified(monitoring_data, file_path, node, get_root_node(tree));
         }
     }
+
+    if(fresh != NULL) {
+        vnr_file_destroy_data(fresh);
+    }
     g_free(file_path);
+    monitoring_data_unref(monitoring_data);
 }
 
 
-static void
+void
 vnr_file_directory_updated(GFileMonitor       *monitor,
                            GFile              *file,
                            GFile              *other_file,
@@ -230,20 +533,168 @@ vnr_file_directory_updated(GFileMonitor       *monitor,
                            gpointer            data)
 {
     UNUSED(monitor);
-    UNUSED(other_file);
 
-    VnrFile* vnrfile = data;
+    GNode* tree = data;
+    struct MonitoringData *monitoring_data = ((VnrFile*) tree->data)->monitoring_data;
+    gint64 received = stats_event_received(monitoring_data);
+
+    if(burst_absorb(tree, file, other_file, type)) {
+        // Covered by reading the directory again after the burst.
+        stats_event_merged(monitoring_data);
+        return;
+    }
+    if(!events_enqueue(tree, file, other_file, type, received)) {
+        // Held, since the callbacks may free the tree.
+        monitoring_data_ref(monitoring_data);
+        stats_apply_begin(monitoring_data, received);
+        vnr_file_apply_directory_event(tree, file, other_file, type);
+        stats_apply_end(monitoring_data);
+        monitoring_data_unref(monitoring_data);
+    }
+}
+
+/*
+ * Takes care of the file system that the directory @tree@ is on having
+ * been unmounted. The directory it was mounted on is removed, with
+ * everything in it, and the callback is called once for it instead of
+ * once for every entry. If that directory is in another directory of
+ * the tree, it is added back and read from scratch once something is
+ * mounted on it again. If it is the root of the tree, which belongs to
+ * the caller, only its entries are removed, and it is read again once
+ * something is mounted on it.
+ */
+static void unmount_directory(GNode *tree) {
+
+    // Held, since the callback may free the tree.
+    struct MonitoringData *monitoring_data = monitoring_data_ref(((VnrFile*) tree->data)->monitoring_data);
+
+    GNode *root = get_root_node(tree);
+    GNode *mount_point = tree;
+
+    // What was below the mount point is gone with the file system.
+    while(mount_point->parent != NULL && mount_point->parent->data != NULL &&
+          !g_file_test(((VnrFile*) mount_point->data)->path, G_FILE_TEST_EXISTS)) {
+        mount_point = mount_point->parent;
+    }
+    char *path = g_strdup(((VnrFile*) mount_point->data)->path);
+    GNode *parent = mount_point->parent;
+
+    if(parent == NULL) {
+        mounts_watch_for_remount(mount_point, path);
+
+        // The callbacks may free the tree.
+        node_guard(&mount_point);
+        while(mount_point != NULL && mount_point->children != NULL) {
+            GNode *child = mount_point->children;
+            char *child_path = g_strdup(((VnrFile*) child->data)->path);
+            drop_node(child, root, monitoring_data);
+            changes_notify(monitoring_data, TRUE, child_path, child, mount_point, root);
+            g_free(child_path);
+        }
+        node_unguard(&mount_point);
+
+    } else {
+        if(parent->data != NULL) {
+            mounts_watch_for_remount(parent, path);
+        }
+        drop_node(mount_point, root, monitoring_data);
+        changes_notify(monitoring_data, TRUE, path, mount_point, parent, root);
+    }
+
+    g_free(path);
+    monitoring_data_unref(monitoring_data);
+}
+
+/*
+ * Watches the directory @tree@ again and reads it, after its watch was
+ * lost without the directory being removed, such as when the file
+ * system under it was replaced.
+ */
+static void rewatch_lost_directory(GNode *tree) {
+    VnrFile *vnrfile = tree->data;
+
+    if(!vnrfile->is_directory || !g_file_test(vnrfile->path, G_FILE_TEST_IS_DIR)) {
+        // Gone; the parent directory will report that.
+        return;
+    }
+    // Held, since the callbacks may free the tree.
+    struct MonitoringData *monitoring_data = monitoring_data_ref(vnrfile->monitoring_data);
+    vnr_file_remove_file_monitor(tree);
+    vnr_file_set_file_monitor(tree, monitoring_data);
+    vnr_file_directory_rescan(tree);
+    monitoring_data_unref(monitoring_data);
+}
+
+/*
+ * Changes the tree according to an event from the monitor of @tree@,
+ * once it is no longer held back.
+ */
+void vnr_file_apply_directory_event(GNode *tree, GFile *file, GFile *other_file, GFileMonitorEvent type) {
+    gboolean complete_files_only = ((VnrFile*) tree->data)->monitoring_data->complete_files_only;
+
+    if(type == VNR_FILE_MONITOR_EVENT_WATCH_LOST) {
+        rewatch_lost_directory(tree);
+        return;
+    }
 
     switch (type) {
         case G_FILE_MONITOR_EVENT_DELETED:
 
-            remove_file_from_tree(vnrfile->monitoring_data, file);
+            remove_file_from_tree(tree, file);
+            break;
+
+        case G_FILE_MONITOR_EVENT_CHANGED:
+
+            if(!complete_files_only) {
+                modify_file_in_tree(tree, file, type);
+            }
+            break;
+
+        case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+
+            modify_file_in_tree(tree, file, type);
             break;
 
-        case G_FILE_MONITOR_EVENT_CHANGED: // Fall-through
+        // A new file may still be written to. Directories are never
+        // written, so they are added right away.
         case G_FILE_MONITOR_EVENT_CREATED:
 
-            add_file_to_tree(vnrfile->monitoring_data, file);
+            if(!complete_files_only || g_file_query_file_type(file, G_FILE_QUERY_INFO_NONE, NULL) == G_FILE_TYPE_DIRECTORY) {
+                add_file_to_tree(tree, file);
+            }
+            break;
+
+        // Also all that the inotify and fanotify backends report of a
+        // write, so it is not only for complete files.
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+
+            modify_file_in_tree(tree, file, type);
+            break;
+
+        case G_FILE_MONITOR_EVENT_UNMOUNTED:
+
+            unmount_directory(tree);
+            break;
+
+        // Without the other end, the move crossed the edge of what is
+        // monitored.
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+
+            if(other_file == NULL) {
+                add_file_to_tree(tree, file);
+            } else {
+                move_file_in_tree(tree, other_file, file);
+            }
+            break;
+
+        case G_FILE_MONITOR_EVENT_RENAMED: // Fall-through
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+
+            if(other_file == NULL) {
+                remove_file_from_tree(tree, file);
+            } else {
+                move_file_in_tree(tree, file, other_file);
+            }
             break;
 
         default:
@@ -252,41 +703,256 @@ vnr_file_directory_updated(GFileMonitor       *monitor,
 }
 
 
+/*
+ * Entry point for monitor backends other than GIO. @name@ is the name
+ * of the affected entry in the directory of @tree@, or NULL if the
+ * event concerns @tree@ itself.
+ */
+void vnr_file_directory_entry_updated(GNode *tree, const char *name, GFileMonitorEvent type) {
+    VnrFile *vnrfile = tree->data;
+    char *path = name != NULL ? g_build_filename(vnrfile->path, name, NULL)
+                              : g_strdup(vnrfile->path);
+    GFile *file = g_file_new_for_path(path);
 
-static void
-vnr_file_set_file_monitor(GNode* tree, struct Preference_Settings* preference_settings)
+    vnr_file_directory_updated(NULL, file, NULL, type, tree);
+
+    g_object_unref(file);
+    g_free(path);
+}
+
+/*
+ * Like vnr_file_directory_entry_updated, for a backend that has paired
+ * the two halves of a move from @from_tree@ to @to_tree@.
+ */
+void vnr_file_directory_entry_moved(GNode *from_tree, const char *from_name,
+                                    GNode *to_tree, const char *to_name) {
+    char *from_path = g_build_filename(((VnrFile*) from_tree->data)->path, from_name, NULL);
+    char *to_path = g_build_filename(((VnrFile*) to_tree->data)->path, to_name, NULL);
+    GFile *from_file = g_file_new_for_path(from_path);
+    GFile *to_file = g_file_new_for_path(to_path);
+
+    vnr_file_directory_updated(NULL, from_file, to_file, G_FILE_MONITOR_EVENT_RENAMED, from_tree);
+
+    g_object_unref(from_file);
+    g_object_unref(to_file);
+    g_free(from_path);
+    g_free(to_path);
+}
+
+
+/**
+ * Makes the tree that @tree@ is part of only get files added by file
+ * system changes once they have been completely written, if @enabled@
+ * is TRUE. A file is then added when it is closed after being written
+ * to, or when it is moved or renamed into a monitored directory, but
+ * not while it is being written. Files with names that are commonly
+ * used while writing, such as "photo.jpg.part" or "photo.jpg~", are
+ * not added until they are renamed. New directories are added right
+ * away. Files found when reading a directory are always added.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_complete_files_only(GNode *tree, gboolean enabled) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        return FALSE;
+    }
+    monitoring_data->complete_files_only = enabled;
+    return TRUE;
+}
+
+
+void
+vnr_file_set_file_monitor(GNode* tree, struct MonitoringData* monitoring_data)
 {
     VnrFile* vnrfile = tree->data;
-    GFile *file = g_file_new_for_path(vnrfile->path);
-    // It's not fatal if directory monitoring isn't supported,
-    // so set error to NULL.
-    vnrfile->monitor = g_file_monitor(file,
-                                      G_FILE_MONITOR_NONE,
-                                      NULL,
-                                      NULL);
-    g_object_unref(file);
 
-    if(vnrfile->monitor) {
+    // Kept even without a monitor, since it is also how a directory
+    // finds the state of the tree it belongs to.
+    // The reference will be dropped when the VnrFile is destroyed.
+    if(vnrfile->monitoring_data == NULL) {
+        vnrfile->monitoring_data = monitoring_data_ref(monitoring_data);
+    }
+
+    if(vnrfile->is_directory && budget_poll_instead(tree, monitoring_data)) {
+        return;
+    }
 
-        // This will be freed when the VnrFile is destroyed.
-        struct MonitoringData* monitoring_data = malloc(sizeof(*monitoring_data));
+    gboolean watched = fanotify_watch(tree, monitoring_data) || inotify_watch(tree, monitoring_data);
 
-        monitoring_data->tree = tree;
-        monitoring_data->include_hidden = preference_settings->include_hidden;
-        monitoring_data->include_dirs = preference_settings->include_dirs;
-        monitoring_data->set_file_monitor_for_file = preference_settings->set_file_monitor_for_file;
-        monitoring_data->cb = preference_settings->cb;
-        monitoring_data->cb_data = preference_settings->cb_data;
+    if(!watched) {
+        // Shared with other trees that watch the same path.
+        vnrfile->monitor = registry_acquire_monitor(tree);
+        watched = vnrfile->monitor != NULL;
+    }
 
-        vnrfile->monitoring_data = monitoring_data;
+    if(vnrfile->is_directory && watched) {
+        budget_watch_added(tree, monitoring_data);
+    } else if(vnrfile->is_directory) {
+        // Polled instead, so that changes are not silently missed.
+        budget_watch_failed(tree, monitoring_data);
+    }
+}
 
-        g_signal_connect(vnrfile->monitor,
-                         "changed",
-                         G_CALLBACK(vnr_file_directory_updated),
-                         vnrfile);
+/*
+ * Removes whatever watch @tree@ has, keeping its monitoring data.
+ */
+void vnr_file_remove_file_monitor(GNode *tree) {
+    registry_forget(tree);
+    inotify_forget(tree);
+    fanotify_forget(tree);
+}
+
+/*
+ * Returns the modification time of @path@ in nanoseconds, or -1 if it
+ * cannot be read.
+ */
+gint64 vnr_file_get_mtime(const char *path) {
+    struct stat st;
+    if(stat(path, &st) != 0) {
+        return -1;
     }
+    return (gint64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
 }
 
+/*
+ * Reads the directory @tree@ from disk and brings its children up to
+ * date, as if the monitor had reported every difference: entries that
+ * are gone are removed and new entries that the tree would have read
+ * are added, with a call to the callback for each. Subdirectories are
+ * not looked into. Stops if a callback frees @tree@.
+ * Returns the number of changes.
+ */
+guint vnr_file_directory_rescan(GNode *tree) {
+    VnrFile *vnrfile = tree->data;
+    struct MonitoringData *monitoring_data = vnrfile->monitoring_data;
+    GHashTable *on_disk;
+    GHashTable *wanted;
+    GHashTable *in_tree;
+    GSList *removed = NULL, *added = NULL, *it;
+    GHashTableIter iter;
+    gpointer path;
+    guint changes = 0;
+    guint i;
+
+    if(!g_file_test(vnrfile->path, G_FILE_TEST_IS_DIR)) {
+        // Gone; the parent directory will report that.
+        return 0;
+    }
+    // Read now, with the entries classified as when the tree was read.
+    listing_invalidate(vnrfile->path);
+    struct Listing *listing = listing_get(vnrfile->path);
+
+    on_disk = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    wanted = g_hash_table_new(g_str_hash, g_str_equal);
+    for(i = 0; i < listing->entries->len; i++) {
+        struct ListedEntry *entry = &g_array_index(listing->entries, struct ListedEntry, i);
+        char *entry_path = g_build_filename(vnrfile->path, entry->name, NULL);
+
+        g_hash_table_add(on_disk, entry_path);
+        if((!entry->is_hidden || monitoring_data->include_hidden) &&
+           (entry->is_directory ? monitoring_data->include_dirs : entry->is_supported)) {
+            g_hash_table_add(wanted, entry_path);
+        }
+    }
+    listing_unref(listing);
+
+    spill_fault_in(tree);
+    packed_unpack(tree);
+
+    in_tree = g_hash_table_new(g_str_hash, g_str_equal);
+    GNode *child = g_node_first_child(tree);
+    while(child != NULL) {
+        char *child_path = ((VnrFile*) child->data)->path;
+        g_hash_table_add(in_tree, child_path);
+        if(!g_hash_table_contains(on_disk, child_path)) {
+            removed = g_slist_prepend(removed, g_strdup(child_path));
+        }
+        child = g_node_next_sibling(child);
+    }
+    g_hash_table_iter_init(&iter, wanted);
+    while(g_hash_table_iter_next(&iter, &path, NULL)) {
+        if(!g_hash_table_contains(in_tree, path)) {
+            added = g_slist_prepend(added, g_strdup(path));
+        }
+    }
+    g_hash_table_destroy(in_tree);
+    g_hash_table_destroy(wanted);
+    g_hash_table_destroy(on_disk);
+
+    // The callbacks may free the tree.
+    node_guard(&tree);
+
+    for(it = removed; it != NULL && tree != NULL; it = it->next) {
+        GFile *file = g_file_new_for_path(it->data);
+        remove_file_from_tree(tree, file);
+        g_object_unref(file);
+        changes++;
+    }
+    for(it = added; it != NULL && tree != NULL; it = it->next) {
+        GFile *file = g_file_new_for_path(it->data);
+        if(add_file_to_tree(tree, file)) {
+            changes++;
+        }
+        g_object_unref(file);
+    }
+
+    node_unguard(&tree);
+    g_slist_free_full(removed, g_free);
+    g_slist_free_full(added, g_free);
+    return changes;
+}
+
+
+#define FILE_INFO_ATTRIBUTES G_FILE_ATTRIBUTE_STANDARD_TYPE"," \
+                             G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME"," \
+                             G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN
+
+/*
+ * Queries what vnr_file_get_file_info and vnr_file_list_entry need to
+ * know about @file@. The content type, which may mean reading the
+ * start of the file, is left for is_supported_file when there is a
+ * classification cache to look in first; what the cache is looked up
+ * by is queried instead.
+ */
+static GFileInfo* query_file_info(GFile *file, GError **error) {
+    const char *attributes = classify_enabled() ?
+                             FILE_INFO_ATTRIBUTES","CLASSIFY_KEY_ATTRIBUTES :
+                             FILE_INFO_ATTRIBUTES","G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE;
+    return g_file_query_info(file, attributes, (GFileQueryInfoFlags) 0, NULL, error);
+}
+
+/*
+ * Returns TRUE if @file@, which @fileinfo@ from query_file_info is
+ * about, is an image of a supported type. Without the content type in
+ * @fileinfo@, the classification cache is looked in before the content
+ * type is queried, and what the query gives is remembered.
+ */
+static gboolean is_supported_file(GFile *file, GFileInfo *fileinfo) {
+    if(g_file_info_has_attribute(fileinfo, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE)) {
+        return vnr_file_is_supported_mime_type(g_file_info_get_content_type(fileinfo));
+    }
+
+    struct ClassificationKey key;
+    gboolean is_supported = FALSE;
+    char *path = g_file_get_path(file);
+    // From before the query, so that a file that changes in between is
+    // remembered under what it was, which will not be looked up again.
+    gboolean has_key = classify_key(fileinfo, path, &key);
+
+    if(!has_key || !classify_lookup(&key, &is_supported)) {
+        GFileInfo *typeinfo = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+                                                (GFileQueryInfoFlags) 0, NULL, NULL);
+        if(typeinfo != NULL) {
+            is_supported = vnr_file_is_supported_mime_type(g_file_info_get_content_type(typeinfo));
+            if(has_key) {
+                classify_store(&key, is_supported);
+            }
+            g_object_unref(typeinfo);
+        }
+    }
+    g_free(path);
+    return is_supported;
+}
 
 
 static gboolean
@@ -300,7 +966,6 @@ vnr_file_get_file_info(char *filepath,
     }
     GFile *file;
     GFileInfo *fileinfo;
-    const char *mimetype;
     char *display_name;
     char *full_filepath;
     gboolean file_info_success;
@@ -309,12 +974,7 @@ vnr_file_get_file_info(char *filepath,
 
     *vnrfile = NULL;
     file = g_file_new_for_path(filepath);
-    fileinfo = g_file_query_info(file,
-                                 G_FILE_ATTRIBUTE_STANDARD_TYPE","
-                                 G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME","
-                                 G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE","
-                                 G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN,
-                                 (GFileQueryInfoFlags) 0, NULL, error);
+    fileinfo = query_file_info(file, error);
     file_info_success = fileinfo != NULL;
 
     if(file_info_success && (include_hidden || !g_file_info_get_is_hidden(fileinfo))) {
@@ -322,8 +982,7 @@ vnr_file_get_file_info(char *filepath,
         display_name = g_strdup(g_file_info_get_display_name(fileinfo));
 
         if(!is_directory) {
-            mimetype = g_file_info_get_content_type(fileinfo);
-            supported_mime_type = vnr_file_is_supported_mime_type(mimetype);
+            supported_mime_type = is_supported_file(file, fileinfo);
         }
 
         if(is_directory || supported_mime_type) {
@@ -341,20 +1000,47 @@ vnr_file_get_file_info(char *filepath,
 }
 
 
+/*
+ * Looks at what is at @path@ the way vnr_file_get_file_info does, for
+ * a listing of the directory it is in. Returns FALSE, with @error@
+ * set, if that fails.
+ */
+gboolean vnr_file_list_entry(const char *path, struct ListedEntry *entry, GError **error) {
+    GFile *file = g_file_new_for_path(path);
+    GFileInfo *fileinfo = query_file_info(file, error);
+    if(fileinfo == NULL) {
+        g_object_unref(file);
+        return FALSE;
+    }
+
+    entry->name = g_file_get_basename(file);
+    entry->display_name = g_strdup(g_file_info_get_display_name(fileinfo));
+    entry->display_name_collate = g_utf8_collate_key_for_filename(entry->display_name, -1);
+    entry->is_directory = g_file_info_get_file_type(fileinfo) == G_FILE_TYPE_DIRECTORY;
+    entry->is_hidden = g_file_info_get_is_hidden(fileinfo);
+    entry->is_supported = !entry->is_directory && is_supported_file(file, fileinfo);
+
+    g_object_unref(fileinfo);
+    g_object_unref(file);
+    return TRUE;
+}
+
+
 static void
 vnr_file_add_file_to_lists_if_possible(gchar   *filepath,
                                        GList  **dir_list,
                                        GList  **file_list,
-                                       struct Preference_Settings* preference_settings,
+                                       gboolean include_hidden,
+                                       gboolean include_dirs,
                                        GError **error)
 {
     VnrFile *vnrfile;
     gboolean file_info_ok = vnr_file_get_file_info(filepath,
                                                    &vnrfile,
-                                                   preference_settings->include_hidden,
+                                                   include_hidden,
                                                    error);
 
-    if(file_info_ok && vnr_file_is_directory(vnrfile) && preference_settings->include_dirs) {
+    if(file_info_ok && vnr_file_is_directory(vnrfile) && include_dirs) {
         *dir_list  = g_list_prepend( *dir_list, vnrfile);
     } else if(file_info_ok && vnr_file_is_image_file(vnrfile)) {
         *file_list = g_list_prepend(*file_list, vnrfile);
@@ -367,17 +1053,20 @@ static void
 vnr_append_file_and_dir_lists_to_tree(GNode  **tree,
                                       GList  **dir_list,
                                       GList  **file_list,
-                                      struct Preference_Settings* preference_settings,
+                                      struct MonitoringData* monitoring_data,
+                                      gboolean set_file_monitor_for_file,
+                                      gboolean set_file_monitor_for_dir,
                                       GError **error)
 {
-    add_file_list_to_tree(tree, file_list, preference_settings);
-    add_directory_list_to_tree(tree, dir_list, preference_settings, error);
+    add_file_list_to_tree(tree, file_list, monitoring_data, set_file_monitor_for_file);
+    add_directory_list_to_tree(tree, dir_list, monitoring_data, set_file_monitor_for_dir, error);
 }
 
 static void
 add_file_list_to_tree(GNode **tree,
                       GList **file_list,
-                      struct Preference_Settings *preference_settings) {
+                      struct MonitoringData *monitoring_data,
+                      gboolean set_file_monitor_for_file) {
 
     *file_list = g_list_sort(*file_list, vnr_file_list_compare);
 
@@ -385,8 +1074,8 @@ add_file_list_to_tree(GNode **tree,
         GNode *node = g_node_new((*file_list)->data);
         add_node_in_tree(*tree, node);
 
-        if(preference_settings->set_file_monitor_for_file) {
-            vnr_file_set_file_monitor(node, preference_settings);
+        if(set_file_monitor_for_file) {
+            vnr_file_set_file_monitor(node, monitoring_data);
         }
 
         *file_list = g_list_next(*file_list);
@@ -396,86 +1085,143 @@ add_file_list_to_tree(GNode **tree,
 static void
 add_directory_list_to_tree(GNode  **tree,
                            GList  **dir_list,
-                           struct Preference_Settings *preference_settings,
+                           struct MonitoringData *monitoring_data,
+                           gboolean watch,
                            GError **error) {
 
     *dir_list  = g_list_sort(*dir_list, vnr_file_list_compare);
 
-    struct Preference_Settings* dir_preference_settings = create_preference_settings(preference_settings->include_hidden,
-                                                                                     preference_settings->include_dirs,
-                                                                                     FALSE,
-                                                                                     preference_settings->cb,
-                                                                                     preference_settings->cb_data);
     while(*dir_list != NULL) {
 
-        GNode *node = vnr_file_dir_content_to_list((*dir_list)->data,
-                                                   dir_preference_settings,
-                                                   error);
-        vnr_file_set_file_monitor(node, preference_settings);
+        GNode *node = watch ?
+                      read_watched_directory((*dir_list)->data, monitoring_data, error) :
+                      read_directory((*dir_list)->data, monitoring_data, FALSE, error);
 
         add_node_in_tree(*tree, node);
         *dir_list = g_list_next(*dir_list);
     }
-
-    free(dir_preference_settings);
 }
 
 
+/*
+ * Like vnr_file_dir_content_to_list, and gives the directory a monitor
+ * as well. If the monitors of the tree are deferred, it is left for
+ * later instead, together with those of the subdirectories. If the
+ * tree is being created and there is a snapshot of the directory, the
+ * tree is taken from it instead.
+ */
 static GNode*
+read_watched_directory(VnrFile  *vnrfile,
+                       struct MonitoringData* monitoring_data,
+                       GError   **error)
+{
+    // Directories read later, such as new ones or ones brought back
+    // from being spilled, are read from disk.
+    GNode *snapshot = monitoring_data->building ? snapshot_load(vnrfile, monitoring_data) : NULL;
+    if(snapshot != NULL) {
+        return snapshot;
+    }
+    if(!deferred_watches_accepting(monitoring_data)) {
+        GNode *tree = read_directory(vnrfile, monitoring_data, TRUE, error);
+        vnr_file_set_file_monitor(tree, monitoring_data);
+        return tree;
+    }
+    // Taken first, so that changes made while reading are caught up on.
+    gint64 mtime = vnr_file_get_mtime(vnrfile->path);
+    GNode *tree = read_directory(vnrfile, monitoring_data, TRUE, error);
+    deferred_watch(tree, monitoring_data, mtime);
+    return tree;
+}
+
+GNode*
 vnr_file_dir_content_to_list(VnrFile  *vnrfile,
-                             struct Preference_Settings* preference_settings,
+                             struct MonitoringData* monitoring_data,
                              GError   **error)
+{
+    return read_directory(vnrfile, monitoring_data, TRUE, error);
+}
+
+/*
+ * Like vnr_file_dir_content_to_list. Subdirectories only get monitors
+ * if @watch@ is TRUE.
+ */
+static GNode*
+read_directory(VnrFile  *vnrfile,
+               struct MonitoringData* monitoring_data,
+               gboolean watch,
+               GError   **error)
 {
     GNode *tree       = g_node_new(vnrfile);
     GList *dir_list   = NULL;
     GList *file_list  = NULL;
-
-    GFile *file;
-    GFileEnumerator *f_enum;
-    GFileInfo *file_info;
+    guint i;
 
     char* folder_path = vnrfile->path;
 
-    file   = g_file_new_for_path(folder_path);
-    f_enum = g_file_enumerate_children(file,
-                                       G_FILE_ATTRIBUTE_STANDARD_NAME","
-                                       G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME","
-                                       G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE","
-                                       G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN,
-                                       G_FILE_QUERY_INFO_NONE,
-                                       NULL, NULL);
-    file_info = g_file_enumerator_next_file(f_enum, NULL, NULL);
-
+    // Possibly read a moment ago for another tree.
+    struct Listing *listing = listing_get(folder_path);
 
-    while(file_info != NULL) {
-        char* child_path = g_strjoin(G_DIR_SEPARATOR_S, folder_path,
-                                     (char*)g_file_info_get_name (file_info), NULL);
+    for(i = 0; i < listing->entries->len; i++) {
+        struct ListedEntry *entry = &g_array_index(listing->entries, struct ListedEntry, i);
 
-        vnr_file_add_file_to_lists_if_possible(child_path,
-                                               &dir_list,
-                                               &file_list,
-                                               preference_settings,
-                                               error);
-
-        free(child_path);
-        g_object_unref(file_info);
-        file_info = g_file_enumerator_next_file(f_enum, NULL, NULL);
+        if(entry->is_hidden && !monitoring_data->include_hidden) {
+            continue;
+        }
+        if(entry->is_directory && !monitoring_data->include_dirs) {
+            continue;
+        }
+        if(entry->is_directory || entry->is_supported) {
+            char* child_path = g_build_filename(folder_path, entry->name, NULL);
+            VnrFile *child = vnr_file_create_with_collate_key(child_path,
+                                                              entry->display_name,
+                                                              entry->display_name_collate,
+                                                              entry->is_directory);
+            if(entry->is_directory) {
+                dir_list = g_list_prepend(dir_list, child);
+            } else {
+                file_list = g_list_prepend(file_list, child);
+            }
+            g_free(child_path);
+        }
     }
-
-    g_object_unref(file);
-    g_file_enumerator_close(f_enum, NULL, NULL);
-    g_object_unref(f_enum);
+    if(listing->error != NULL && error != NULL && *error == NULL) {
+        *error = g_error_copy(listing->error);
+    }
+    listing_unref(listing);
 
     vnr_append_file_and_dir_lists_to_tree(&tree,
                                           &dir_list,
                                           &file_list,
-                                          preference_settings,
+                                          monitoring_data,
+                                          FALSE,
+                                          watch,
                                           error);
     g_list_free(dir_list);
     g_list_free(file_list);
     return tree;
 }
 
+static void register_live_tree(GNode *tree) {
+    GNode *root = get_root_node(tree);
+    if(root == NULL) {
+        return;
+    }
+    G_LOCK(live_trees);
+    if(live_trees == NULL) {
+        live_trees = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    g_hash_table_add(live_trees, root);
+    G_UNLOCK(live_trees);
+}
+
+static void unregister_live_tree(GNode *node) {
+    G_LOCK(live_trees);
+    if(live_trees != NULL) {
+        g_hash_table_remove(live_trees, node);
+    }
+    G_UNLOCK(live_trees);
+}
+
 static char*
 vnr_get_parent_file_path(char *path)
 {
@@ -547,11 +1293,15 @@ GNode* create_tree_from_single_uri(char *uri,
     VnrFile* vnrfile;
     gboolean file_info_ok;
 
-    struct Preference_Settings* preference_settings = create_preference_settings(include_hidden,
-                                                                                 include_dirs,
-                                                                                 FALSE,
-                                                                                 cb,
-                                                                                 cb_data);
+    struct MonitoringData* monitoring_data = monitoring_data_new(include_hidden,
+                                                                 include_dirs,
+                                                                 cb,
+                                                                 cb_data);
+    monitoring_data->backend = default_monitor_backend;
+    monitoring_data->building = TRUE;
+    if(default_deferred_monitors) {
+        monitoring_data->deferred_watches = deferred_watches_new();
+    }
 
     file_info_ok = vnr_file_get_file_info(uri,
                                           &vnrfile,
@@ -559,10 +1309,9 @@ GNode* create_tree_from_single_uri(char *uri,
                                           error);
 
     if(file_info_ok && vnrfile != NULL && vnrfile->is_directory) {
-        tree = vnr_file_dir_content_to_list(vnrfile,
-                                            preference_settings,
-                                            error);
-        vnr_file_set_file_monitor(tree, preference_settings);
+        tree = read_watched_directory(vnrfile,
+                                      monitoring_data,
+                                      error);
 
         tree = get_next_in_tree(tree);
 
@@ -576,10 +1325,9 @@ GNode* create_tree_from_single_uri(char *uri,
                                               error);
 
         if(file_info_ok && vnrfile != NULL) {
-            tree = vnr_file_dir_content_to_list(vnrfile,
-                                                preference_settings,
-                                                error);
-            vnr_file_set_file_monitor(tree, preference_settings);
+            tree = read_watched_directory(vnrfile,
+                                          monitoring_data,
+                                          error);
         }
 
         GNode *node = get_child_in_directory(tree, uri);
@@ -591,10 +1339,33 @@ GNode* create_tree_from_single_uri(char *uri,
         free(parent_path);
     }
 
-    free(preference_settings);
+    register_live_tree(tree);
+    monitoring_data->building = FALSE;
+    deferred_watches_start(monitoring_data);
+    monitoring_data_unref(monitoring_data);
     return tree;
 }
 
+/**
+ * Selects how file system changes are picked up in trees that are
+ * created after the call. Trees that already exist keep their backend.
+ */
+void set_monitor_backend(MonitorBackend backend) {
+    default_monitor_backend = backend;
+}
+
+/**
+ * Makes trees that are created after the call be returned before their
+ * directories are monitored, if @deferred@ is TRUE. The monitors are
+ * then created from the main loop, a few at a time, and directories
+ * that changed before they got theirs are read again, with a call to
+ * the callback for each difference. Trees that already exist are not
+ * affected.
+ */
+void set_deferred_monitors(gboolean deferred) {
+    default_deferred_monitors = deferred;
+}
+
 /**
  * Given a list of paths @uri_list@, a tree will be created and
  * returned. The paths in @uri_list@ may point to files or directories.
@@ -655,40 +1426,45 @@ GNode* create_tree_from_uri_list(GSList *uri_list,
     GList *file_list = NULL;
 
 
-    struct Preference_Settings* dir_preference_settings = create_preference_settings(include_hidden,
-                                                                                     TRUE,
-                                                                                     TRUE,
-                                                                                     cb,
-                                                                                     cb_data);
-
+    // Directories given in @uri_list@ are always included,
+    // even if their subdirectories are not.
     while(uri_list != NULL) {
 
         vnr_file_add_file_to_lists_if_possible(uri_list->data,
                                                &dir_list,
                                                &file_list,
-                                               dir_preference_settings,
+                                               include_hidden,
+                                               TRUE,
                                                error);
         g_clear_error(error);
         uri_list = g_slist_next(uri_list);
     }
 
-    struct Preference_Settings* preference_settings = create_preference_settings(include_hidden,
-                                                                                 include_dirs,
-                                                                                 TRUE,
-                                                                                 cb,
-                                                                                 cb_data);
+    struct MonitoringData* monitoring_data = monitoring_data_new(include_hidden,
+                                                                 include_dirs,
+                                                                 cb,
+                                                                 cb_data);
+    monitoring_data->backend = default_monitor_backend;
+    monitoring_data->building = TRUE;
+    if(default_deferred_monitors) {
+        monitoring_data->deferred_watches = deferred_watches_new();
+    }
     vnr_append_file_and_dir_lists_to_tree(&tree,
                                           &dir_list,
                                           &file_list,
-                                          preference_settings,
+                                          monitoring_data,
+                                          TRUE,
+                                          TRUE,
                                           error);
 
     tree = get_next_in_tree(tree);
+    register_live_tree(tree);
+    monitoring_data->building = FALSE;
+    deferred_watches_start(monitoring_data);
 
     g_list_free(dir_list);
     g_list_free(file_list);
-    free(dir_preference_settings);
-    free(preference_settings);
+    monitoring_data_unref(monitoring_data);
     return tree;
 }
 
@@ -704,13 +1480,27 @@ static gboolean is_leaf(GNode *node) {
 }
 
 static gboolean has_more_siblings_in_direction(GNode *tree, Direction direction) {
+    gint index = packed_get_index(tree);
+    if(index >= 0) {
+        return direction == RIGHT ? (guint) index + 1 < packed_get_number_of_files(tree->parent) : index > 0;
+    }
     return tree != (direction == RIGHT ? g_node_last_sibling(tree) : g_node_first_sibling(tree));
 }
 
 static GNode* get_prev_or_next(GNode* tree, Direction direction) {
+    gint index = packed_get_index(tree);
+    if(index >= 0) {
+        return packed_get_child(tree->parent, direction == RIGHT ? index + 1 : index - 1);
+    }
     return direction == RIGHT ? g_node_next_sibling(tree) : g_node_prev_sibling(tree);
 }
 static GNode* get_first_or_last(GNode* tree, Direction direction) {
+    spill_fault_in(tree);
+
+    guint packed_files = packed_get_number_of_files(tree);
+    if(packed_files > 0) {
+        return packed_get_child(tree, direction == RIGHT ? 0 : packed_files - 1);
+    }
     return direction == RIGHT ? g_node_first_child(tree) : g_node_last_child(tree);
 }
 
@@ -778,7 +1568,10 @@ static GNode* get_prev_or_next_in_tree(GNode *tree, Direction direction) {
         course = RETREAT;
     }
 
-    return recursively_find_prev_or_next(next, tree, direction, course);
+    next = recursively_find_prev_or_next(next, tree, direction, course);
+    spill_touch(next);
+    budget_touch(next);
+    return next;
 }
 
 /**
@@ -830,6 +1623,7 @@ void add_node_in_tree(GNode *tree, GNode *node) {
     if(node == NULL || node->data == NULL || tree == NULL || is_leaf(tree)) {
         return;
     }
+    packed_unpack(tree);
     GNode *child = get_first_or_last(tree, RIGHT);
 
     gboolean already_present = FALSE;
@@ -866,6 +1660,17 @@ static GNode* recursively_get_child_in_directory(GNode *tree, char* path) {
     }
     GNode *child, *dirchild;
 
+    if(spill_is_stub(tree)) {
+        // Only bring the spilled subtree back if the path can be in it.
+        if(!spill_may_contain(tree, path)) {
+            return NULL;
+        }
+        spill_fault_in(tree);
+    }
+    if(packed_get_number_of_files(tree) > 0) {
+        return packed_find_path(tree, path);
+    }
+
     if(has_children(tree)) {
         child = g_node_first_child(tree);
         dirchild = recursively_get_child_in_directory(child, path);
@@ -886,7 +1691,10 @@ static GNode* recursively_get_child_in_directory(GNode *tree, char* path) {
  * @path@. If no such node exists in the structure, NULL is returned.
  */
 GNode* get_child_in_directory(GNode *tree, char* path) {
-    return recursively_get_child_in_directory(get_root_node(tree), path);
+    GNode *child = recursively_get_child_in_directory(get_root_node(tree), path);
+    spill_touch(child);
+    budget_touch(child);
+    return child;
 }
 
 static gboolean tree_contains_path(GNode *tree, char *path) {
@@ -898,7 +1706,9 @@ static gboolean tree_contains_path(GNode *tree, char *path) {
  * (files or directories).
  */
 gboolean has_children(GNode *tree) {
-    return tree != NULL && g_node_n_children(tree) > 0;
+    return tree != NULL && (g_node_n_children(tree) > 0 ||
+                            spill_get_number_of_children(tree) > 0 ||
+                            packed_get_number_of_files(tree) > 0);
 }
 
 /**
@@ -943,6 +1753,22 @@ static void get_number_of_leaves(GNode *tree, GNode *node_to_look_for, int *curr
     if(tree == node_to_look_for) {
         *current = *total;
     }
+    if(spill_is_stub(tree)) {
+        // Count the spilled files without bringing them back.
+        *total = *total + spill_get_number_of_leaves(tree);
+        return;
+    }
+    guint packed_files = packed_get_number_of_files(tree);
+    if(packed_files > 0) {
+        if(node_to_look_for != NULL && node_to_look_for->parent == tree) {
+            gint index = packed_get_index(node_to_look_for);
+            if(index >= 0) {
+                *current = *total + index + 1;
+            }
+        }
+        *total = *total + packed_files;
+        return;
+    }
 
     GNode *child = get_first_or_last(tree, RIGHT);
     while(child != NULL) {
@@ -995,8 +1821,165 @@ GNode* get_root_node(GNode *tree) {
 }
 
 
+static gboolean add_node_memory_usage(GNode *node, gpointer data) {
+    struct MemoryUsage *usage = data;
+    usage->nodes += sizeof(GNode);
+    vnr_file_add_memory_usage(node->data, usage);
+    spill_add_memory_usage(node, usage);
+    packed_add_memory_usage(node, usage);
+    return FALSE;
+}
+
+static void add_tree_memory_usage(GNode *root, struct MemoryUsage *usage) {
+    g_node_traverse(root, G_PRE_ORDER, G_TRAVERSE_ALL, -1, add_node_memory_usage, usage);
+
+    // Shared by all monitored nodes of the tree.
+    struct MonitoringData *monitoring_data = get_monitoring_data(root);
+    if(monitoring_data != NULL) {
+        usage->monitoring_data += sizeof(struct MonitoringData);
+        entry_index_add_memory_usage(monitoring_data->entry_index, usage);
+        inotify_add_memory_usage(monitoring_data->inotify, usage);
+        fanotify_add_memory_usage(monitoring_data->fanotify, usage);
+        budget_add_memory_usage(monitoring_data->watch_budget, usage);
+        subscribers_add_memory_usage(monitoring_data->subscribers, usage);
+    }
+}
+
+static void sum_memory_usage(struct MemoryUsage *usage) {
+    usage->total = usage->nodes +
+                   usage->files +
+                   usage->paths +
+                   usage->display_names +
+                   usage->collate_keys +
+                   usage->monitors +
+                   usage->monitoring_data +
+                   usage->indexes;
+}
+
+static gboolean find_monitoring_data(GNode *node, gpointer data) {
+    struct MonitoringData **monitoring_data = data;
+    VnrFile *vnrfile = node->data;
+
+    if(vnrfile != NULL && vnrfile->monitoring_data != NULL) {
+        *monitoring_data = vnrfile->monitoring_data;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Returns the monitoring settings that are shared by all monitored
+ * files and directories in the tree that @tree@ is part of, or NULL if
+ * nothing in the tree is monitored. Changing the settings will affect
+ * how all subsequent file system changes in the tree are handled.
+ */
+struct MonitoringData* get_monitoring_data(GNode *tree) {
+    struct MonitoringData *monitoring_data = NULL;
+    GNode *root = get_root_node(tree);
+
+    if(root != NULL) {
+        g_node_traverse(root, G_PRE_ORDER, G_TRAVERSE_ALL, -1, find_monitoring_data, &monitoring_data);
+    }
+    return monitoring_data;
+}
+
+/**
+ * Moves to the topmost root of @tree@ and places the number of bytes
+ * used by the whole structure in @usage@, broken down by the kind of
+ * data. The sum of all kinds is placed in the total.
+ */
+void get_tree_memory_usage(GNode *tree, struct MemoryUsage *usage) {
+    memset(usage, 0, sizeof(*usage));
+
+    GNode *root = get_root_node(tree);
+    if(root != NULL) {
+        add_tree_memory_usage(root, usage);
+    }
+    sum_memory_usage(usage);
+}
+
+/**
+ * Places the number of bytes used by all trees that have been created
+ * and not yet freed in @usage@, broken down by the kind of data.
+ */
+void get_total_memory_usage(struct MemoryUsage *usage) {
+    GHashTableIter iter;
+    gpointer root;
+
+    memset(usage, 0, sizeof(*usage));
+
+    G_LOCK(live_trees);
+    if(live_trees != NULL) {
+        g_hash_table_iter_init(&iter, live_trees);
+        while(g_hash_table_iter_next(&iter, &root, NULL)) {
+            // A tree that has been added into another tree is counted
+            // as part of that tree.
+            if(((GNode*) root)->parent == NULL) {
+                add_tree_memory_usage(root, usage);
+            }
+        }
+    }
+    G_UNLOCK(live_trees);
+
+    sum_memory_usage(usage);
+}
+
+
+/*
+ * Makes *@node@ be set to NULL if the node is freed, until
+ * node_unguard is called. For loops that call callbacks, which may
+ * free the tree.
+ */
+void node_guard(GNode **node) {
+    G_LOCK(guarded_nodes);
+    g_atomic_pointer_set(&guarded_nodes, g_slist_prepend(guarded_nodes, node));
+    G_UNLOCK(guarded_nodes);
+}
+
+void node_unguard(GNode **node) {
+    G_LOCK(guarded_nodes);
+    g_atomic_pointer_set(&guarded_nodes, g_slist_remove(guarded_nodes, node));
+    G_UNLOCK(guarded_nodes);
+}
+
+static void guards_forget(GNode *node) {
+    // Guards are taken by the thread that may free the node, so one
+    // that matters cannot be added meanwhile.
+    if(g_atomic_pointer_get(&guarded_nodes) == NULL) {
+        return;
+    }
+    G_LOCK(guarded_nodes);
+    for(GSList *it = guarded_nodes; it != NULL; it = it->next) {
+        GNode **guarded = it->data;
+        if(*guarded == node) {
+            *guarded = NULL;
+        }
+    }
+    G_UNLOCK(guarded_nodes);
+}
+
 static gboolean destroy_node(GNode *node, gpointer data) {
     UNUSED(data);
+    guards_forget(node);
+    // Only roots are registered. A tree may have been added into
+    // another one since, but files are never roots.
+    if(node->parent == NULL || vnr_file_is_directory(node->data)) {
+        unregister_live_tree(node);
+    }
+    spill_forget(node);
+    packed_forget(node);
+    inotify_forget(node);
+    fanotify_forget(node);
+    budget_forget(node);
+    events_forget(node);
+    changes_forget(node);
+    worker_forget(node);
+    deferred_forget(node);
+    registry_forget(node);
+    mounts_forget(node);
+    burst_forget(node);
+    subscribers_forget(node);
+    entry_index_forget(node);
     vnr_file_destroy_data(node->data);
     return FALSE;
 }
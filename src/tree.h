@@ -132,6 +132,68 @@ GNode* create_tree_from_uri_list(GSList *uri_list,
                                  gpointer cb_data,
                                  GError **error);
 
+/**
+ * Selects how file system changes are picked up in trees that are
+ * created after the call. Trees that already exist keep their backend.
+ */
+void set_monitor_backend(MonitorBackend backend);
+
+/**
+ * Makes trees that are created after the call be returned before their
+ * directories are monitored, if @deferred@ is TRUE. The monitors are
+ * then created from the main loop, a few at a time, and directories
+ * that changed before they got theirs are read again, with a call to
+ * the callback for each difference. Trees that already exist are not
+ * affected.
+ */
+void set_deferred_monitors(gboolean deferred);
+
+/**
+ * Makes trees that are created after the call start from a snapshot in
+ * @directory@, written by save_snapshot, instead of reading all their
+ * directories. Only snapshots of the same directory with the same
+ * settings are used. The monitors are then created from the main loop,
+ * as with set_deferred_monitors, and the directories that have changed
+ * since the snapshot was written are read again, with a call to the
+ * callback for each difference. A @directory@ of NULL turns snapshots
+ * off.
+ */
+void set_snapshot_directory(const char *directory);
+
+/**
+ * Writes a snapshot of the tree that @tree@ is part of to the directory
+ * given to set_snapshot_directory, replacing any earlier snapshot of
+ * it. For a tree created from a uri-list, every directory in the list
+ * gets a snapshot of its own. Directories with changes that have been
+ * picked up but not yet applied are read again when the snapshot is
+ * used.
+ * Returns FALSE, with @error@ set, if a snapshot could not be written,
+ * and also if no snapshot directory has been set or nothing in the tree
+ * is monitored.
+ */
+gboolean save_snapshot(GNode *tree, GError **error);
+
+/**
+ * Makes whether files are images of a supported type be remembered in
+ * the file @path@, so that files that have not changed since are not
+ * looked into again when they are read into a tree. What @path@ holds
+ * is read by the call, and written by save_classification_cache. A
+ * @path@ of NULL turns the cache off.
+ * Returns FALSE, with @error@ set, if @path@ exists but could not be
+ * read. The cache then starts out empty.
+ */
+gboolean set_classification_cache(const char *path, GError **error);
+
+/**
+ * Writes what is remembered to the file given to
+ * set_classification_cache, replacing what it held. Files that have
+ * been read into a tree since the cache was set are kept before others
+ * if there are too many to keep.
+ * Returns FALSE, with @error@ set, if the file could not be written,
+ * and also if no cache has been set.
+ */
+gboolean save_classification_cache(GError **error);
+
 
 /**
  * Adds @node@ as a child of @tree@, sorted by @display_name_collate@.
@@ -218,6 +280,276 @@ gboolean has_more_siblings(GNode *tree);
 GNode* get_root_node(GNode *tree);
 
 
+/**
+ * Returns the monitoring settings that are shared by all monitored
+ * files and directories in the tree that @tree@ is part of, or NULL if
+ * nothing in the tree is monitored. Changing the settings will affect
+ * how all subsequent file system changes in the tree are handled.
+ */
+struct MonitoringData* get_monitoring_data(GNode *tree);
+
+/**
+ * Enables out-of-core mode for the tree that @tree@ is part of. Every
+ * @idle_seconds@ seconds, the directories that have not been visited
+ * for @idle_seconds@ will have their children written to a memory
+ * mapped backing file and freed. The directory stays in the tree, and
+ * its children are read back as soon as navigation or
+ * get_child_in_directory enters it. Positions and totals of files are
+ * reported as before, without reading anything back.
+ *
+ * Nodes below a spilled directory are freed, so pointers to them must
+ * not be kept. The nodes last returned by navigation and
+ * get_child_in_directory, and those of subscribers, are never freed
+ * this way. Changes on disk in subdirectories of a spilled directory
+ * are picked up when it is read back, without calls to the callback.
+ *
+ * Returns FALSE and sets @error@ if the backing file could not be
+ * created.
+ */
+gboolean enable_out_of_core_mode(GNode *tree, guint idle_seconds, GError **error);
+
+/**
+ * Spills the directories of the tree that @tree@ is part of that have
+ * not been visited within the time given to enable_out_of_core_mode.
+ * Returns the number of directories that were spilled.
+ */
+guint spill_cold_subtrees(GNode *tree);
+
+/**
+ * Reads back everything that has been spilled in the tree that @tree@
+ * is part of and disables out-of-core mode for it.
+ */
+void disable_out_of_core_mode(GNode *tree);
+
+
+/**
+ * Goes through the tree that @tree@ is part of, and stores the files of
+ * every directory that has at least @minimum_number_of_files@ files and
+ * no subdirectories in a packed array instead of as separate nodes.
+ * Nodes for the files are created again when they are needed; nodes
+ * that have been returned by navigation or get_child_in_directory stay
+ * valid. A directory is turned back into ordinary nodes when a file is
+ * added to or removed from it.
+ * Returns the number of directories that were packed.
+ */
+guint pack_file_only_directories(GNode *tree, guint minimum_number_of_files);
+
+/**
+ * Turns every packed directory in the tree that @tree@ is part of back
+ * into ordinary nodes.
+ */
+void unpack_directories(GNode *tree);
+
+
+/**
+ * Makes the tree that @tree@ is part of report files and directories
+ * that are moved or renamed within the tree through @cb@, instead of
+ * as a removal and an addition through the callback given when the
+ * tree was created. The moved node is kept, along with the nodes below
+ * it. Setting @cb@ to NULL goes back to a removal and an addition.
+ * Change sets, if used, report moves in their own list.
+ * With the fanotify backend, moves are only reported as such on Linux
+ * 5.17 and later; before that, they are a removal and an addition.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_moved_callback(GNode *tree, moved_callback cb, gpointer cb_data);
+
+/**
+ * Makes the tree that @tree@ is part of report file system changes
+ * through @cb@, which is given all changes since the previous call at
+ * once, instead of through the callback given when the tree was
+ * created. With a @window_ms@ of 0, the changes are handed over when
+ * the main loop is next idle; otherwise, they are collected for
+ * @window_ms@ milliseconds after the first of them.
+ * Setting @cb@ to NULL hands over what has been collected and goes back
+ * to the callback given when the tree was created.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_change_set_callback(GNode *tree, change_set_callback cb, gpointer cb_data, guint window_ms);
+
+/**
+ * Calls @cb@ for the changes of the kinds in @events@, a combination
+ * of TreeEvent values, to @subtree@ and the files and directories
+ * below it. It is called in addition to the callback given when the
+ * tree was created, also when change sets are used, and right after
+ * it.
+ * The subscription ends when @subtree@ is removed from the tree; @cb@
+ * is then called for that removal if @events@ has TREE_EVENT_REMOVED.
+ * Returns an id for remove_subscriber, or 0 if nothing in the tree is
+ * monitored.
+ */
+guint add_subscriber(GNode *subtree, guint events, subscriber_callback cb, gpointer cb_data);
+
+/**
+ * Ends the subscription with the id @id@, made by add_subscriber on a
+ * node in the tree that @tree@ is part of. It may be called from a
+ * callback. Returns FALSE if there is no such subscription.
+ */
+gboolean remove_subscriber(GNode *tree, guint id);
+
+
+/**
+ * Makes the tree that @tree@ is part of hold back created, changed and
+ * deleted events for a path until no event has arrived for it in
+ * @delay_ms@ milliseconds, and then apply them as one. A path that
+ * keeps changing is applied after ten times the delay at the latest.
+ * A file that is created and deleted again within the delay is never
+ * added, and the callback is not called for it.
+ * A @delay_ms@ of 0 applies all held back events and turns coalescing
+ * off.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_event_coalescing(GNode *tree, guint delay_ms);
+
+/**
+ * Makes the tree that @tree@ is part of apply file system changes from
+ * an idle source, spending at most about @budget_ms@ milliseconds on
+ * them per main loop iteration, instead of all at once as they arrive.
+ * A burst of thousands of changes is then spread over many iterations,
+ * and the main loop keeps running in between. The tree is changed one
+ * whole change at a time, so it can be used between iterations. Works
+ * together with set_event_coalescing; changes that are held back are
+ * applied within the budget once their time has come.
+ * A @budget_ms@ of 0 applies all queued changes and turns the budget
+ * off.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_event_time_budget(GNode *tree, guint budget_ms);
+
+/**
+ * Makes the tree that @tree@ is part of stop applying the changes of a
+ * directory one by one once more than @events_per_second@ of them
+ * arrive for it within a second. The directory is instead read again
+ * when no change has arrived for it in a quarter of a second, and the
+ * callback is called for every difference from what the tree has.
+ * Changes to other directories are applied as usual. Moves within the
+ * tree are always applied, so their nodes are kept.
+ * An @events_per_second@ of 0 turns the detection off; directories in
+ * the middle of a burst are then read right away.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_burst_threshold(GNode *tree, guint events_per_second);
+
+
+/**
+ * Limits the tree that @tree@ is part of to @max_watches@ watched
+ * directories. The directories that were visited least recently lose
+ * their watch first, and get it back when navigation enters them.
+ * Directories without a watch, including those for which no watch
+ * could be created, are checked about every @poll_interval_seconds@
+ * seconds and read again if their modification time has changed, so
+ * changes are still reported, only later. A directory that keeps
+ * changing is checked more often, down to every second, and one that
+ * does not is checked less often, down to every eighth interval.
+ * A @max_watches@ of 0 removes the limit; directories that already
+ * lost their watch keep being polled until they are visited.
+ * Returns FALSE if the tree contains no directories.
+ */
+gboolean set_watch_budget(GNode *tree, guint max_watches, guint poll_interval_seconds);
+
+/**
+ * Brings the tree that @tree@ is part of up to date with the file
+ * system, for when changes may have gone unreported. This happens on
+ * its own when the event queue of the inotify or fanotify backend
+ * overflows; GIO does not tell.
+ * Only directories that have been modified since the tree was last
+ * known to be up to date are read again. Each difference is reported
+ * like any other change.
+ * Returns the number of changes.
+ */
+guint reconcile_tree(GNode *tree);
+
+/**
+ * Starts a thread for the tree that @tree@ is part of, on which the
+ * file system is read when a change adds something to the tree. For a
+ * new directory, that means reading everything in it. The result is
+ * put in the tree, and the callback called, on the thread that created
+ * the tree, when its main context is next run. Changes are therefore
+ * reported later than without the thread, but the thread that created
+ * the tree is not held up by the reading.
+ * The thread runs until the tree is freed.
+ * Returns FALSE if nothing in the tree is monitored or the thread could
+ * not be started.
+ */
+gboolean set_monitor_thread(GNode *tree);
+
+/**
+ * Makes the tree that @tree@ is part of keep statistics on how file
+ * system changes are handled, or stop keeping them if @enabled@ is
+ * FALSE. Enabling them again starts over from zero.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_monitor_statistics(GNode *tree, gboolean enabled);
+
+/**
+ * Makes the tree that @tree@ is part of only get files added by file
+ * system changes once they have been completely written, if @enabled@
+ * is TRUE. A file is then added when it is closed after being written
+ * to, or when it is moved or renamed into a monitored directory, but
+ * not while it is being written. Files with names that are commonly
+ * used while writing, such as "photo.jpg.part" or "photo.jpg~", are
+ * not added until they are renamed. New directories are added right
+ * away. Files found when reading a directory are always added.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_complete_files_only(GNode *tree, gboolean enabled);
+
+/**
+ * Places the statistics of the tree that @tree@ is part of in
+ * @statistics@. Returns FALSE, leaving @statistics@ untouched, if the
+ * tree keeps none.
+ */
+gboolean get_monitor_statistics(GNode *tree, struct MonitorStatistics *statistics);
+
+/**
+ * Returns the smallest value, in microseconds, that at least
+ * @percentile@ percent of the values in @histogram@ are at or below,
+ * rounded up to the end of its bucket. Returns 0 for an empty
+ * histogram.
+ */
+guint64 latency_histogram_get_percentile(const struct LatencyHistogram *histogram, gdouble percentile);
+
+
+/**
+ * Moves the strings of all files in the tree that @tree@ is part of
+ * into one newly allocated block, in traversal order, and frees the
+ * old copies. Nodes and files keep their addresses, but the path,
+ * display name and collate key of every file are moved, so pointers to
+ * them must not be kept across the call. Files of packed directories
+ * are already stored together and are left alone, as are spilled
+ * directories.
+ * Returns the number of bytes of strings that were moved.
+ */
+gsize compact_tree(GNode *tree);
+
+/**
+ * Makes the tree that @tree@ is part of compact itself, as with
+ * compact_tree, once the number of files and directories that have
+ * been added or removed by file system changes since the last
+ * compaction reaches @changed_percentage@ percent of the number of
+ * nodes in the tree at that time, or once the strings of removed and
+ * renamed files make up @changed_percentage@ percent of the block made
+ * by the last compaction.
+ * A @changed_percentage@ of 0 turns automatic compaction off.
+ * Returns FALSE if nothing in the tree is monitored.
+ */
+gboolean set_automatic_compaction(GNode *tree, guint changed_percentage);
+
+
+/**
+ * Moves to the topmost root of @tree@ and places the number of bytes
+ * used by the whole structure in @usage@, broken down by the kind of
+ * data. The sum of all kinds is placed in the total.
+ */
+void get_tree_memory_usage(GNode *tree, struct MemoryUsage *usage);
+
+/**
+ * Places the number of bytes used by all trees that have been created
+ * and not yet freed in @usage@, broken down by the kind of data.
+ */
+void get_total_memory_usage(struct MemoryUsage *usage);
+
+
 /**
  * Frees @tree@. If it is a sub-tree, the rest of the tree will be left
  * alone. Traverses the whole of @tree@ and destroys the nodes as well.
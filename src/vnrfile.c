@@ -19,8 +19,10 @@
  */
 
 #include "vnrfile.h"
+#include "tree-internal.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #define UNUSED(x) (void)(x)
 
@@ -64,20 +66,61 @@ VnrFile* vnr_file_create_new(gchar *path,
     return vnrfile;
 }
 
+/* Like vnr_file_create_new, but without computing the collate key. */
+VnrFile* vnr_file_create_with_collate_key(gchar *path,
+                                          char *display_name,
+                                          const char *display_name_collate,
+                                          gboolean is_directory)
+{
+    VnrFile *vnrfile = vnr_file_new();
+    vnrfile->path = g_strdup(path);
+    vnrfile->is_directory = is_directory;
+    vnrfile->display_name = g_strdup(display_name);
+    vnrfile->display_name_collate = g_strdup(display_name_collate);
+    return vnrfile;
+}
+
+/*
+ * Gives @vnrfile@ a new @path@ and, unless @display_name@ is NULL, a
+ * new display name.
+ */
+void vnr_file_rename(VnrFile *vnrfile, const char *path, const char *display_name) {
+    char *new_path = g_strdup(path);
+    char *new_display_name = g_strdup(display_name != NULL ? display_name : vnrfile->display_name);
+    char *new_display_name_collate = display_name != NULL ?
+                                     g_utf8_collate_key_for_filename(new_display_name, -1) :
+                                     g_strdup(vnrfile->display_name_collate);
+
+    if(vnrfile->arena != NULL) {
+        string_arena_release(vnrfile);
+    } else {
+        g_free(vnrfile->path);
+        g_free(vnrfile->display_name);
+        g_free((gpointer) vnrfile->display_name_collate);
+    }
+    vnrfile->path = new_path;
+    vnrfile->display_name = new_display_name;
+    vnrfile->display_name_collate = new_display_name_collate;
+}
+
 void vnr_file_destroy_data(VnrFile *vnrfile) {
     if(vnrfile == NULL) {
         return;
     }
-    if(vnrfile->monitoring_data != NULL) {
-        free(vnrfile->monitoring_data);
-    }
     if(vnrfile->monitor != NULL) {
         g_file_monitor_cancel(vnrfile->monitor);
         g_object_unref(vnrfile->monitor);
     }
-    g_free(vnrfile->path);
-    g_free(vnrfile->display_name);
-    g_free((gpointer) vnrfile->display_name_collate);
+    if(vnrfile->monitoring_data != NULL) {
+        monitoring_data_unref(vnrfile->monitoring_data);
+    }
+    if(vnrfile->arena != NULL) {
+        string_arena_release(vnrfile);
+    } else {
+        g_free(vnrfile->path);
+        g_free(vnrfile->display_name);
+        g_free((gpointer) vnrfile->display_name_collate);
+    }
     g_object_unref(vnrfile);
 }
 
@@ -88,3 +131,98 @@ gboolean vnr_file_is_directory(VnrFile* vnrfile) {
 gboolean vnr_file_is_image_file(VnrFile* vnrfile) {
     return vnrfile != NULL && !vnrfile->is_directory;
 }
+
+static gsize string_size(const gchar *str) {
+    return str == NULL ? 0 : strlen(str) + 1;
+}
+
+static gsize object_size(gpointer object) {
+    GTypeQuery query;
+    g_type_query(G_OBJECT_TYPE(object), &query);
+    return query.instance_size;
+}
+
+/**
+ * Adds the number of bytes used by @vnrfile@ and the data it owns to
+ * the corresponding fields of @usage@. The total is left untouched.
+ */
+void vnr_file_add_memory_usage(VnrFile* vnrfile, struct MemoryUsage *usage) {
+    if(vnrfile == NULL) {
+        return;
+    }
+    usage->files         += sizeof(VnrFile);
+    usage->paths         += string_size(vnrfile->path);
+    usage->display_names += string_size(vnrfile->display_name);
+    usage->collate_keys  += string_size(vnrfile->display_name_collate);
+
+    if(vnrfile->monitor != NULL) {
+        usage->monitors += object_size(vnrfile->monitor);
+    }
+}
+
+
+struct MonitoringData* monitoring_data_new(gboolean include_hidden,
+                                           gboolean include_dirs,
+                                           callback cb,
+                                           gpointer cb_data)
+{
+    struct MonitoringData* monitoring_data = malloc(sizeof(*monitoring_data));
+    monitoring_data->include_hidden = include_hidden;
+    monitoring_data->include_dirs = include_dirs;
+    monitoring_data->cb = cb;
+    monitoring_data->cb_data = cb_data;
+    monitoring_data->moved_cb = NULL;
+    monitoring_data->moved_cb_data = NULL;
+    monitoring_data->ref_count = 1;
+    monitoring_data->backend = MONITOR_BACKEND_GIO;
+    monitoring_data->spill_store = NULL;
+    monitoring_data->inotify = NULL;
+    monitoring_data->fanotify = NULL;
+    monitoring_data->watch_budget = NULL;
+    monitoring_data->pending_events = NULL;
+    monitoring_data->change_sets = NULL;
+    monitoring_data->worker = NULL;
+    monitoring_data->stats = NULL;
+    monitoring_data->deferred_watches = NULL;
+    monitoring_data->complete_files_only = FALSE;
+    monitoring_data->building = FALSE;
+    monitoring_data->mounts = NULL;
+    monitoring_data->bursts = NULL;
+    monitoring_data->subscribers = NULL;
+    monitoring_data->entry_index = NULL;
+    monitoring_data->compaction_threshold = 0;
+    monitoring_data->nodes_at_compaction = 0;
+    monitoring_data->nodes_changed = 0;
+    monitoring_data->string_arena = NULL;
+    // Created before anything is read, so nothing earlier is missed.
+    monitoring_data->in_sync_since = g_get_real_time() * 1000;
+    monitoring_data->reconcile_source_id = 0;
+    monitoring_data->reconcile_root = NULL;
+    return monitoring_data;
+}
+
+struct MonitoringData* monitoring_data_ref(struct MonitoringData *monitoring_data) {
+    g_atomic_int_inc(&monitoring_data->ref_count);
+    return monitoring_data;
+}
+
+void monitoring_data_unref(struct MonitoringData *monitoring_data) {
+    if(monitoring_data != NULL && g_atomic_int_dec_and_test(&monitoring_data->ref_count)) {
+        spill_store_free(monitoring_data->spill_store);
+        inotify_watches_free(monitoring_data->inotify);
+        fanotify_watches_free(monitoring_data->fanotify);
+        budget_free(monitoring_data->watch_budget);
+        events_free(monitoring_data->pending_events);
+        changes_free(monitoring_data->change_sets);
+        worker_free(monitoring_data->worker);
+        stats_free(monitoring_data->stats);
+        deferred_watches_free(monitoring_data->deferred_watches);
+        mounts_free(monitoring_data->mounts);
+        burst_free(monitoring_data->bursts);
+        subscribers_free(monitoring_data->subscribers);
+        entry_index_free(monitoring_data->entry_index);
+        string_arena_unref(monitoring_data->string_arena);
+        reconcile_cancel(monitoring_data);
+        free(monitoring_data);
+    }
+}
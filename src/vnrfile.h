@@ -39,6 +39,9 @@ G_BEGIN_DECLS
 typedef struct _VnrFile VnrFile;
 typedef struct _VnrFileClass VnrFileClass;
 
+struct PackedDirectory;
+struct StringArena;
+
 
 struct _VnrFile {
     GObject parent;
@@ -46,9 +49,14 @@ struct _VnrFile {
     gchar *display_name;
     const gchar *display_name_collate;
     gchar *path;
+    // The block holding the strings above, if the tree has been compacted.
+    struct StringArena *arena;
 
     gboolean is_directory;
 
+    gint64 last_visited;
+    struct PackedDirectory *packed;
+
     GFileMonitor *monitor;
     struct MonitoringData *monitoring_data;
 };
@@ -57,6 +65,22 @@ struct _VnrFileClass {
     GObjectClass parent;
 };
 
+/**
+ * Byte totals for the structures that make up a tree. Only the
+ * requested sizes are counted, not the overhead of the allocator.
+ */
+struct MemoryUsage {
+    gsize nodes;
+    gsize files;
+    gsize paths;
+    gsize display_names;
+    gsize collate_keys;
+    gsize monitors;
+    gsize monitoring_data;
+    gsize indexes;
+    gsize total;
+};
+
 GType   vnr_file_get_type   (void) G_GNUC_CONST;
 
 /* Constructors */
@@ -67,9 +91,25 @@ VnrFile*
 vnr_file_create_new(gchar *path,
                     char *display_name,
                     gboolean is_directory);
+VnrFile*
+vnr_file_create_with_collate_key(gchar *path,
+                                 char *display_name,
+                                 const char *display_name_collate,
+                                 gboolean is_directory);
+void     vnr_file_rename       (VnrFile* vnrfile,
+                                const char *path,
+                                const char *display_name);
 void     vnr_file_destroy_data (VnrFile* vnrfile);
 gboolean vnr_file_is_directory (VnrFile* vnrfile);
 gboolean vnr_file_is_image_file(VnrFile* vnrfile);
+void     vnr_file_add_memory_usage(VnrFile* vnrfile, struct MemoryUsage *usage);
+
+struct MonitoringData* monitoring_data_new  (gboolean include_hidden,
+                                             gboolean include_dirs,
+                                             callback cb,
+                                             gpointer cb_data);
+struct MonitoringData* monitoring_data_ref  (struct MonitoringData *monitoring_data);
+void                   monitoring_data_unref(struct MonitoringData *monitoring_data);
 
 
 G_END_DECLS
@@ -0,0 +1,362 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+#include "tree-internal.h"
+
+#define UNUSED(x) (void)(x)
+
+/*
+ * The monitor thread. Reading what a file system change added, which
+ * for a new directory means reading everything in it, is done on a
+ * thread with a main context of its own. The prepared nodes are handed
+ * back over a lock-free stack, and only putting them in the tree,
+ * creating their monitors and calling the callback is left to the
+ * thread that owns the tree.
+ */
+
+struct WorkerJob {
+    struct WorkerJob *next;
+    struct MonitorWorker *worker;
+    char *path;
+    // The directory to add to. Only touched by the owning thread; NULL
+    // when the addition has been called off.
+    GNode *dir;
+    // Written by the worker thread. For a directory, its modification
+    // time from before it was read, and when it was read.
+    GNode *node;
+    gint64 mtime;
+    gint64 read_at;
+    // When the event that led to the job was received, for the
+    // statistics.
+    gint64 received;
+};
+
+struct MonitorWorker {
+    struct MonitoringData *monitoring_data;
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *loop;
+
+    // In the context of the owning thread; made ready by the worker
+    // thread when there are prepared jobs.
+    GMainContext *owner_context;
+    GSource *wakeup;
+
+    // Prepared jobs, pushed by the worker thread and taken by the
+    // owning thread.
+    struct WorkerJob *prepared;
+
+    // Path -> job, for all jobs not yet taken care of. Only touched by
+    // the owning thread.
+    GHashTable *jobs;
+};
+
+
+static gint64 now_ns() {
+    return g_get_real_time() * 1000;
+}
+
+static void free_job(struct WorkerJob *job) {
+    if(job->node != NULL) {
+        free_current_tree(job->node);
+    }
+    g_free(job->path);
+    g_free(job);
+}
+
+static gpointer run_worker(gpointer data) {
+    struct MonitorWorker *worker = data;
+
+    g_main_context_push_thread_default(worker->context);
+    g_main_loop_run(worker->loop);
+    g_main_context_pop_thread_default(worker->context);
+    return NULL;
+}
+
+static gboolean quit_worker(gpointer data) {
+    g_main_loop_quit(data);
+    return G_SOURCE_REMOVE;
+}
+
+/* Runs on the worker thread. */
+static gboolean prepare_job(gpointer data) {
+    struct WorkerJob *job = data;
+    struct MonitorWorker *worker = job->worker;
+    struct WorkerJob *head;
+
+    job->mtime = vnr_file_get_mtime(job->path);
+    job->read_at = now_ns();
+    job->node = vnr_file_prepare_node(job->path, worker->monitoring_data);
+
+    do {
+        head = g_atomic_pointer_get(&worker->prepared);
+        job->next = head;
+    } while(!g_atomic_pointer_compare_and_exchange(&worker->prepared, head, job));
+
+    g_source_set_ready_time(worker->wakeup, 0);
+    return G_SOURCE_REMOVE;
+}
+
+static struct WorkerJob* take_prepared(struct MonitorWorker *worker) {
+    struct WorkerJob *head, *reversed = NULL;
+
+    do {
+        head = g_atomic_pointer_get(&worker->prepared);
+    } while(!g_atomic_pointer_compare_and_exchange(&worker->prepared, head, NULL));
+
+    // Oldest first.
+    while(head != NULL) {
+        struct WorkerJob *next = head->next;
+        head->next = reversed;
+        reversed = head;
+        head = next;
+    }
+    return reversed;
+}
+
+/*
+ * Whether the directory of @job@ might have changed between being read
+ * and getting its monitor. As with the deferred watches, a change in
+ * the same tick as the reading does not show in the modification time.
+ */
+static gboolean needs_catch_up(struct WorkerJob *job) {
+    gint64 mtime = vnr_file_get_mtime(job->path);
+    return mtime != job->mtime || mtime >= job->read_at - MTIME_SLACK_NS;
+}
+
+/* Runs on the owning thread. */
+static gboolean splice_prepared(gpointer data) {
+    struct MonitoringData *monitoring_data = data;
+    struct MonitorWorker *worker = monitoring_data->worker;
+    struct WorkerJob *job, *next;
+
+    g_source_set_ready_time(worker->wakeup, -1);
+
+    // The callbacks may free the tree; the jobs that remain are still
+    // found by worker_forget until they have been dealt with.
+    monitoring_data_ref(monitoring_data);
+
+    for(job = take_prepared(worker); job != NULL; job = next) {
+        next = job->next;
+        g_hash_table_remove(worker->jobs, job->path);
+
+        if(job->dir != NULL && job->node != NULL) {
+            GNode *node = job->node;
+            job->node = NULL;
+            stats_apply_resume(monitoring_data, job->received);
+            // Freed if it is in the tree already, or by the callbacks.
+            node_guard(&node);
+            vnr_file_splice_node(job->dir, node);
+            if(node != NULL && vnr_file_is_directory(node->data) && needs_catch_up(job)) {
+                vnr_file_directory_rescan(node);
+            }
+            node_unguard(&node);
+            stats_apply_end(monitoring_data);
+        }
+        free_job(job);
+    }
+
+    monitoring_data_unref(monitoring_data);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean dispatch_wakeup(GSource *source, GSourceFunc callback, gpointer data) {
+    UNUSED(source);
+    return callback(data);
+}
+
+static GSourceFuncs wakeup_funcs = {
+    .dispatch = dispatch_wakeup,
+};
+
+
+/*
+ * Hands the addition of @path@ to the directory @dir@ to the monitor
+ * thread, if the tree has one. Returns FALSE if it does not, in which
+ * case the caller adds it itself.
+ */
+gboolean worker_submit(GNode *dir, char *path) {
+    struct MonitoringData *monitoring_data = ((VnrFile*) dir->data)->monitoring_data;
+    struct MonitorWorker *worker = monitoring_data == NULL ? NULL : monitoring_data->worker;
+
+    if(worker == NULL) {
+        return FALSE;
+    }
+
+    struct WorkerJob *job = g_hash_table_lookup(worker->jobs, path);
+    if(job != NULL) {
+        // Already on its way; it might have been called off meanwhile.
+        job->dir = dir;
+        return TRUE;
+    }
+
+    job = g_new0(struct WorkerJob, 1);
+    job->worker = worker;
+    job->path = g_strdup(path);
+    job->dir = dir;
+    job->received = stats_current_received(monitoring_data);
+    g_hash_table_insert(worker->jobs, job->path, job);
+
+    GSource *source = g_idle_source_new();
+    g_source_set_callback(source, prepare_job, job, NULL);
+    g_source_attach(source, worker->context);
+    g_source_unref(source);
+    return TRUE;
+}
+
+/*
+ * Calls off the addition of @path@, if it is on its way. Called when
+ * @path@ is removed from the tree.
+ */
+void worker_cancel(struct MonitoringData *monitoring_data, char *path) {
+    struct MonitorWorker *worker = monitoring_data->worker;
+    struct WorkerJob *job = worker == NULL ? NULL : g_hash_table_lookup(worker->jobs, path);
+
+    if(job != NULL) {
+        job->dir = NULL;
+    }
+}
+
+/*
+ * Calls off the additions to @node@. Called when the node is destroyed.
+ */
+void worker_forget(GNode *node) {
+    VnrFile *vnrfile = node->data;
+    struct MonitorWorker *worker;
+    GHashTableIter iter;
+    gpointer job;
+
+    // Only directories are added to.
+    if(vnrfile == NULL || !vnrfile->is_directory || vnrfile->monitoring_data == NULL) {
+        return;
+    }
+    worker = vnrfile->monitoring_data->worker;
+    if(worker == NULL || g_hash_table_size(worker->jobs) == 0) {
+        return;
+    }
+    g_hash_table_iter_init(&iter, worker->jobs);
+    while(g_hash_table_iter_next(&iter, NULL, &job)) {
+        if(((struct WorkerJob*) job)->dir == node) {
+            ((struct WorkerJob*) job)->dir = NULL;
+        }
+    }
+}
+
+/*
+ * Stops the monitor thread and frees @worker@. Additions that have not
+ * been put in the tree yet are dropped. Called when the monitoring
+ * data is freed.
+ */
+/*
+ * Adds the directories that have additions still being read to the set
+ * @dirs@.
+ */
+void worker_add_busy_directories(struct MonitoringData *monitoring_data, GHashTable *dirs) {
+    GHashTableIter iter;
+    gpointer job;
+
+    if(monitoring_data->worker == NULL) {
+        return;
+    }
+    g_hash_table_iter_init(&iter, monitoring_data->worker->jobs);
+    while(g_hash_table_iter_next(&iter, NULL, &job)) {
+        if(((struct WorkerJob*) job)->dir != NULL) {
+            g_hash_table_add(dirs, ((struct WorkerJob*) job)->dir);
+        }
+    }
+}
+
+void worker_free(struct MonitorWorker *worker) {
+    GHashTableIter iter;
+    gpointer job;
+
+    if(worker == NULL) {
+        return;
+    }
+    // Through the context, since the loop may not be running yet.
+    g_main_context_invoke_full(worker->context, G_PRIORITY_HIGH, quit_worker, worker->loop, NULL);
+    g_thread_join(worker->thread);
+
+    g_source_destroy(worker->wakeup);
+    g_source_unref(worker->wakeup);
+
+    g_hash_table_iter_init(&iter, worker->jobs);
+    while(g_hash_table_iter_next(&iter, NULL, &job)) {
+        free_job(job);
+    }
+    g_hash_table_destroy(worker->jobs);
+
+    g_main_loop_unref(worker->loop);
+    g_main_context_unref(worker->context);
+    g_main_context_unref(worker->owner_context);
+    g_free(worker);
+}
+
+
+/**
+ * Starts a thread for the tree that @tree@ is part of, on which the
+ * file system is read when a change adds something to the tree. For a
+ * new directory, that means reading everything in it. The result is
+ * put in the tree, and the callback called, on the thread that created
+ * the tree, when its main context is next run. Changes are therefore
+ * reported later than without the thread, but the thread that created
+ * the tree is not held up by the reading.
+ * The thread runs until the tree is freed.
+ * Returns FALSE if nothing in the tree is monitored or the thread could
+ * not be started.
+ */
+gboolean set_monitor_thread(GNode *tree) {
+    struct MonitoringData *monitoring_data = get_monitoring_data(tree);
+    if(monitoring_data == NULL) {
+        return FALSE;
+    }
+    if(monitoring_data->worker != NULL) {
+        return TRUE;
+    }
+
+    struct MonitorWorker *worker = g_new0(struct MonitorWorker, 1);
+    worker->monitoring_data = monitoring_data;
+    worker->context = g_main_context_new();
+    worker->loop = g_main_loop_new(worker->context, FALSE);
+    worker->owner_context = g_main_context_ref_thread_default();
+    worker->prepared = NULL;
+    worker->jobs = g_hash_table_new(g_str_hash, g_str_equal);
+
+    worker->wakeup = g_source_new(&wakeup_funcs, sizeof(GSource));
+    g_source_set_callback(worker->wakeup, splice_prepared, monitoring_data, NULL);
+    g_source_attach(worker->wakeup, worker->owner_context);
+
+    worker->thread = g_thread_try_new("c-trees monitor", run_worker, worker, NULL);
+    if(worker->thread == NULL) {
+        g_source_destroy(worker->wakeup);
+        g_source_unref(worker->wakeup);
+        g_hash_table_destroy(worker->jobs);
+        g_main_loop_unref(worker->loop);
+        g_main_context_unref(worker->context);
+        g_main_context_unref(worker->owner_context);
+        g_free(worker);
+        return FALSE;
+    }
+    monitoring_data->worker = worker;
+    return TRUE;
+}
@@ -26,11 +26,34 @@
 #include "test-tree-getchildindir.h"
 #include "test-tree-addnode.h"
 #include "test-tree-numberofleaves.h"
+#include "test-tree-memoryusage.h"
+#include "test-tree-outofcore.h"
+#include "test-tree-packed.h"
+#include "test-tree-compact.h"
+#include "test-tree-classify.h"
 #include "test-filemon-create.h"
 #include "test-filemon-urilist-create.h"
 #include "test-filemon-delete.h"
 #include "test-filemon-urilist-delete.h"
 #include "test-filemon-move.h"
+#include "test-filemon-inotify.h"
+#include "test-filemon-fanotify.h"
+#include "test-filemon-budget.h"
+#include "test-filemon-coalesce.h"
+#include "test-filemon-changeset.h"
+#include "test-filemon-rename.h"
+#include "test-filemon-reconcile.h"
+#include "test-filemon-thread.h"
+#include "test-filemon-timebudget.h"
+#include "test-filemon-polling.h"
+#include "test-filemon-statistics.h"
+#include "test-filemon-deferred.h"
+#include "test-filemon-shared.h"
+#include "test-filemon-complete.h"
+#include "test-filemon-burst.h"
+#include "test-filemon-subscribers.h"
+#include "test-filemon-modify.h"
+#include "test-filemon-snapshot.h"
 
 #include "utils.h"
 
@@ -45,11 +68,34 @@ int main() {
     test_tree_getchildindir();
     test_tree_addnode();
     test_tree_numberofleaves();
+    test_tree_memoryusage();
+    test_tree_outofcore();
+    test_tree_packed();
+    test_tree_compact();
+    test_tree_classify();
     test_filemon_create();
     test_filemon_urilist_create();
     test_filemon_delete();
     test_filemon_urilist_delete();
     test_filemon_move();
+    test_filemon_inotify();
+    test_filemon_fanotify();
+    test_filemon_budget();
+    test_filemon_coalesce();
+    test_filemon_changeset();
+    test_filemon_rename();
+    test_filemon_reconcile();
+    test_filemon_thread();
+    test_filemon_timebudget();
+    test_filemon_polling();
+    test_filemon_statistics();
+    test_filemon_deferred();
+    test_filemon_shared();
+    test_filemon_complete();
+    test_filemon_burst();
+    test_filemon_subscribers();
+    test_filemon_modify();
+    test_filemon_snapshot();
 
     after_all();
 
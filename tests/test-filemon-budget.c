@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-filemon-budget.h"
+#include "utils.h"
+
+
+static void test_filemonitor_budget_noDirectories_notSet() {
+    before();
+
+    GNode *tree = uri_list_with_no_entries(FALSE, FALSE);
+    assert_numbers_equals("Watch budget ─ No directories ─ Not set", FALSE, set_watch_budget(tree, 1, 1));
+
+    free_whole_tree(tree);
+    after();
+}
+
+static void test_filemonitor_budget_createFileInPolledDirectory() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+
+    // Only the root directory keeps its watch; the rest are polled.
+    assert_numbers_equals("Watch budget ─ Set", TRUE, set_watch_budget(monitor_test_tree, 1, 1));
+
+    create_file(testdir_path, "/dir_two/sub_dir_one/img3.png");
+
+    char* expected_after = KWHT TESTDIRNAME RESET " (5 children)\n\
+├─ bepa.png\n\
+├─ cepa.jpg\n\
+├─ epa.png\n\
+├─┬" KWHT "dir_one" RESET " (1 children)\n\
+│ └─ two.jpg\n\
+└─┬" KWHT "dir_two" RESET " (7 children)\n\
+  ├─ apa.png\n\
+  ├─ bepa.png\n\
+  ├─ cepa.png\n\
+  ├─┬" KWHT "sub_dir_four" RESET " (2 children)\n\
+  │ ├──" KWHT "subsub" RESET " (0 children)\n\
+  │ └──" KWHT "subsub2" RESET " (0 children)\n\
+  ├─┬" KWHT "sub_dir_one" RESET " (4 children)\n\
+  │ ├─ img0.png\n\
+  │ ├─ img1.png\n\
+  │ ├─ img2.png\n\
+  │ └─ img3.png\n\
+  ├──" KWHT "sub_dir_three" RESET " (0 children)\n\
+  └─┬" KWHT "sub_dir_two" RESET " (4 children)\n\
+    ├─ img0.png\n\
+    ├─ img1.png\n\
+    ├─ img2.png\n\
+    └─ img3.png\n\
+";
+
+    wait_until_tree_is_as_expected(monitor_test_tree, expected_after);
+
+    assert_equals("Watch budget after create in polled subdir ─ Include hidden files: F ─ Recursive: T", expected_after, output);
+    assert_file_system_changes_at_least(1);
+
+    after();
+}
+
+
+
+void test_filemon_budget() {
+    test_filemonitor_budget_noDirectories_notSet();
+    test_filemonitor_budget_createFileInPolledDirectory();
+}
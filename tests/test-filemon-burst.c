@@ -0,0 +1,137 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-filemon-burst.h"
+#include "utils.h"
+
+
+#define BURST_FILES 20
+
+
+static const unsigned char png_signature[] = { 0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a };
+
+static int modifications;
+
+
+static char *burst_file_path(int i) {
+    char *name = g_strdup_printf("/dir_two/sub_dir_one/burst%02d.png", i);
+    char *path = append_strings(testdir_path, name);
+    g_free(name);
+    return path;
+}
+
+static void write_png(char *path) {
+    FILE *fh = fopen(path, "wb");
+    fwrite(png_signature, sizeof(png_signature), 1, fh);
+    fclose(fh);
+}
+
+static void count_modifications(TreeEvent event, char *path, GNode *node, GNode *root, gpointer data) {
+    (void) path;
+    (void) node;
+    (void) root;
+    (void) data;
+    if(event == TREE_EVENT_MODIFIED) {
+        modifications++;
+    }
+}
+
+static void test_filemonitor_burst_rescanDirectoryAfterBurst() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    assert_numbers_equals("Burst ─ Set", TRUE, set_burst_threshold(monitor_test_tree, 5));
+
+    for(int i = 0; i < BURST_FILES; i++) {
+        char *path = burst_file_path(i);
+        write_png(path);
+        free(path);
+    }
+    wait_until_file_system_changes_is_as_expected(BURST_FILES);
+
+    assert_numbers_equals("Burst ─ Changes", BURST_FILES, file_system_changes);
+    for(int i = 0; i < BURST_FILES; i++) {
+        char *path = burst_file_path(i);
+        assert_numbers_equals("Burst ─ In tree", TRUE, get_child_in_directory(monitor_test_tree, path) != NULL);
+        free(path);
+    }
+
+    after();
+}
+
+static void test_filemonitor_burst_turnOffWhileBursting() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    set_burst_threshold(monitor_test_tree, 1);
+
+    char *first = burst_file_path(0);
+    char *second = burst_file_path(1);
+    char *third = burst_file_path(2);
+    write_png(first);
+    write_png(second);
+    write_png(third);
+    g_main_context_iteration(NULL, FALSE);
+
+    assert_numbers_equals("Burst turned off ─ Unset", TRUE, set_burst_threshold(monitor_test_tree, 0));
+    wait_until_file_system_changes_is_as_expected(3);
+
+    assert_numbers_equals("Burst turned off ─ Changes", 3, file_system_changes);
+    assert_numbers_equals("Burst turned off ─ In tree", TRUE,
+                          get_child_in_directory(monitor_test_tree, third) != NULL);
+    free(first);
+    free(second);
+    free(third);
+
+    after();
+}
+static void test_filemonitor_burst_modificationDuringBurstIsReported() {
+    before();
+    modifications = 0;
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    set_burst_threshold(monitor_test_tree, 5);
+    char *dir = append_strings(testdir_path, "/dir_two/sub_dir_one");
+    char *img1 = append_strings(testdir_path, "/dir_two/sub_dir_one/img1.png");
+    add_subscriber(get_child_in_directory(monitor_test_tree, dir), TREE_EVENT_MODIFIED, count_modifications, NULL);
+
+    for(int i = 0; i < BURST_FILES; i++) {
+        char *path = burst_file_path(i);
+        write_png(path);
+        free(path);
+    }
+    // Written while the directory is having a burst.
+    write_png(img1);
+    wait_until_file_system_changes_is_as_expected(BURST_FILES);
+
+    assert_numbers_equals("Burst with modification ─ Changes", BURST_FILES, file_system_changes);
+    assert_numbers_equals("Burst with modification ─ Modified", TRUE, modifications > 0);
+    free(dir);
+    free(img1);
+
+    after();
+}
+
+
+void test_filemon_burst() {
+    test_filemonitor_burst_rescanDirectoryAfterBurst();
+    test_filemonitor_burst_turnOffWhileBursting();
+    test_filemonitor_burst_modificationDuringBurstIsReported();
+}
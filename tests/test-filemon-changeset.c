@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "test-filemon-changeset.h"
+#include "utils.h"
+
+
+static int change_sets;
+static int added;
+static int removed;
+
+static void count_changes(struct ChangeSet *changes, gpointer data) {
+    (void) data;
+    change_sets++;
+    added += g_list_length(changes->added);
+    removed += g_list_length(changes->removed);
+}
+
+static void wait_until_added_is(int expected) {
+    clock_t start = clock();
+    while((clock() - start) / CLOCKS_PER_SEC < TIMEOUT && added < expected) {
+        g_main_context_iteration(NULL, FALSE);
+    }
+}
+
+
+static void test_filemonitor_changeset_createFilesInFolder_nonRecursive() {
+    before();
+    change_sets = added = removed = 0;
+
+    monitor_test_tree = single_folder(FALSE, FALSE);
+    assert_numbers_equals("Change set ─ Set", TRUE, set_change_set_callback(monitor_test_tree, count_changes, NULL, 200));
+
+    create_file(testdir_path, "/fepa.jpg");
+    create_file(testdir_path, "/gepa.jpg");
+    create_file(testdir_path, "/hepa.jpg");
+
+    wait_until_added_is(3);
+
+    assert_numbers_equals("Change set ─ Files added", 3, added);
+    assert_numbers_equals("Change set ─ Files removed", 0, removed);
+    assert_numbers_equals("Change set ─ Fewer calls than changes", TRUE, change_sets < 3);
+    // The callback given at creation is not called while change sets are used.
+    assert_numbers_equals("Change set ─ No single changes", 0, file_system_changes);
+
+    after();
+}
+
+
+
+void test_filemon_changeset() {
+    test_filemonitor_changeset_createFilesInFolder_nonRecursive();
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-filemon-coalesce.h"
+#include "utils.h"
+
+
+static void test_filemonitor_coalesce_noDirectories_notSet() {
+    before();
+
+    GNode *tree = uri_list_with_no_entries(FALSE, FALSE);
+    assert_numbers_equals("Coalescing ─ No directories ─ Not set", FALSE, set_event_coalescing(tree, 100));
+
+    free_whole_tree(tree);
+    after();
+}
+
+static void test_filemonitor_coalesce_createAndDeleteFilesInFolder_nonRecursive() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, FALSE);
+    assert_numbers_equals("Coalescing ─ Set", TRUE, set_event_coalescing(monitor_test_tree, 100));
+
+    create_file(testdir_path, "/fepa.jpg");
+    create_file(testdir_path, "/gepa.jpg");
+    create_file(testdir_path, "/hepa.png");
+    remove_file(testdir_path, "/hepa.png");
+
+    char* expected_after = KWHT TESTDIRNAME RESET " (5 children)\n\
+├─ bepa.png\n\
+├─ cepa.jpg\n\
+├─ epa.png\n\
+├─ fepa.jpg\n\
+└─ gepa.jpg\n\
+";
+
+    wait_until_tree_is_as_expected(monitor_test_tree, expected_after);
+
+    assert_equals("Coalescing after create and delete in root ─ Include hidden files: F ─ Recursive: F", expected_after, output);
+    assert_file_system_changes_at_least(2);
+
+    after();
+}
+static void test_filemonitor_coalesce_deleteAndRecreateExistingFiles_nonRecursive() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, FALSE);
+    assert_numbers_equals("Coalescing ─ Set", TRUE, set_event_coalescing(monitor_test_tree, 100));
+
+    remove_file(testdir_path, "/bepa.png");
+    create_file(testdir_path, "/bepa.png");
+    remove_file(testdir_path, "/epa.png");
+
+    char* expected_after = KWHT TESTDIRNAME RESET " (2 children)\n\
+├─ bepa.png\n\
+└─ cepa.jpg\n\
+";
+
+    wait_until_tree_is_as_expected(monitor_test_tree, expected_after);
+
+    assert_equals("Coalescing after delete of existing files in root ─ Include hidden files: F ─ Recursive: F", expected_after, output);
+    assert_file_system_changes_at_least(2);
+
+    after();
+}
+
+
+
+void test_filemon_coalesce() {
+    test_filemonitor_coalesce_noDirectories_notSet();
+    test_filemonitor_coalesce_createAndDeleteFilesInFolder_nonRecursive();
+    test_filemonitor_coalesce_deleteAndRecreateExistingFiles_nonRecursive();
+}
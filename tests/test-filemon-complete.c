@@ -0,0 +1,101 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "test-filemon-complete.h"
+#include "utils.h"
+
+
+static const unsigned char png_signature[] = { 0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a };
+
+
+static void wait_for_events() {
+    clock_t start = clock();
+    while((clock() - start) / CLOCKS_PER_SEC < 1) {
+        g_main_context_iteration(NULL, FALSE);
+    }
+}
+
+static void write_png(char *path) {
+    FILE *fh = fopen(path, "wb");
+    fwrite(png_signature, sizeof(png_signature), 1, fh);
+    fclose(fh);
+}
+
+static void test_filemonitor_complete_addFileWhenClosed() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    assert_numbers_equals("Complete files ─ Set", TRUE, set_complete_files_only(monitor_test_tree, TRUE));
+
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/img3.png");
+    FILE *fh = fopen(path, "wb");
+    fwrite(png_signature, sizeof(png_signature), 1, fh);
+    fflush(fh);
+    wait_for_events();
+
+    assert_numbers_equals("Complete files while written ─ Changes", 0, file_system_changes);
+    assert_numbers_equals("Complete files while written ─ Not in tree", TRUE,
+                          get_child_in_directory(monitor_test_tree, path) == NULL);
+
+    fclose(fh);
+    wait_until_file_system_changes_is_as_expected(1);
+
+    assert_numbers_equals("Complete files after close ─ Changes", 1, file_system_changes);
+    assert_numbers_equals("Complete files after close ─ In tree", TRUE,
+                          get_child_in_directory(monitor_test_tree, path) != NULL);
+    free(path);
+
+    after();
+}
+
+static void test_filemonitor_complete_addFileWhenRenamedFromTemporaryName() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    set_complete_files_only(monitor_test_tree, TRUE);
+
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/img4.png");
+    char *temporary_path = append_strings(testdir_path, "/dir_two/sub_dir_one/img4.png.part");
+    write_png(temporary_path);
+    wait_for_events();
+
+    assert_numbers_equals("Complete files with temporary name ─ Changes", 0, file_system_changes);
+    assert_numbers_equals("Complete files with temporary name ─ Not in tree", TRUE,
+                          get_child_in_directory(monitor_test_tree, temporary_path) == NULL);
+
+    rename(temporary_path, path);
+    wait_until_file_system_changes_is_as_expected(1);
+
+    assert_numbers_equals("Complete files after rename ─ Changes", 1, file_system_changes);
+    assert_numbers_equals("Complete files after rename ─ In tree", TRUE,
+                          get_child_in_directory(monitor_test_tree, path) != NULL);
+    free(temporary_path);
+    free(path);
+
+    after();
+}
+
+
+void test_filemon_complete() {
+    test_filemonitor_complete_addFileWhenClosed();
+    test_filemonitor_complete_addFileWhenRenamedFromTemporaryName();
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-filemon-deferred.h"
+#include "utils.h"
+
+
+static void test_filemonitor_deferred_createFileBeforeMonitorsExist() {
+    before();
+    set_deferred_monitors(TRUE);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+
+    // Created before the main loop has run, so nothing is monitored yet.
+    create_file(testdir_path, "/dir_two/sub_dir_one/img3.png");
+    wait_until_file_system_changes_is_as_expected(1);
+
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/img3.png");
+    assert_numbers_equals("Deferred monitors after create before monitoring ─ Changes", 1, file_system_changes);
+    assert_numbers_equals("Deferred monitors after create before monitoring ─ In tree", TRUE,
+                          get_child_in_directory(monitor_test_tree, path) != NULL);
+    free(path);
+
+    remove_file(testdir_path, "/dir_two/sub_dir_two/img0.png");
+    wait_until_file_system_changes_is_as_expected(2);
+
+    path = append_strings(testdir_path, "/dir_two/sub_dir_two/img0.png");
+    assert_numbers_equals("Deferred monitors after delete when monitored ─ Changes", 2, file_system_changes);
+    assert_numbers_equals("Deferred monitors after delete when monitored ─ Not in tree", TRUE,
+                          get_child_in_directory(monitor_test_tree, path) == NULL);
+    free(path);
+
+    set_deferred_monitors(FALSE);
+    after();
+}
+
+static void test_filemonitor_deferred_freeTreeBeforeMonitorsExist() {
+    before();
+    set_deferred_monitors(TRUE);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    free_whole_tree(monitor_test_tree);
+    monitor_test_tree = NULL;
+
+    create_file(testdir_path, "/dir_two/sub_dir_one/img3.png");
+    while(g_main_context_iteration(NULL, FALSE));
+    assert_numbers_equals("Deferred monitors after freeing tree ─ Changes", 0, file_system_changes);
+
+    set_deferred_monitors(FALSE);
+    after();
+}
+
+
+
+void test_filemon_deferred() {
+    test_filemonitor_deferred_createFileBeforeMonitorsExist();
+    test_filemonitor_deferred_freeTreeBeforeMonitorsExist();
+}
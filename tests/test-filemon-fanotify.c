@@ -0,0 +1,77 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-filemon-fanotify.h"
+#include "utils.h"
+
+
+// Without CAP_SYS_ADMIN, this runs on the inotify fallback.
+static void test_filemonitor_fanotify_createFileInFolder_nonRecursive() {
+    before();
+    set_monitor_backend(MONITOR_BACKEND_FANOTIFY);
+
+    monitor_test_tree = single_folder(FALSE, FALSE);
+
+    create_file(testdir_path, "/fepa.jpg");
+
+    char* expected_after = KWHT TESTDIRNAME RESET " (4 children)\n\
+├─ bepa.png\n\
+├─ cepa.jpg\n\
+├─ epa.png\n\
+└─ fepa.jpg\n\
+";
+
+    wait_until_tree_is_as_expected(monitor_test_tree, expected_after);
+
+    assert_equals("Fanotify monitor after create in root ─ Include hidden files: F ─ Recursive: F", expected_after, output);
+    assert_file_system_changes_at_least(1);
+
+    set_monitor_backend(MONITOR_BACKEND_GIO);
+    after();
+}
+
+static void test_filemonitor_fanotify_deleteFileInFolder_nonRecursive() {
+    before();
+    set_monitor_backend(MONITOR_BACKEND_FANOTIFY);
+
+    monitor_test_tree = single_folder(FALSE, FALSE);
+
+    remove_file(testdir_path, "/bepa.png");
+
+    char* expected_after = KWHT TESTDIRNAME RESET " (2 children)\n\
+├─ cepa.jpg\n\
+└─ epa.png\n\
+";
+
+    wait_until_tree_is_as_expected(monitor_test_tree, expected_after);
+
+    assert_equals("Fanotify monitor after delete in root ─ Include hidden files: F ─ Recursive: F", expected_after, output);
+    assert_file_system_changes_at_least(1);
+
+    set_monitor_backend(MONITOR_BACKEND_GIO);
+    after();
+}
+
+
+
+void test_filemon_fanotify() {
+    test_filemonitor_fanotify_createFileInFolder_nonRecursive();
+    test_filemonitor_fanotify_deleteFileInFolder_nonRecursive();
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-filemon-inotify.h"
+#include "utils.h"
+
+
+static void test_filemonitor_inotify_createAndDeleteFileInSubdir() {
+    before();
+    set_monitor_backend(MONITOR_BACKEND_INOTIFY);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    assert_numbers_equals("Inotify monitor ─ Backend is used", MONITOR_BACKEND_INOTIFY,
+                          get_monitoring_data(monitor_test_tree)->backend);
+
+    create_file(testdir_path, "/dir_two/sub_dir_one/img3.png");
+
+    char* expected_after_create = KWHT TESTDIRNAME RESET " (5 children)\n\
+├─ bepa.png\n\
+├─ cepa.jpg\n\
+├─ epa.png\n\
+├─┬" KWHT "dir_one" RESET " (1 children)\n\
+│ └─ two.jpg\n\
+└─┬" KWHT "dir_two" RESET " (7 children)\n\
+  ├─ apa.png\n\
+  ├─ bepa.png\n\
+  ├─ cepa.png\n\
+  ├─┬" KWHT "sub_dir_four" RESET " (2 children)\n\
+  │ ├──" KWHT "subsub" RESET " (0 children)\n\
+  │ └──" KWHT "subsub2" RESET " (0 children)\n\
+  ├─┬" KWHT "sub_dir_one" RESET " (4 children)\n\
+  │ ├─ img0.png\n\
+  │ ├─ img1.png\n\
+  │ ├─ img2.png\n\
+  │ └─ img3.png\n\
+  ├──" KWHT "sub_dir_three" RESET " (0 children)\n\
+  └─┬" KWHT "sub_dir_two" RESET " (4 children)\n\
+    ├─ img0.png\n\
+    ├─ img1.png\n\
+    ├─ img2.png\n\
+    └─ img3.png\n\
+";
+
+    wait_until_tree_is_as_expected(monitor_test_tree, expected_after_create);
+    assert_equals("Inotify monitor after create in subdir ─ Include hidden files: F ─ Recursive: T", expected_after_create, output);
+    assert_file_system_changes_at_least(1);
+
+
+    remove_file(testdir_path, "/dir_two/sub_dir_two/img0.png");
+
+    char* expected_after_delete = KWHT TESTDIRNAME RESET " (5 children)\n\
+├─ bepa.png\n\
+├─ cepa.jpg\n\
+├─ epa.png\n\
+├─┬" KWHT "dir_one" RESET " (1 children)\n\
+│ └─ two.jpg\n\
+└─┬" KWHT "dir_two" RESET " (7 children)\n\
+  ├─ apa.png\n\
+  ├─ bepa.png\n\
+  ├─ cepa.png\n\
+  ├─┬" KWHT "sub_dir_four" RESET " (2 children)\n\
+  │ ├──" KWHT "subsub" RESET " (0 children)\n\
+  │ └──" KWHT "subsub2" RESET " (0 children)\n\
+  ├─┬" KWHT "sub_dir_one" RESET " (4 children)\n\
+  │ ├─ img0.png\n\
+  │ ├─ img1.png\n\
+  │ ├─ img2.png\n\
+  │ └─ img3.png\n\
+  ├──" KWHT "sub_dir_three" RESET " (0 children)\n\
+  └─┬" KWHT "sub_dir_two" RESET " (3 children)\n\
+    ├─ img1.png\n\
+    ├─ img2.png\n\
+    └─ img3.png\n\
+";
+
+    wait_until_tree_is_as_expected(monitor_test_tree, expected_after_delete);
+    assert_equals("Inotify monitor after delete in subdir ─ Include hidden files: F ─ Recursive: T", expected_after_delete, output);
+    assert_file_system_changes_at_least(2);
+
+    set_monitor_backend(MONITOR_BACKEND_GIO);
+    after();
+}
+
+static void test_filemonitor_inotify_deleteDirectoryAndFileInSubdir() {
+    before();
+    set_monitor_backend(MONITOR_BACKEND_INOTIFY);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+
+    // The directory reports its own removal as well as its entries.
+    remove_directory(testdir_path, "/dir_one");
+    remove_file(testdir_path, "/dir_two/sub_dir_one/img0.png");
+
+    char* expected_after_delete = KWHT TESTDIRNAME RESET " (4 children)\n\
+├─ bepa.png\n\
+├─ cepa.jpg\n\
+├─ epa.png\n\
+└─┬" KWHT "dir_two" RESET " (7 children)\n\
+  ├─ apa.png\n\
+  ├─ bepa.png\n\
+  ├─ cepa.png\n\
+  ├─┬" KWHT "sub_dir_four" RESET " (2 children)\n\
+  │ ├──" KWHT "subsub" RESET " (0 children)\n\
+  │ └──" KWHT "subsub2" RESET " (0 children)\n\
+  ├─┬" KWHT "sub_dir_one" RESET " (2 children)\n\
+  │ ├─ img1.png\n\
+  │ └─ img2.png\n\
+  ├──" KWHT "sub_dir_three" RESET " (0 children)\n\
+  └─┬" KWHT "sub_dir_two" RESET " (4 children)\n\
+    ├─ img0.png\n\
+    ├─ img1.png\n\
+    ├─ img2.png\n\
+    └─ img3.png\n\
+";
+
+    wait_until_tree_is_as_expected(monitor_test_tree, expected_after_delete);
+    assert_equals("Inotify monitor after deleting directory ─ Include hidden files: F ─ Recursive: T", expected_after_delete, output);
+
+    set_monitor_backend(MONITOR_BACKEND_GIO);
+    after();
+}
+
+static void test_filemonitor_inotify_recreateDirectory_watchedAgain() {
+    before();
+    set_monitor_backend(MONITOR_BACKEND_INOTIFY);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    // The dropped watch of the old directory goes through the queue.
+    set_event_time_budget(monitor_test_tree, 1);
+
+    remove_directory(testdir_path, "/dir_one");
+    create_dir(testdir_path, "/dir_one");
+    create_file(testdir_path, "/dir_one/three.jpg");
+
+    char* expected_after_recreate = KWHT TESTDIRNAME RESET " (5 children)\n\
+├─ bepa.png\n\
+├─ cepa.jpg\n\
+├─ epa.png\n\
+├─┬" KWHT "dir_one" RESET " (1 children)\n\
+│ └─ three.jpg\n\
+└─┬" KWHT "dir_two" RESET " (7 children)\n\
+  ├─ apa.png\n\
+  ├─ bepa.png\n\
+  ├─ cepa.png\n\
+  ├─┬" KWHT "sub_dir_four" RESET " (2 children)\n\
+  │ ├──" KWHT "subsub" RESET " (0 children)\n\
+  │ └──" KWHT "subsub2" RESET " (0 children)\n\
+  ├─┬" KWHT "sub_dir_one" RESET " (3 children)\n\
+  │ ├─ img0.png\n\
+  │ ├─ img1.png\n\
+  │ └─ img2.png\n\
+  ├──" KWHT "sub_dir_three" RESET " (0 children)\n\
+  └─┬" KWHT "sub_dir_two" RESET " (4 children)\n\
+    ├─ img0.png\n\
+    ├─ img1.png\n\
+    ├─ img2.png\n\
+    └─ img3.png\n\
+";
+
+    wait_until_tree_is_as_expected(monitor_test_tree, expected_after_recreate);
+    assert_equals("Inotify monitor after recreating directory", expected_after_recreate, output);
+
+    create_file(testdir_path, "/dir_one/four.jpg");
+
+    char* expected_after_create = KWHT TESTDIRNAME RESET " (5 children)\n\
+├─ bepa.png\n\
+├─ cepa.jpg\n\
+├─ epa.png\n\
+├─┬" KWHT "dir_one" RESET " (2 children)\n\
+│ ├─ four.jpg\n\
+│ └─ three.jpg\n\
+└─┬" KWHT "dir_two" RESET " (7 children)\n\
+  ├─ apa.png\n\
+  ├─ bepa.png\n\
+  ├─ cepa.png\n\
+  ├─┬" KWHT "sub_dir_four" RESET " (2 children)\n\
+  │ ├──" KWHT "subsub" RESET " (0 children)\n\
+  │ └──" KWHT "subsub2" RESET " (0 children)\n\
+  ├─┬" KWHT "sub_dir_one" RESET " (3 children)\n\
+  │ ├─ img0.png\n\
+  │ ├─ img1.png\n\
+  │ └─ img2.png\n\
+  ├──" KWHT "sub_dir_three" RESET " (0 children)\n\
+  └─┬" KWHT "sub_dir_two" RESET " (4 children)\n\
+    ├─ img0.png\n\
+    ├─ img1.png\n\
+    ├─ img2.png\n\
+    └─ img3.png\n\
+";
+
+    wait_until_tree_is_as_expected(monitor_test_tree, expected_after_create);
+    assert_equals("Inotify monitor ─ Recreated directory is watched", expected_after_create, output);
+
+    set_monitor_backend(MONITOR_BACKEND_GIO);
+    after();
+}
+
+
+
+void test_filemon_inotify() {
+    test_filemonitor_inotify_createAndDeleteFileInSubdir();
+    test_filemonitor_inotify_deleteDirectoryAndFileInSubdir();
+    test_filemonitor_inotify_recreateDirectory_watchedAgain();
+}
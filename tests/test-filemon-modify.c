@@ -0,0 +1,111 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "test-filemon-modify.h"
+#include "utils.h"
+
+
+static int modifications;
+static GNode *modified_node;
+
+static void count_modifications(TreeEvent event, char *path, GNode *node, GNode *root, gpointer data) {
+    (void) path;
+    (void) root;
+    (void) data;
+    if(event == TREE_EVENT_MODIFIED) {
+        modifications++;
+        modified_node = node;
+    }
+}
+
+static void count_modified_in_change_set(struct ChangeSet *changes, gpointer data) {
+    (void) data;
+    if(changes->modified != NULL) {
+        modifications += g_list_length(changes->modified);
+        modified_node = changes->modified->data;
+    }
+}
+
+static void wait_until_modified() {
+    clock_t start = clock();
+    while((clock() - start) / CLOCKS_PER_SEC < TIMEOUT && modifications == 0) {
+        g_main_context_iteration(NULL, FALSE);
+    }
+}
+
+static void append_to_file(char *path) {
+    FILE *fh = fopen(path, "ab");
+    fputc(0, fh);
+    fclose(fh);
+}
+
+
+static void test_filemonitor_modify_writtenFileIsKept() {
+    before();
+    modifications = 0;
+    modified_node = NULL;
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    char *dir = append_strings(testdir_path, "/dir_two/sub_dir_one");
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/img1.png");
+    GNode *node = get_child_in_directory(monitor_test_tree, path);
+    add_subscriber(get_child_in_directory(monitor_test_tree, dir), TREE_EVENT_MODIFIED, count_modifications, NULL);
+
+    append_to_file(path);
+    wait_until_modified();
+
+    assert_numbers_equals("Modify ─ Reported", TRUE, modifications > 0);
+    assert_numbers_equals("Modify ─ Same node", TRUE, modified_node == node);
+    assert_numbers_equals("Modify ─ Still in tree", TRUE, get_child_in_directory(monitor_test_tree, path) == node);
+    // Neither an addition nor a removal.
+    assert_numbers_equals("Modify ─ No changes", 0, file_system_changes);
+    free(dir);
+    free(path);
+
+    after();
+}
+
+static void test_filemonitor_modify_inChangeSet() {
+    before();
+    modifications = 0;
+    modified_node = NULL;
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    set_change_set_callback(monitor_test_tree, count_modified_in_change_set, NULL, 0);
+    char *path = append_strings(testdir_path, "/bepa.png");
+    GNode *node = get_child_in_directory(monitor_test_tree, path);
+
+    append_to_file(path);
+    wait_until_modified();
+
+    assert_numbers_equals("Modify in change set ─ Reported", TRUE, modifications > 0);
+    assert_numbers_equals("Modify in change set ─ Same node", TRUE, modified_node == node);
+    free(path);
+
+    after();
+}
+
+
+void test_filemon_modify() {
+    test_filemonitor_modify_writtenFileIsKept();
+    test_filemonitor_modify_inChangeSet();
+}
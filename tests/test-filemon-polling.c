@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-filemon-polling.h"
+#include "utils.h"
+
+
+static void test_filemonitor_polling_createAndDeleteFileInSubdir() {
+    before();
+    set_monitor_backend(MONITOR_BACKEND_POLLING);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    set_watch_budget(monitor_test_tree, 0, 1);
+
+    create_file(testdir_path, "/dir_two/sub_dir_one/img3.png");
+    wait_until_file_system_changes_is_as_expected(1);
+
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/img3.png");
+    assert_numbers_equals("Polling monitor after create in subdir ─ Changes", 1, file_system_changes);
+    assert_numbers_equals("Polling monitor after create in subdir ─ In tree", TRUE,
+                          get_child_in_directory(monitor_test_tree, path) != NULL);
+    free(path);
+
+    remove_file(testdir_path, "/dir_two/sub_dir_two/img0.png");
+    wait_until_file_system_changes_is_as_expected(2);
+
+    path = append_strings(testdir_path, "/dir_two/sub_dir_two/img0.png");
+    assert_numbers_equals("Polling monitor after delete in subdir ─ Changes", 2, file_system_changes);
+    assert_numbers_equals("Polling monitor after delete in subdir ─ Not in tree", TRUE,
+                          get_child_in_directory(monitor_test_tree, path) == NULL);
+    free(path);
+
+    set_monitor_backend(MONITOR_BACKEND_GIO);
+    after();
+}
+
+
+
+void test_filemon_polling() {
+    test_filemonitor_polling_createAndDeleteFileInSubdir();
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "test-filemon-reconcile.h"
+#include "utils.h"
+
+
+static void wait_for_events() {
+    clock_t start = clock();
+    while((clock() - start) / CLOCKS_PER_SEC < 1) {
+        g_main_context_iteration(NULL, FALSE);
+    }
+}
+
+
+static void test_filemonitor_reconcile_nothingChanged() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+
+    assert_numbers_equals("Reconcile nothing changed ─ Changes", 0, reconcile_tree(monitor_test_tree));
+    assert_numbers_equals("Reconcile nothing changed ─ Callbacks", 0, file_system_changes);
+
+    after();
+}
+
+static void test_filemonitor_reconcile_changesNotYetReported() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+
+    // The monitor has not had the chance to report these yet.
+    create_file(testdir_path, "/fepa.jpg");
+    remove_file(testdir_path, "/dir_one/two.jpg");
+
+    assert_numbers_equals("Reconcile unreported ─ Changes", 2, reconcile_tree(monitor_test_tree));
+    assert_numbers_equals("Reconcile unreported ─ Callbacks", 2, file_system_changes);
+
+    // The events that arrive afterwards find the tree already changed.
+    wait_for_events();
+    assert_numbers_equals("Reconcile unreported ─ No callbacks from events", 2, file_system_changes);
+
+    after();
+}
+
+static void test_filemonitor_reconcile_onlyWhatTreeWouldRead() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+
+    create_file(testdir_path, "/notes.txt");
+    create_file(testdir_path, "/.hidden.png");
+
+    assert_numbers_equals("Reconcile not for tree ─ Changes", 0, reconcile_tree(monitor_test_tree));
+    assert_numbers_equals("Reconcile not for tree ─ Callbacks", 0, file_system_changes);
+
+    after();
+}
+
+
+
+void test_filemon_reconcile() {
+    test_filemonitor_reconcile_nothingChanged();
+    test_filemonitor_reconcile_changesNotYetReported();
+    test_filemonitor_reconcile_onlyWhatTreeWouldRead();
+}
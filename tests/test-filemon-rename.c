@@ -0,0 +1,154 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "test-filemon-rename.h"
+#include "utils.h"
+
+
+static int moves;
+
+static void count_moves(char *old_path, GNode *moved_node, GNode *root, gpointer data) {
+    (void) old_path;
+    (void) moved_node;
+    (void) root;
+    (void) data;
+    moves++;
+}
+
+static void wait_until_moves_is(int expected) {
+    clock_t start = clock();
+    while((clock() - start) / CLOCKS_PER_SEC < TIMEOUT && moves < expected) {
+        g_main_context_iteration(NULL, FALSE);
+    }
+}
+
+
+static void test_filemonitor_rename_dirInRoot_keepsNodes() {
+    before();
+    moves = 0;
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    assert_numbers_equals("Rename ─ Set", TRUE, set_moved_callback(monitor_test_tree, count_moves, NULL));
+
+    char *path_before = append_strings(testdir_path, "/dir_one/two.jpg");
+    GNode *node_before = get_child_in_directory(monitor_test_tree, path_before);
+
+    char *path_src = append_strings(testdir_path, "/dir_one");
+    char *path_dst = append_strings(testdir_path, "/dir_moved");
+    rename(path_src, path_dst);
+    free(path_src);
+    free(path_dst);
+
+    wait_until_moves_is(1);
+
+    char *path_after = append_strings(testdir_path, "/dir_moved/two.jpg");
+    GNode *node_after = get_child_in_directory(monitor_test_tree, path_after);
+
+    assert_numbers_equals("Rename ─ One move", 1, moves);
+    assert_numbers_equals("Rename ─ Node kept", TRUE, node_before != NULL && node_before == node_after);
+    assert_equals("Rename ─ Path updated", path_after, node_after == NULL ? "" : ((VnrFile*) node_after->data)->path);
+    assert_numbers_equals("Rename ─ No removal or addition", 0, file_system_changes);
+
+    free(path_before);
+    free(path_after);
+    after();
+}
+
+static void test_filemonitor_rename_dirInRoot_inotify_keepsNodes() {
+    before();
+    moves = 0;
+    set_monitor_backend(MONITOR_BACKEND_INOTIFY);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    assert_numbers_equals("Rename with inotify ─ Set", TRUE, set_moved_callback(monitor_test_tree, count_moves, NULL));
+
+    char *path_before = append_strings(testdir_path, "/dir_one/two.jpg");
+    GNode *node_before = get_child_in_directory(monitor_test_tree, path_before);
+
+    char *path_src = append_strings(testdir_path, "/dir_one");
+    char *path_dst = append_strings(testdir_path, "/dir_moved");
+    rename(path_src, path_dst);
+    free(path_src);
+    free(path_dst);
+
+    wait_until_moves_is(1);
+
+    char *path_after = append_strings(testdir_path, "/dir_moved/two.jpg");
+    GNode *node_after = get_child_in_directory(monitor_test_tree, path_after);
+
+    assert_numbers_equals("Rename with inotify ─ One move", 1, moves);
+    assert_numbers_equals("Rename with inotify ─ Node kept", TRUE, node_before != NULL && node_before == node_after);
+    assert_equals("Rename with inotify ─ Path updated", path_after, node_after == NULL ? "" : ((VnrFile*) node_after->data)->path);
+    assert_numbers_equals("Rename with inotify ─ No removal or addition", 0, file_system_changes);
+
+    // The moved directory reports IN_MOVE_SELF as well.
+    char *path_dir = append_strings(testdir_path, "/dir_moved");
+    for(int i = 0; i < 10; i++) {
+        g_main_context_iteration(NULL, FALSE);
+    }
+    assert_numbers_equals("Rename with inotify ─ Directory kept", TRUE,
+                          get_child_in_directory(monitor_test_tree, path_dir) != NULL);
+    assert_numbers_equals("Rename with inotify ─ Still no removal", 0, file_system_changes);
+
+    free(path_dir);
+    free(path_before);
+    free(path_after);
+    set_monitor_backend(MONITOR_BACKEND_GIO);
+    after();
+}
+
+static void test_filemonitor_rename_ontoExistingFile_replacesIt() {
+    before();
+    moves = 0;
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    set_moved_callback(monitor_test_tree, count_moves, NULL);
+
+    char *path_src = append_strings(testdir_path, "/bepa.png");
+    char *path_dst = append_strings(testdir_path, "/epa.png");
+    GNode *node_before = get_child_in_directory(monitor_test_tree, path_src);
+    GNode *parent = node_before == NULL ? NULL : node_before->parent;
+
+    // As when a file is saved atomically.
+    rename(path_src, path_dst);
+    wait_until_moves_is(1);
+
+    GNode *node_after = get_child_in_directory(monitor_test_tree, path_dst);
+
+    assert_numbers_equals("Rename onto file ─ One move", 1, moves);
+    assert_numbers_equals("Rename onto file ─ Node kept", TRUE, node_before != NULL && node_before == node_after);
+    assert_numbers_equals("Rename onto file ─ Node in tree", TRUE, node_after != NULL && node_after->parent == parent);
+    assert_numbers_equals("Rename onto file ─ Replaced file gone", 4, parent == NULL ? 0 : (int) g_node_n_children(parent));
+    assert_numbers_equals("Rename onto file ─ One removal", 1, file_system_changes);
+
+    free(path_src);
+    free(path_dst);
+    after();
+}
+
+
+
+void test_filemon_rename() {
+    test_filemonitor_rename_dirInRoot_keepsNodes();
+    test_filemonitor_rename_dirInRoot_inotify_keepsNodes();
+    test_filemonitor_rename_ontoExistingFile_replacesIt();
+}
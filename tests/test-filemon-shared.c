@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-filemon-shared.h"
+#include "utils.h"
+
+
+static void test_filemonitor_shared_createFileInTwoTrees() {
+    before();
+
+    GNode *first = get_root_node(single_folder(FALSE, TRUE));
+    GNode *second = get_root_node(single_folder(FALSE, TRUE));
+    monitor_test_tree = first;
+
+    assert_numbers_equals("Shared monitors after opening twice ─ Same monitor", TRUE,
+                          VNR_FILE(first->data)->monitor == VNR_FILE(second->data)->monitor);
+
+    create_file(testdir_path, "/dir_two/sub_dir_one/img3.png");
+    wait_until_file_system_changes_is_as_expected(2);
+
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/img3.png");
+    assert_numbers_equals("Shared monitors after create ─ Changes", 2, file_system_changes);
+    assert_numbers_equals("Shared monitors after create ─ In first tree", TRUE,
+                          get_child_in_directory(first, path) != NULL);
+    assert_numbers_equals("Shared monitors after create ─ In second tree", TRUE,
+                          get_child_in_directory(second, path) != NULL);
+    free(path);
+
+    free_whole_tree(second);
+    monitor_test_tree = first;
+
+    remove_file(testdir_path, "/dir_two/sub_dir_two/img0.png");
+    wait_until_file_system_changes_is_as_expected(3);
+
+    path = append_strings(testdir_path, "/dir_two/sub_dir_two/img0.png");
+    assert_numbers_equals("Shared monitors after freeing one tree ─ Changes", 3, file_system_changes);
+    assert_numbers_equals("Shared monitors after freeing one tree ─ Not in tree", TRUE,
+                          get_child_in_directory(first, path) == NULL);
+    free(path);
+
+    free_whole_tree(first);
+    monitor_test_tree = NULL;
+    after();
+}
+
+
+
+void test_filemon_shared() {
+    test_filemonitor_shared_createFileInTwoTrees();
+}
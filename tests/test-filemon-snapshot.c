@@ -0,0 +1,179 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "test-filemon-snapshot.h"
+#include "utils.h"
+
+
+#define SNAPSHOTDIR TESTDIRBASE "c-trees-snapshots"
+
+
+static void remove_snapshots() {
+    remove_directory(TESTDIRBASE, "c-trees-snapshots");
+}
+
+static void test_filemonitor_snapshot_loadAndCatchUp() {
+    before();
+    set_snapshot_directory(SNAPSHOTDIR);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    pretty_print_tree(monitor_test_tree, output);
+    char *expected = g_strdup(output);
+    assert_numbers_equals("Snapshot ─ Saved", TRUE, save_snapshot(monitor_test_tree, NULL));
+    free_whole_tree(monitor_test_tree);
+
+    // Made while no tree exists, so only the catching up can find it.
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/snap.png");
+    create_file(testdir_path, "/dir_two/sub_dir_one/snap.png");
+
+    reset_output();
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    pretty_print_tree(monitor_test_tree, output);
+    assert_equals("Snapshot ─ Loaded as saved", expected, output);
+
+    wait_until_file_system_changes_is_as_expected(1);
+    assert_numbers_equals("Snapshot ─ Changes since saved", 1, file_system_changes);
+    assert_numbers_equals("Snapshot ─ New file in tree", TRUE, get_child_in_directory(monitor_test_tree, path) != NULL);
+
+    g_free(expected);
+    free(path);
+    set_snapshot_directory(NULL);
+    remove_snapshots();
+    after();
+}
+
+static void test_filemonitor_snapshot_otherSettingsReadFromDisk() {
+    before();
+    set_snapshot_directory(SNAPSHOTDIR);
+
+    monitor_test_tree = single_folder(FALSE, FALSE);
+    assert_numbers_equals("Snapshot with other settings ─ Saved", TRUE, save_snapshot(monitor_test_tree, NULL));
+    free_whole_tree(monitor_test_tree);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/img0.png");
+    assert_numbers_equals("Snapshot with other settings ─ Read from disk", TRUE,
+                          get_child_in_directory(monitor_test_tree, path) != NULL);
+
+    free(path);
+    set_snapshot_directory(NULL);
+    remove_snapshots();
+    after();
+}
+
+static void wait_until_in_tree(char *path) {
+    clock_t start = clock();
+    while((clock() - start) / CLOCKS_PER_SEC < TIMEOUT && get_child_in_directory(monitor_test_tree, path) == NULL) {
+        g_main_context_iteration(NULL, FALSE);
+    }
+}
+
+static void test_filemonitor_snapshot_notUsedAfterCreation() {
+    before();
+    set_snapshot_directory(SNAPSHOTDIR);
+
+    char *dir = append_strings(testdir_path, "/dir_two");
+    GError *error = NULL;
+    GNode *subtree = create_tree_from_single_uri(dir, FALSE, TRUE, NULL, NULL, &error);
+    assert_error_is_null(error);
+    assert_numbers_equals("Snapshot not used after creation ─ Saved", TRUE, save_snapshot(subtree, NULL));
+    free_whole_tree(subtree);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+
+    // Read while the tree exists, so not from the snapshot of dir_two.
+    remove_directory(testdir_path, "/dir_two");
+    create_dir(testdir_path, "/dir_two");
+    create_file(testdir_path, "/dir_two/new.png");
+    char *new_file = append_strings(testdir_path, "/dir_two/new.png");
+    char *old_file = append_strings(testdir_path, "/dir_two/apa.png");
+    wait_until_in_tree(new_file);
+
+    assert_numbers_equals("Snapshot not used after creation ─ New file", TRUE,
+                          get_child_in_directory(monitor_test_tree, new_file) != NULL);
+    assert_numbers_equals("Snapshot not used after creation ─ No old file", TRUE,
+                          get_child_in_directory(monitor_test_tree, old_file) == NULL);
+
+    // The directory is monitored.
+    create_file(testdir_path, "/dir_two/later.png");
+    char *later_file = append_strings(testdir_path, "/dir_two/later.png");
+    wait_until_in_tree(later_file);
+    assert_numbers_equals("Snapshot not used after creation ─ Monitored", TRUE,
+                          get_child_in_directory(monitor_test_tree, later_file) != NULL);
+
+    free(dir);
+    free(new_file);
+    free(old_file);
+    free(later_file);
+    set_snapshot_directory(NULL);
+    remove_snapshots();
+    after();
+}
+
+static void test_filemonitor_snapshot_packedDirectories() {
+    before();
+    set_snapshot_directory(SNAPSHOTDIR);
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    pretty_print_tree(monitor_test_tree, output);
+    char *expected = g_strdup(output);
+
+    pack_file_only_directories(monitor_test_tree, 3);
+    // Handed out, and thereby linked into its packed directory.
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/img1.png");
+    assert_numbers_equals("Snapshot of packed tree ─ Packed file found", TRUE,
+                          get_child_in_directory(monitor_test_tree, path) != NULL);
+    assert_numbers_equals("Snapshot of packed tree ─ Saved", TRUE, save_snapshot(monitor_test_tree, NULL));
+    free_whole_tree(monitor_test_tree);
+
+    reset_output();
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    pretty_print_tree(monitor_test_tree, output);
+    assert_equals("Snapshot of packed tree ─ Loaded as saved", expected, output);
+
+    g_free(expected);
+    free(path);
+    set_snapshot_directory(NULL);
+    remove_snapshots();
+    after();
+}
+
+static void test_filemonitor_snapshot_noDirectory() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    GError *error = NULL;
+    assert_numbers_equals("Snapshot without directory ─ Not saved", FALSE, save_snapshot(monitor_test_tree, &error));
+    assert_error_is_not_null(error);
+    g_error_free(error);
+
+    after();
+}
+
+
+void test_filemon_snapshot() {
+    test_filemonitor_snapshot_loadAndCatchUp();
+    test_filemonitor_snapshot_otherSettingsReadFromDisk();
+    test_filemonitor_snapshot_notUsedAfterCreation();
+    test_filemonitor_snapshot_packedDirectories();
+    test_filemonitor_snapshot_noDirectory();
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-filemon-statistics.h"
+#include "utils.h"
+
+
+static void test_filemonitor_statistics_createFile() {
+    struct MonitorStatistics statistics;
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    assert_numbers_equals("Statistics before enabling ─ Kept", FALSE,
+                          get_monitor_statistics(monitor_test_tree, &statistics));
+    set_monitor_statistics(monitor_test_tree, TRUE);
+
+    create_file(testdir_path, "/dir_two/sub_dir_one/img3.png");
+    wait_until_file_system_changes_is_as_expected(1);
+
+    assert_numbers_equals("Statistics after create ─ Kept", TRUE,
+                          get_monitor_statistics(monitor_test_tree, &statistics));
+    assert_numbers_equals("Statistics after create ─ Events received", TRUE,
+                          statistics.events_received >= 1);
+    assert_numbers_equals("Statistics after create ─ Changes reported", 1, statistics.changes_reported);
+    assert_numbers_equals("Statistics after create ─ Total count", 1, statistics.total.count);
+    assert_numbers_equals("Statistics after create ─ Percentiles ordered", TRUE,
+                          latency_histogram_get_percentile(&statistics.total, 100) >=
+                          latency_histogram_get_percentile(&statistics.total, 50));
+    assert_numbers_equals("Statistics after create ─ Max is upper bound", TRUE,
+                          latency_histogram_get_percentile(&statistics.total, 100) <= statistics.total.max_usec);
+
+    set_monitor_statistics(monitor_test_tree, FALSE);
+    assert_numbers_equals("Statistics after disabling ─ Kept", FALSE,
+                          get_monitor_statistics(monitor_test_tree, &statistics));
+    after();
+}
+
+
+
+void test_filemon_statistics() {
+    test_filemonitor_statistics_createFile();
+}
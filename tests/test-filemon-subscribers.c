@@ -0,0 +1,160 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "test-filemon-subscribers.h"
+#include "utils.h"
+
+
+static int subscriber_calls;
+static TreeEvent last_event;
+static char *last_path;
+
+
+static void subscriber(TreeEvent event, char *path, GNode *node, GNode *root, gpointer data) {
+    (void) node;
+    (void) root;
+    (void) data;
+    subscriber_calls++;
+    last_event = event;
+    g_free(last_path);
+    last_path = g_strdup(path);
+}
+
+static void wait_for_events() {
+    clock_t start = clock();
+    while((clock() - start) / CLOCKS_PER_SEC < 1) {
+        g_main_context_iteration(NULL, FALSE);
+    }
+}
+
+static void reset_subscriber() {
+    subscriber_calls = 0;
+    g_free(last_path);
+    last_path = NULL;
+}
+
+static GNode* get_subtree(char *relative_path) {
+    char *path = append_strings(testdir_path, relative_path);
+    GNode *subtree = get_child_in_directory(monitor_test_tree, path);
+    free(path);
+    return subtree;
+}
+
+static void test_filemonitor_subscribers_onlyCalledForSubtree() {
+    before();
+    reset_subscriber();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    GNode *subtree = get_subtree("/dir_two/sub_dir_one");
+    guint id = add_subscriber(subtree, TREE_EVENT_ALL, subscriber, NULL);
+    assert_numbers_equals("Subscribers ─ Id", TRUE, id != 0);
+
+    create_file(testdir_path, "/dir_one/sub.jpg");
+    wait_until_file_system_changes_is_as_expected(1);
+    assert_numbers_equals("Subscribers outside subtree ─ Changes", 1, file_system_changes);
+    assert_numbers_equals("Subscribers outside subtree ─ Calls", 0, subscriber_calls);
+
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/sub.png");
+    create_file(testdir_path, "/dir_two/sub_dir_one/sub.png");
+    wait_until_file_system_changes_is_as_expected(2);
+    assert_numbers_equals("Subscribers inside subtree ─ Changes", 2, file_system_changes);
+    assert_numbers_equals("Subscribers inside subtree ─ Calls", 1, subscriber_calls);
+    assert_numbers_equals("Subscribers inside subtree ─ Event", TREE_EVENT_ADDED, last_event);
+    assert_equals("Subscribers inside subtree ─ Path", path, last_path);
+
+    assert_numbers_equals("Subscribers ─ Remove", TRUE, remove_subscriber(monitor_test_tree, id));
+    assert_numbers_equals("Subscribers ─ Remove again", FALSE, remove_subscriber(monitor_test_tree, id));
+    remove_file(testdir_path, "/dir_two/sub_dir_one/sub.png");
+    wait_until_file_system_changes_is_as_expected(3);
+    assert_numbers_equals("Subscribers after remove ─ Calls", 1, subscriber_calls);
+    free(path);
+
+    after();
+}
+
+static void test_filemonitor_subscribers_onlyCalledForEventsInMask() {
+    before();
+    reset_subscriber();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    add_subscriber(get_subtree("/dir_two"), TREE_EVENT_REMOVED, subscriber, NULL);
+
+    create_file(testdir_path, "/dir_two/sub_dir_two/sub.png");
+    wait_until_file_system_changes_is_as_expected(1);
+    assert_numbers_equals("Subscribers with mask, added ─ Calls", 0, subscriber_calls);
+
+    remove_file(testdir_path, "/dir_two/sub_dir_two/sub.png");
+    wait_until_file_system_changes_is_as_expected(2);
+    assert_numbers_equals("Subscribers with mask, removed ─ Calls", 1, subscriber_calls);
+    assert_numbers_equals("Subscribers with mask, removed ─ Event", TREE_EVENT_REMOVED, last_event);
+
+    after();
+}
+
+static void test_filemonitor_subscribers_moveOutOfSubtree() {
+    before();
+    reset_subscriber();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    add_subscriber(get_subtree("/dir_two/sub_dir_one"), TREE_EVENT_ALL, subscriber, NULL);
+
+    char *path_src = append_strings(testdir_path, "/dir_two/sub_dir_one/img0.png");
+    char *path_dst = append_strings(testdir_path, "/dir_two/sub_dir_two/img9.png");
+    rename(path_src, path_dst);
+    wait_for_events();
+
+    assert_numbers_equals("Subscribers move out of subtree ─ Calls", 1, subscriber_calls);
+    assert_numbers_equals("Subscribers move out of subtree ─ Event", TREE_EVENT_REMOVED, last_event);
+    assert_equals("Subscribers move out of subtree ─ Path", path_src, last_path);
+    free(path_src);
+    free(path_dst);
+
+    after();
+}
+
+static void test_filemonitor_subscribers_endWhenSubtreeIsRemoved() {
+    before();
+    reset_subscriber();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    guint id = add_subscriber(get_subtree("/dir_two/sub_dir_three"), TREE_EVENT_REMOVED, subscriber, NULL);
+
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_three");
+    remove_directory(testdir_path, "/dir_two/sub_dir_three");
+    wait_for_events();
+
+    assert_numbers_equals("Subscribers with removed subtree ─ Calls", 1, subscriber_calls);
+    assert_equals("Subscribers with removed subtree ─ Path", path, last_path);
+    assert_numbers_equals("Subscribers with removed subtree ─ Ended", FALSE, remove_subscriber(monitor_test_tree, id));
+    free(path);
+
+    after();
+}
+
+
+void test_filemon_subscribers() {
+    test_filemonitor_subscribers_onlyCalledForSubtree();
+    test_filemonitor_subscribers_onlyCalledForEventsInMask();
+    test_filemonitor_subscribers_moveOutOfSubtree();
+    test_filemonitor_subscribers_endWhenSubtreeIsRemoved();
+    reset_subscriber();
+}
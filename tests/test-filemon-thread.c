@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-filemon-thread.h"
+#include "utils.h"
+
+
+static void test_filemonitor_thread_createPopulatedDir() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    assert_numbers_equals("Monitor thread ─ Set", TRUE, set_monitor_thread(monitor_test_tree));
+
+    create_dir (testdir_path, "/dir_new");
+    create_file(testdir_path, "/dir_new/fepa.jpg");
+    create_file(testdir_path, "/dir_new/gepa.jpg");
+
+    char *path = append_strings(testdir_path, "/dir_new");
+    wait_until_file_system_changes_is_as_expected(1);
+    GNode *node = get_child_in_directory(monitor_test_tree, path);
+
+    assert_numbers_equals("Monitor thread ─ Directory added", TRUE, node != NULL);
+
+    char* expected_dir = KWHT "dir_new" RESET " (2 children)\n\
+├─ fepa.jpg\n\
+└─ gepa.jpg\n\
+";
+    wait_until_tree_is_as_expected(node, expected_dir);
+    assert_equals("Monitor thread ─ Directory populated", expected_dir, output);
+
+    char *fepa_path = append_strings(path, "/fepa.jpg");
+    char *gepa_path = append_strings(path, "/gepa.jpg");
+    GNode *fepa = get_child_in_directory(node, fepa_path);
+    GNode *gepa = get_child_in_directory(node, gepa_path);
+    assert_numbers_equals("Monitor thread ─ fepa.jpg in directory", TRUE, fepa != NULL && fepa->parent == node);
+    assert_numbers_equals("Monitor thread ─ gepa.jpg in directory", TRUE, gepa != NULL && gepa->parent == node);
+    if(fepa != NULL && gepa != NULL) {
+        assert_equals("Monitor thread ─ fepa.jpg path", fepa_path, ((VnrFile*) fepa->data)->path);
+        assert_equals("Monitor thread ─ gepa.jpg path", gepa_path, ((VnrFile*) gepa->data)->path);
+    }
+
+    free(fepa_path);
+    free(gepa_path);
+    free(path);
+    after();
+}
+
+static void test_filemonitor_thread_createAndDeleteFile() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, TRUE);
+    set_monitor_thread(monitor_test_tree);
+
+    create_file(testdir_path, "/fepa.jpg");
+    wait_until_file_system_changes_is_as_expected(1);
+    remove_file(testdir_path, "/fepa.jpg");
+    wait_until_file_system_changes_is_as_expected(2);
+
+    char *path = append_strings(testdir_path, "/fepa.jpg");
+    assert_numbers_equals("Monitor thread ─ File added and removed", 2, file_system_changes);
+    assert_numbers_equals("Monitor thread ─ File gone", TRUE, get_child_in_directory(monitor_test_tree, path) == NULL);
+
+    free(path);
+    after();
+}
+
+
+
+void test_filemon_thread() {
+    test_filemonitor_thread_createPopulatedDir();
+    test_filemonitor_thread_createAndDeleteFile();
+}
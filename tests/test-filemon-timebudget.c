@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "test-filemon-timebudget.h"
+#include "utils.h"
+
+#define NUMBER_OF_FILES 20
+
+
+static void wait_for_events() {
+    clock_t start = clock();
+    while((clock() - start) / CLOCKS_PER_SEC < 1) {
+        g_main_context_iteration(NULL, FALSE);
+    }
+}
+
+
+static void test_filemonitor_timebudget_createManyFiles() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, FALSE);
+    assert_numbers_equals("Time budget ─ Set", TRUE, set_event_time_budget(monitor_test_tree, 1));
+
+    int i;
+    for(i = 0; i < NUMBER_OF_FILES; i++) {
+        char name[32];
+        sprintf(name, "/burst%02d.jpg", i);
+        create_file(testdir_path, name);
+    }
+
+    wait_until_file_system_changes_is_as_expected(NUMBER_OF_FILES);
+
+    assert_numbers_equals("Time budget ─ All files added", NUMBER_OF_FILES, file_system_changes);
+    assert_numbers_equals("Time budget ─ Files in tree", 3 + NUMBER_OF_FILES, g_node_n_children(monitor_test_tree));
+
+    after();
+}
+
+static void test_filemonitor_timebudget_turnOffAppliesQueued() {
+    before();
+
+    monitor_test_tree = single_folder(FALSE, FALSE);
+    set_event_time_budget(monitor_test_tree, 1);
+    set_event_coalescing(monitor_test_tree, 10000);
+
+    create_file(testdir_path, "/fepa.jpg");
+    wait_for_events();
+    assert_numbers_equals("Time budget off ─ Held back", 0, file_system_changes);
+
+    set_event_coalescing(monitor_test_tree, 0);
+    set_event_time_budget(monitor_test_tree, 0);
+    assert_numbers_equals("Time budget off ─ Applied", 1, file_system_changes);
+
+    after();
+}
+
+
+
+void test_filemon_timebudget() {
+    test_filemonitor_timebudget_createManyFiles();
+    test_filemonitor_timebudget_turnOffAppliesQueued();
+}
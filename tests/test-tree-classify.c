@@ -0,0 +1,131 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include "test-tree-classify.h"
+#include "utils.h"
+
+
+#define CACHEDIR TESTDIRBASE "c-trees-classification"
+#define CACHEFILE CACHEDIR "/cache"
+
+
+static void remove_cache() {
+    remove_directory(TESTDIRBASE, "c-trees-classification");
+}
+
+static void test_classify_SameTreeWithCache() {
+    before();
+
+    GNode *expected = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    assert_numbers_equals("Classification cache ─ Set", TRUE, set_classification_cache(CACHEFILE, NULL));
+
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    assert_trees_equal("Classification cache ─ Same tree when filling cache", expected, tree);
+    free_whole_tree(tree);
+
+    tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    assert_trees_equal("Classification cache ─ Same tree from cache", expected, tree);
+    free_whole_tree(tree);
+
+    free_whole_tree(expected);
+    set_classification_cache(NULL, NULL);
+    after();
+}
+
+static void test_classify_SavedAndReadAgain() {
+    before();
+
+    GNode *expected = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    set_classification_cache(CACHEFILE, NULL);
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    free_whole_tree(tree);
+    assert_numbers_equals("Classification cache ─ Saved", TRUE, save_classification_cache(NULL));
+
+    GError *error = NULL;
+    assert_numbers_equals("Classification cache ─ Read again", TRUE, set_classification_cache(CACHEFILE, &error));
+    assert_error_is_null(error);
+    tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    assert_trees_equal("Classification cache ─ Same tree from saved cache", expected, tree);
+    free_whole_tree(tree);
+
+    free_whole_tree(expected);
+    set_classification_cache(NULL, NULL);
+    remove_cache();
+    after();
+}
+
+static void test_classify_ChangedFileLookedAtAgain() {
+    before();
+
+    char *path = append_strings(testdir_path, "/not_an_image.yo");
+    char *png = append_strings(testdir_path, "/now_an_image.png");
+    set_classification_cache(CACHEFILE, NULL);
+
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    assert_numbers_equals("Classification cache ─ Not an image", TRUE, get_child_in_directory(tree, path) == NULL);
+    free_whole_tree(tree);
+
+    create_file(testdir_path, "/now_an_image.png");
+    rename(png, path);
+
+    tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    assert_numbers_equals("Classification cache ─ Replaced by an image", TRUE, get_child_in_directory(tree, path) != NULL);
+    free_whole_tree(tree);
+
+    free(path);
+    free(png);
+    set_classification_cache(NULL, NULL);
+    after();
+}
+
+static void test_classify_Errors() {
+    before();
+
+    GNode *expected = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    GError *error = NULL;
+    assert_numbers_equals("Classification cache ─ Not saved without cache", FALSE, save_classification_cache(&error));
+    assert_error_is_not_null(error);
+    g_clear_error(&error);
+
+    g_mkdir_with_parents(CACHEDIR, 0700);
+    g_file_set_contents(CACHEFILE, "not a cache", -1, NULL);
+    assert_numbers_equals("Classification cache ─ Unreadable cache", FALSE, set_classification_cache(CACHEFILE, &error));
+    assert_error_is_not_null(error);
+    g_clear_error(&error);
+
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    assert_trees_equal("Classification cache ─ Starts out empty", expected, tree);
+    set_classification_cache(NULL, NULL);
+
+    free_whole_tree(expected);
+    free_whole_tree(tree);
+    remove_cache();
+    after();
+}
+
+
+void test_tree_classify() {
+    test_classify_SameTreeWithCache();
+    test_classify_SavedAndReadAgain();
+    test_classify_ChangedFileLookedAtAgain();
+    test_classify_Errors();
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-tree-compact.h"
+#include "utils.h"
+
+
+static void test_compact_NoDirectories_NoAutomaticCompaction() {
+    before();
+
+    GNode *tree = uri_list_with_no_entries(FALSE, FALSE);
+
+    assert_numbers_equals("Compact ─ No directories ─ Not enabled", FALSE, set_automatic_compaction(tree, 50));
+    assert_numbers_equals("Compact ─ No directories ─ Nothing moved", 0, compact_tree(tree));
+
+    free_whole_tree(tree);
+    after();
+}
+
+static void test_compact_NodesKeepTheirIdentity() {
+    before();
+
+    GNode *expected = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_two/img3.png");
+    GNode *node = get_child_in_directory(tree, path);
+
+    assert_numbers_equals("Compact ─ Strings are moved", TRUE, compact_tree(tree) > 0);
+    assert_numbers_equals("Compact ─ Same node after compaction", TRUE, node == get_child_in_directory(tree, path));
+    assert_equals("Compact ─ Path is kept", path, ((VnrFile*) node->data)->path);
+    assert_trees_equal("Compact ─ Tree is unchanged", expected, tree);
+
+    // Compacting a compacted tree releases the first block.
+    assert_numbers_equals("Compact ─ Strings are moved again", TRUE, compact_tree(tree) > 0);
+    assert_trees_equal("Compact ─ Tree is unchanged after second compaction", expected, tree);
+
+    free(path);
+    free_whole_tree(expected);
+    free_whole_tree(tree);
+    after();
+}
+
+
+
+void test_tree_compact() {
+    test_compact_NoDirectories_NoAutomaticCompaction();
+    test_compact_NodesKeepTheirIdentity();
+}
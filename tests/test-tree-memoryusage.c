@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-tree-memoryusage.h"
+#include "utils.h"
+
+
+static void test_memoryUsage_NullIn() {
+    before();
+
+    struct MemoryUsage usage;
+    get_tree_memory_usage(NULL, &usage);
+
+    assert_numbers_equals("Memory usage ─ Null input ─ Nodes", 0, (int) usage.nodes);
+    assert_numbers_equals("Memory usage ─ Null input ─ Total", 0, (int) usage.total);
+
+    after();
+}
+
+static void test_memoryUsage_SingleFolder_CountsEveryNode() {
+    before();
+
+    struct MemoryUsage usage;
+    GNode *tree = single_folder(FALSE, FALSE);
+
+// THIS IS THE STRUCTURE:
+//
+// test-dir (3 children)
+// ├─ bepa.png
+// ├─ cepa.jpg
+// └─ epa.png
+
+    get_tree_memory_usage(tree, &usage);
+    assert_numbers_equals("Memory usage ─ Single folder ─ Nodes", (int) (4 * sizeof(GNode)), (int) usage.nodes);
+    assert_numbers_equals("Memory usage ─ Single folder ─ Files", (int) (4 * sizeof(VnrFile)), (int) usage.files);
+    assert_numbers_equals("Memory usage ─ Single folder ─ Monitoring data", (int) sizeof(struct MonitoringData), (int) usage.monitoring_data);
+    assert_numbers_equals("Memory usage ─ Single folder ─ Total is sum",
+                          (int) (usage.nodes + usage.files + usage.paths + usage.display_names + usage.collate_keys +
+                                 usage.monitors + usage.monitoring_data + usage.indexes),
+                          (int) usage.total);
+
+    struct MemoryUsage from_leaf;
+    get_tree_memory_usage(get_last_in_tree(tree), &from_leaf);
+    assert_numbers_equals("Memory usage ─ Single folder ─ Same no matter where in the tree", (int) usage.total, (int) from_leaf.total);
+
+    free_whole_tree(tree);
+    after();
+}
+
+static void ignore_event(TreeEvent event, char *path, GNode *node, GNode *root, gpointer data) {
+    (void) event;
+    (void) path;
+    (void) node;
+    (void) root;
+    (void) data;
+}
+
+static void test_memoryUsage_Subscribers_CountedAsIndexes() {
+    before();
+
+    struct MemoryUsage before_subscribing, after_subscribing;
+    GNode *tree = single_folder(FALSE, FALSE);
+
+    get_tree_memory_usage(tree, &before_subscribing);
+    add_subscriber(tree, TREE_EVENT_ALL, ignore_event, NULL);
+    get_tree_memory_usage(tree, &after_subscribing);
+
+    assert_numbers_equals("Memory usage ─ Subscribers ─ Indexes grow", TRUE,
+                          after_subscribing.indexes > before_subscribing.indexes);
+    assert_numbers_equals("Memory usage ─ Subscribers ─ Nothing else changes",
+                          (int) (before_subscribing.total - before_subscribing.indexes),
+                          (int) (after_subscribing.total - after_subscribing.indexes));
+
+    free_whole_tree(tree);
+    after();
+}
+
+static void test_memoryUsage_Total_FollowsTreeLifetime() {
+    before();
+
+    struct MemoryUsage before_creation, after_creation, after_free, tree_usage;
+    get_total_memory_usage(&before_creation);
+
+    GNode *tree = uri_list(TRUE, TRUE);
+    get_tree_memory_usage(tree, &tree_usage);
+    get_total_memory_usage(&after_creation);
+
+    assert_numbers_equals("Memory usage ─ Total ─ Increases by the size of the tree",
+                          (int) (before_creation.total + tree_usage.total), (int) after_creation.total);
+
+    free_whole_tree(tree);
+    get_total_memory_usage(&after_free);
+    assert_numbers_equals("Memory usage ─ Total ─ Decreases when the tree is freed",
+                          (int) before_creation.total, (int) after_free.total);
+
+    after();
+}
+
+
+
+void test_tree_memoryusage() {
+    test_memoryUsage_NullIn();
+    test_memoryUsage_SingleFolder_CountsEveryNode();
+    test_memoryUsage_Subscribers_CountedAsIndexes();
+    test_memoryUsage_Total_FollowsTreeLifetime();
+}
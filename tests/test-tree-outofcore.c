@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-tree-outofcore.h"
+#include "utils.h"
+
+
+static void test_outOfCore_NoDirectories_CannotBeEnabled() {
+    before();
+
+    GError *error = NULL;
+    GNode *tree = uri_list_with_no_entries(FALSE, FALSE);
+
+    assert_numbers_equals("Out of core ─ No directories ─ Not enabled", FALSE, enable_out_of_core_mode(tree, 1, &error));
+    assert_error_is_not_null(error);
+
+    g_clear_error(&error);
+    free_whole_tree(tree);
+    after();
+}
+
+static void test_outOfCore_ColdSubtreesAreSpilledAndReadBack() {
+    before();
+
+    GError *error = NULL;
+    struct MemoryUsage resident, spilled;
+    GNode *expected = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+
+    assert_numbers_equals("Out of core ─ Enabled", TRUE, enable_out_of_core_mode(tree, 1, &error));
+    assert_error_is_null(error);
+    get_tree_memory_usage(tree, &resident);
+
+    // Only the path down to the returned file has been visited.
+    assert_numbers_equals("Out of core ─ dir_one and dir_two are spilled", 2, spill_cold_subtrees(tree));
+    get_tree_memory_usage(tree, &spilled);
+    assert_numbers_equals("Out of core ─ Less memory is used", TRUE, spilled.total < resident.total);
+    assert_numbers_equals("Out of core ─ Leaves are counted without reading back", 14, get_total_number_of_leaves(tree));
+
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_two/img3.png");
+    GNode *node = get_child_in_directory(tree, path);
+    assert_equals("Out of core ─ Spilled file is found", path, node == NULL ? "" : ((VnrFile*) node->data)->path);
+    free(path);
+
+    disable_out_of_core_mode(tree);
+    assert_trees_equal("Out of core ─ Tree is unchanged after reading everything back", expected, tree);
+
+    free_whole_tree(expected);
+    free_whole_tree(tree);
+    after();
+}
+
+static void test_outOfCore_HandedOutNodesAreNotSpilled() {
+    before();
+
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    enable_out_of_core_mode(tree, 1, NULL);
+
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_two/img3.png");
+    GNode *node = get_child_in_directory(tree, path);
+
+    // Long enough for dir_two to go cold, even though node is held.
+    g_usleep(1100 * 1000);
+    assert_numbers_equals("Out of core ─ Only dir_one is spilled", 1, spill_cold_subtrees(tree));
+    assert_equals("Out of core ─ Handed out node is kept", path, ((VnrFile*) node->data)->path);
+    assert_numbers_equals("Out of core ─ Same node is found again", TRUE, node == get_child_in_directory(tree, path));
+
+    free(path);
+    free_whole_tree(tree);
+    after();
+}
+
+
+
+void test_tree_outofcore() {
+    test_outOfCore_NoDirectories_CannotBeEnabled();
+    test_outOfCore_ColdSubtreesAreSpilledAndReadBack();
+    test_outOfCore_HandedOutNodesAreNotSpilled();
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright © 2009-2014 Siyan Panayotov <siyan.panayotov@gmail.com>
+ * Copyright © 2016-2018 Johan Sjöblom <sjoblomj88@gmail.com>
+ *
+ * This file is part of c-trees.
+ *
+ * c-trees is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * c-trees is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with c-trees.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test-tree-packed.h"
+#include "utils.h"
+
+
+static char* path_of(GNode *node) {
+    return node == NULL ? "" : ((VnrFile*) node->data)->path;
+}
+
+static void test_packed_FileOnlyDirectoriesArePacked() {
+    before();
+
+    GNode *expected = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+
+    assert_numbers_equals("Packed ─ sub_dir_one and sub_dir_two are packed", 2, pack_file_only_directories(tree, 3));
+    assert_numbers_equals("Packed ─ Leaves are counted", 14, get_total_number_of_leaves(tree));
+
+    unpack_directories(tree);
+    assert_trees_equal("Packed ─ Tree is unchanged after unpacking", expected, tree);
+
+    free_whole_tree(expected);
+    free_whole_tree(tree);
+    after();
+}
+
+static void test_packed_NavigationStepsThroughPackedFiles() {
+    before();
+
+    int position, total;
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    pack_file_only_directories(tree, 3);
+
+    char *img0 = append_strings(testdir_path, "/dir_two/sub_dir_one/img0.png");
+    char *img1 = append_strings(testdir_path, "/dir_two/sub_dir_one/img1.png");
+    char *img2 = append_strings(testdir_path, "/dir_two/sub_dir_one/img2.png");
+
+    GNode *node = get_child_in_directory(tree, img0);
+    assert_equals("Packed ─ Packed file is found", img0, path_of(node));
+    assert_numbers_equals("Packed ─ Same node is returned twice", TRUE, node == get_child_in_directory(tree, img0));
+
+    GNode *next = get_next_in_tree(node);
+    assert_equals("Packed ─ Next file", img1, path_of(next));
+    assert_equals("Packed ─ Next file again", img2, path_of(get_next_in_tree(next)));
+    assert_equals("Packed ─ Previous file", img0, path_of(get_prev_in_tree(next)));
+
+    get_leaf_position(node, &position, &total);
+    int node_position = position;
+    get_leaf_position(next, &position, &total);
+    assert_numbers_equals("Packed ─ Position of next file", node_position + 1, position);
+    assert_numbers_equals("Packed ─ Total", 14, total);
+
+    free(img0);
+    free(img1);
+    free(img2);
+    free_whole_tree(tree);
+    after();
+}
+
+static void test_packed_AddingFileUnpacksDirectory() {
+    before();
+
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    pack_file_only_directories(tree, 3);
+
+    char *dir  = append_strings(testdir_path, "/dir_two/sub_dir_one");
+    char *path = append_strings(testdir_path, "/dir_two/sub_dir_one/img9.png");
+    GNode *dir_node = get_child_in_directory(tree, dir);
+    add_node_in_tree(dir_node, g_node_new(vnr_file_create_new(path, "img9.png", FALSE)));
+
+    assert_numbers_equals("Packed ─ Directory is unpacked", 4, g_node_n_children(dir_node));
+    assert_numbers_equals("Packed ─ Leaves are counted", 15, get_total_number_of_leaves(tree));
+
+    free(dir);
+    free(path);
+    free_whole_tree(tree);
+    after();
+}
+
+static void test_packed_CreatedNodesAreLinkedAndKept() {
+    before();
+
+    GNode *tree = get_tree(SINGLE_FOLDER, FALSE, TRUE);
+    pack_file_only_directories(tree, 3);
+
+    char *img1 = append_strings(testdir_path, "/dir_two/sub_dir_one/img1.png");
+    GNode *node = get_child_in_directory(tree, img1);
+    GNode *dir_node = node->parent;
+    assert_numbers_equals("Packed ─ Created node is a child of its directory", TRUE, g_node_child_index(dir_node, node->data) >= 0);
+
+    unpack_directories(tree);
+    assert_numbers_equals("Packed ─ Unpacked directory has all children", 3, g_node_n_children(dir_node));
+    assert_numbers_equals("Packed ─ Packed again", TRUE, pack_file_only_directories(tree, 3) > 0);
+    assert_equals("Packed ─ Handed out node is kept when packed again", img1, path_of(node));
+    assert_numbers_equals("Packed ─ Same node is found again", TRUE, node == get_child_in_directory(tree, img1));
+
+    free(img1);
+    free_whole_tree(tree);
+    after();
+}
+
+
+
+void test_tree_packed() {
+    test_packed_FileOnlyDirectoriesArePacked();
+    test_packed_NavigationStepsThroughPackedFiles();
+    test_packed_AddingFileUnpacksDirectory();
+    test_packed_CreatedNodesAreLinkedAndKept();
+}
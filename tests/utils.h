@@ -44,6 +44,8 @@
 
 extern char* testdir_path;
 extern int errors;
+extern int file_system_changes;
+extern const int TIMEOUT;
 char* output;
 GNode* monitor_test_tree;
 